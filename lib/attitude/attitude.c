@@ -0,0 +1,293 @@
+#include "./attitude.h"
+
+// The further the accelerometer is from 1g the more of it is the drone accelerating and not gravity.
+// The trust in it goes down in a straight line and is gone at this distance
+#define ACCELEROMETER_TRUST_BAND_G 0.1f
+
+// Vibration that is left after the fifo averaging, taken off before the accelerometer is compared to 1g
+#define ACCELEROMETER_FILTER_HZ 10.0f
+
+// Close to the magnetic poles the field points almost straight down and there is no heading in it
+#define MAGNETOMETER_MIN_HORIZONTAL 0.1f
+
+// Rotation from the drone to the world. w, x, y, z
+static float m_q0 = 1.0f, m_q1 = 0.0f, m_q2 = 0.0f, m_q3 = 0.0f;
+
+static float m_proportional_gain = 0.0f;
+static float m_integral_gain = 0.0f;
+static float m_integral_error[3] = {0.0f, 0.0f, 0.0f}; // rad/s, ends up as the gyro bias
+
+// The magnetometer is slower than the loop. Its correction covers all the updates since its last sample
+static float m_time_since_magnetometer = 0.0f;
+
+static struct attitude_accelerometer_filter m_accelerometer_filter;
+
+// Gains are per second. A proportional gain of 1 pulls the gyro towards the accelerometer with about a 1 second time constant.
+// The integral gain slowly learns the gyro bias, 0 turns that off
+uint8_t init_attitude(float proportional_gain, float integral_gain)
+{
+    m_proportional_gain = proportional_gain;
+    m_integral_gain = integral_gain;
+
+    m_q0 = 1.0f;
+    m_q1 = 0.0f;
+    m_q2 = 0.0f;
+    m_q3 = 0.0f;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_integral_error[i] = 0.0f;
+    }
+    m_time_since_magnetometer = 0.0f;
+    attitude_accelerometer_filter_reset(&m_accelerometer_filter);
+
+    return 1;
+}
+
+// Start from the measured attitude instead of waiting for the filter to get there. Needs the drone to be still
+void attitude_set_from_sensors(const float accelerometer[3], const float magnetometer[3])
+{
+    float ax = accelerometer[0], ay = accelerometer[1], az = accelerometer[2];
+    float norm = fast_sqrtf(ax * ax + ay * ay + az * az);
+    if (norm == 0.0f)
+    {
+        return;
+    }
+
+    float roll = fast_atan2f(ay, az);
+    float sin_pitch = -ax / norm;
+    sin_pitch = sin_pitch > 1.0f ? 1.0f : (sin_pitch < -1.0f ? -1.0f : sin_pitch);
+    float pitch = fast_asinf(sin_pitch);
+
+    // Magnetometer rotated back to level, the world x axis points to magnetic north
+    float yaw = 0.0f;
+    if (magnetometer != NULL)
+    {
+        float sin_roll = fast_sinf(roll), cos_roll = fast_cosf(roll);
+        float cos_pitch = fast_cosf(pitch);
+        float mx = magnetometer[0], my = magnetometer[1], mz = magnetometer[2];
+        float level_x = mx * cos_pitch + (my * sin_roll + mz * cos_roll) * sin_pitch;
+        float level_y = my * cos_roll - mz * sin_roll;
+        yaw = fast_atan2f(-level_y, level_x);
+    }
+
+    float cr = fast_cosf(roll * 0.5f), sr = fast_sinf(roll * 0.5f);
+    float cp = fast_cosf(pitch * 0.5f), sp = fast_sinf(pitch * 0.5f);
+    float cy = fast_cosf(yaw * 0.5f), sy = fast_sinf(yaw * 0.5f);
+    m_q0 = cr * cp * cy + sr * sp * sy;
+    m_q1 = sr * cp * cy - cr * sp * sy;
+    m_q2 = cr * sp * cy + sr * cp * sy;
+    m_q3 = cr * cp * sy - sr * sp * cy;
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_integral_error[i] = 0.0f;
+    }
+    m_time_since_magnetometer = 0.0f;
+    attitude_accelerometer_filter_reset(&m_accelerometer_filter);
+}
+
+// One step of the filter. dt in seconds. Pass NULL as the magnetometer when it has nothing new,
+// the next sample makes up for the skipped updates
+void attitude_update(const float gyro_dps[3], const float accelerometer[3], const float *magnetometer, float dt)
+{
+    if (dt <= 0.0f)
+    {
+        return;
+    }
+
+    float gx = gyro_dps[0] * DEGREES_TO_RADIANS_F;
+    float gy = gyro_dps[1] * DEGREES_TO_RADIANS_F;
+    float gz = gyro_dps[2] * DEGREES_TO_RADIANS_F;
+
+    float q0 = m_q0, q1 = m_q1, q2 = m_q2, q3 = m_q3;
+
+    // Where the filter thinks up is in the drone frame, halved. Third row of the rotation matrix
+    float half_vx = q1 * q3 - q0 * q2;
+    float half_vy = q0 * q1 + q2 * q3;
+    float half_vz = q0 * q0 - 0.5f + q3 * q3;
+
+    float half_ex = 0.0f, half_ey = 0.0f, half_ez = 0.0f;
+
+    float up[3];
+    float trust = attitude_accelerometer_filter_update(&m_accelerometer_filter, accelerometer, dt, up);
+    if (trust > 0.0f)
+    {
+        // Cross product of the measured and the estimated up is the rotation between them
+        half_ex += trust * (up[1] * half_vz - up[2] * half_vy);
+        half_ey += trust * (up[2] * half_vx - up[0] * half_vz);
+        half_ez += trust * (up[0] * half_vy - up[1] * half_vx);
+    }
+
+    m_time_since_magnetometer += dt;
+    if (magnetometer != NULL)
+    {
+        float mx = magnetometer[0], my = magnetometer[1], mz = magnetometer[2];
+        float magnetometer_norm_squared = mx * mx + my * my + mz * mz;
+        if (magnetometer_norm_squared > 0.0f)
+        {
+            float inverse_norm = fast_inverse_sqrtf(magnetometer_norm_squared);
+            mx *= inverse_norm;
+            my *= inverse_norm;
+            mz *= inverse_norm;
+
+            // Field in the world frame, then flattened so it only has north and down parts
+            float hx = 2.0f * (mx * (0.5f - q2 * q2 - q3 * q3) + my * (q1 * q2 - q0 * q3) + mz * (q1 * q3 + q0 * q2));
+            float hy = 2.0f * (mx * (q1 * q2 + q0 * q3) + my * (0.5f - q1 * q1 - q3 * q3) + mz * (q2 * q3 - q0 * q1));
+            float bx = fast_sqrtf(hx * hx + hy * hy);
+            float bz = 2.0f * (mx * (q1 * q3 - q0 * q2) + my * (q2 * q3 + q0 * q1) + mz * (0.5f - q1 * q1 - q2 * q2));
+
+            // That field back in the drone frame, halved
+            float half_wx = bx * (0.5f - q2 * q2 - q3 * q3) + bz * (q1 * q3 - q0 * q2);
+            float half_wy = bx * (q1 * q2 - q0 * q3) + bz * (q0 * q1 + q2 * q3);
+            float half_wz = bx * (q0 * q2 + q1 * q3) + bz * (0.5f - q1 * q1 - q2 * q2);
+
+            float mag_ex = my * half_wz - mz * half_wy;
+            float mag_ey = mz * half_wx - mx * half_wz;
+            float mag_ez = mx * half_wy - my * half_wx;
+
+            // Only keep the part around the up axis. A disturbed field can turn the heading but not tilt the horizon.
+            // The error shrinks with the horizontal part of the field squared, divided out so the heading converges
+            // as fast as the tilt does no matter the inclination
+            float along_up = 4.0f * (mag_ex * half_vx + mag_ey * half_vy + mag_ez * half_vz);
+            float scale = bx > MAGNETOMETER_MIN_HORIZONTAL ? m_time_since_magnetometer / (dt * bx * bx) : 0.0f;
+            half_ex += along_up * half_vx * scale;
+            half_ey += along_up * half_vy * scale;
+            half_ez += along_up * half_vz * scale;
+        }
+        m_time_since_magnetometer = 0.0f;
+    }
+
+    if (m_integral_gain > 0.0f)
+    {
+        m_integral_error[0] += 2.0f * m_integral_gain * half_ex * dt;
+        m_integral_error[1] += 2.0f * m_integral_gain * half_ey * dt;
+        m_integral_error[2] += 2.0f * m_integral_gain * half_ez * dt;
+        gx += m_integral_error[0];
+        gy += m_integral_error[1];
+        gz += m_integral_error[2];
+    }
+
+    gx += 2.0f * m_proportional_gain * half_ex;
+    gy += 2.0f * m_proportional_gain * half_ey;
+    gz += 2.0f * m_proportional_gain * half_ez;
+
+    // q' = q + 0.5 * q * (0, gx, gy, gz) * dt
+    gx *= 0.5f * dt;
+    gy *= 0.5f * dt;
+    gz *= 0.5f * dt;
+    m_q0 = q0 - q1 * gx - q2 * gy - q3 * gz;
+    m_q1 = q1 + q0 * gx + q2 * gz - q3 * gy;
+    m_q2 = q2 + q0 * gy - q1 * gz + q3 * gx;
+    m_q3 = q3 + q0 * gz + q1 * gy - q2 * gx;
+
+    float inverse_norm = fast_inverse_sqrtf(m_q0 * m_q0 + m_q1 * m_q1 + m_q2 * m_q2 + m_q3 * m_q3);
+    m_q0 *= inverse_norm;
+    m_q1 *= inverse_norm;
+    m_q2 *= inverse_norm;
+    m_q3 *= inverse_norm;
+}
+
+void attitude_get_quaternion(float quaternion[4])
+{
+    quaternion[0] = m_q0;
+    quaternion[1] = m_q1;
+    quaternion[2] = m_q2;
+    quaternion[3] = m_q3;
+}
+
+// Drone frame to world frame. No trig, only multiplies
+void attitude_quaternion_to_rotation_matrix(const float quaternion[4], float rotation[3][3])
+{
+    float q0 = quaternion[0], q1 = quaternion[1], q2 = quaternion[2], q3 = quaternion[3];
+
+    rotation[0][0] = 1.0f - 2.0f * (q2 * q2 + q3 * q3);
+    rotation[0][1] = 2.0f * (q1 * q2 - q0 * q3);
+    rotation[0][2] = 2.0f * (q1 * q3 + q0 * q2);
+    rotation[1][0] = 2.0f * (q1 * q2 + q0 * q3);
+    rotation[1][1] = 1.0f - 2.0f * (q1 * q1 + q3 * q3);
+    rotation[1][2] = 2.0f * (q2 * q3 - q0 * q1);
+    rotation[2][0] = 2.0f * (q1 * q3 - q0 * q2);
+    rotation[2][1] = 2.0f * (q0 * q1 + q2 * q3);
+    rotation[2][2] = 1.0f - 2.0f * (q1 * q1 + q2 * q2);
+}
+
+// Rotation around x, rotation around y and the compass heading in degrees.
+// The heading grows clockwise seen from above like calculate_yaw_tilt_compensated, which is the opposite of the gyro z axis
+void attitude_quaternion_to_euler_degrees(const float quaternion[4], float degrees[3])
+{
+    float q0 = quaternion[0], q1 = quaternion[1], q2 = quaternion[2], q3 = quaternion[3];
+
+    degrees[0] = fast_atan2f(2.0f * (q0 * q1 + q2 * q3), 1.0f - 2.0f * (q1 * q1 + q2 * q2)) * RADIANS_TO_DEGREES_F;
+
+    float sin_pitch = 2.0f * (q0 * q2 - q3 * q1);
+    sin_pitch = sin_pitch > 1.0f ? 1.0f : (sin_pitch < -1.0f ? -1.0f : sin_pitch);
+    degrees[1] = fast_asinf(sin_pitch) * RADIANS_TO_DEGREES_F;
+
+    degrees[2] = -fast_atan2f(2.0f * (q0 * q3 + q1 * q2), 1.0f - 2.0f * (q2 * q2 + q3 * q3)) * RADIANS_TO_DEGREES_F;
+}
+
+void attitude_get_rotation_matrix(float rotation[3][3])
+{
+    float quaternion[4] = {m_q0, m_q1, m_q2, m_q3};
+    attitude_quaternion_to_rotation_matrix(quaternion, rotation);
+}
+
+void attitude_get_euler_degrees(float degrees[3])
+{
+    float quaternion[4] = {m_q0, m_q1, m_q2, m_q3};
+    attitude_quaternion_to_euler_degrees(quaternion, degrees);
+}
+
+// What the integral part has learned, already removed from the gyro rates inside the filter
+void attitude_get_gyro_bias_dps(float bias[3])
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        bias[i] = -m_integral_error[i] * RADIANS_TO_DEGREES_F;
+    }
+}
+
+void attitude_accelerometer_filter_reset(struct attitude_accelerometer_filter *filter)
+{
+    filter->started = 0;
+}
+
+// Low pass with the factor worked out from the measured dt, so a late loop does not move the cutoff.
+// unit is the filtered reading made length 1. Returns the trust, 1 at exactly 1g down to 0 at the edge of
+// the band. unit is not set when it is 0
+float attitude_accelerometer_filter_update(struct attitude_accelerometer_filter *filter, const float accelerometer[3], float dt, float unit[3])
+{
+    if (!filter->started)
+    {
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            filter->filtered[i] = accelerometer[i];
+        }
+        filter->started = 1;
+    }
+    else if (dt > 0.0f)
+    {
+        float factor = dt / (dt + 1.0f / (2.0f * (float)M_PI * ACCELEROMETER_FILTER_HZ));
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            filter->filtered[i] += factor * (accelerometer[i] - filter->filtered[i]);
+        }
+    }
+
+    float norm_squared = filter->filtered[0] * filter->filtered[0] + filter->filtered[1] * filter->filtered[1] + filter->filtered[2] * filter->filtered[2];
+    if (norm_squared <= 0.0f)
+    {
+        return 0.0f;
+    }
+    float inverse_norm = fast_inverse_sqrtf(norm_squared);
+    float trust = 1.0f - fabsf(norm_squared * inverse_norm - 1.0f) / ACCELEROMETER_TRUST_BAND_G;
+    if (trust <= 0.0f)
+    {
+        return 0.0f;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        unit[i] = filter->filtered[i] * inverse_norm;
+    }
+    return trust;
+}
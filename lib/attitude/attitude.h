@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../fastmath/fastmath.h"
+#include <math.h>
+
+// Quaternion attitude estimate from the gyro, accelerometer and magnetometer (Mahony filter).
+// The gyro is integrated as a quaternion so there is no gimbal lock and no angle wrapping. The accelerometer
+// and magnetometer errors are cross products fed back into the gyro rates, so an update is a few
+// multiplies and square roots without trig. Trig is only used when Euler angles are asked for.
+//
+// Frames are the mpu6050 ones: x, y, z right handed with z up and the accelerometer reading +1g on z when level.
+
+// Low passed accelerometer and how far it can be trusted to be gravity. Shared with lib/attitude_ekf
+struct attitude_accelerometer_filter {
+    float filtered[3];
+    uint8_t started;
+};
+
+uint8_t init_attitude(float proportional_gain, float integral_gain);
+void attitude_set_from_sensors(const float accelerometer[3], const float magnetometer[3]);
+void attitude_update(const float gyro_dps[3], const float accelerometer[3], const float *magnetometer, float dt);
+void attitude_get_quaternion(float quaternion[4]);
+void attitude_get_rotation_matrix(float rotation[3][3]);
+void attitude_get_euler_degrees(float degrees[3]);
+void attitude_get_gyro_bias_dps(float bias[3]);
+void attitude_quaternion_to_rotation_matrix(const float quaternion[4], float rotation[3][3]);
+void attitude_quaternion_to_euler_degrees(const float quaternion[4], float degrees[3]);
+void attitude_accelerometer_filter_reset(struct attitude_accelerometer_filter *filter);
+float attitude_accelerometer_filter_update(struct attitude_accelerometer_filter *filter, const float accelerometer[3], float dt, float unit[3]);
@@ -0,0 +1,332 @@
+#include "./attitude_ekf.h"
+
+// Below this trust the accelerometer noise would be so large the update does nothing anyway
+#define ACCELEROMETER_MIN_TRUST 0.05f
+
+// Close to the magnetic poles there is no heading in the field
+#define MAGNETOMETER_MIN_HORIZONTAL 0.1f
+
+// How unsure the filter is at the start. The attitude comes from the sensors so it is close already
+#define INITIAL_ATTITUDE_SIGMA 0.05f   // rad
+#define INITIAL_BIAS_SIGMA_DPS 1.0f
+
+#define BENCHMARK_RUNS 1000
+
+static struct attitude_ekf_state m_state;
+
+// Noise as variances in rad
+static float m_gyro_variance_density = 0.0f;    // rad^2/s
+static float m_bias_variance_density = 0.0f;    // rad^2/s^3
+static float m_accelerometer_variance = 0.0f;   // of a unit vector
+static float m_heading_variance = 0.0f;         // rad^2
+
+// Same low pass and trust as lib/attitude. The predicts since the last update are its dt
+static struct attitude_accelerometer_filter m_accelerometer_filter;
+static float m_time_since_accelerometer = 0.0f;
+
+static void reset_covariance()
+{
+    for (uint8_t i = 0; i < ATTITUDE_EKF_STATES; i++)
+    {
+        for (uint8_t k = 0; k < ATTITUDE_EKF_STATES; k++)
+        {
+            m_state.covariance[i][k] = 0.0f;
+        }
+    }
+
+    float bias_sigma = INITIAL_BIAS_SIGMA_DPS * DEGREES_TO_RADIANS_F;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_state.covariance[i][i] = INITIAL_ATTITUDE_SIGMA * INITIAL_ATTITUDE_SIGMA;
+        m_state.covariance[i + 3][i + 3] = bias_sigma * bias_sigma;
+    }
+}
+
+// gyro_noise_density_dps is the white noise on the gyro in dps per sqrt(Hz), vibration included. It sets how
+// much the gyro is trusted against the accelerometer and magnetometer.
+// gyro_bias_walk_dps is how fast the bias can wander, dps per sqrt(second)
+uint8_t init_attitude_ekf(float gyro_noise_density_dps, float gyro_bias_walk_dps, float accelerometer_noise_g, float heading_noise_degrees)
+{
+    float gyro_noise = gyro_noise_density_dps * DEGREES_TO_RADIANS_F;
+    float bias_walk = gyro_bias_walk_dps * DEGREES_TO_RADIANS_F;
+    float heading_noise = heading_noise_degrees * DEGREES_TO_RADIANS_F;
+    m_gyro_variance_density = gyro_noise * gyro_noise;
+    m_bias_variance_density = bias_walk * bias_walk;
+    m_accelerometer_variance = accelerometer_noise_g * accelerometer_noise_g;
+    m_heading_variance = heading_noise * heading_noise;
+
+    m_state.quaternion[0] = 1.0f;
+    m_state.quaternion[1] = 0.0f;
+    m_state.quaternion[2] = 0.0f;
+    m_state.quaternion[3] = 0.0f;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_state.gyro_bias[i] = 0.0f;
+    }
+    reset_covariance();
+    attitude_accelerometer_filter_reset(&m_accelerometer_filter);
+    m_time_since_accelerometer = 0.0f;
+
+    return 1;
+}
+
+// Start from a known attitude, attitude_set_from_sensors in lib/attitude can provide one. The bias is kept
+void attitude_ekf_set_quaternion(const float quaternion[4])
+{
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        m_state.quaternion[i] = quaternion[i];
+    }
+    reset_covariance();
+    attitude_accelerometer_filter_reset(&m_accelerometer_filter);
+    m_time_since_accelerometer = 0.0f;
+}
+
+static void normalize_quaternion(float *q)
+{
+    float inverse_norm = fast_inverse_sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        q[i] *= inverse_norm;
+    }
+}
+
+// q = q * (1, rotation / 2). Rotation is a small angle in the drone frame
+static void rotate_quaternion(float *q, float rx, float ry, float rz)
+{
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    rx *= 0.5f;
+    ry *= 0.5f;
+    rz *= 0.5f;
+    q[0] = q0 - q1 * rx - q2 * ry - q3 * rz;
+    q[1] = q1 + q0 * rx + q2 * rz - q3 * ry;
+    q[2] = q2 + q0 * ry - q1 * rz + q3 * rx;
+    q[3] = q3 + q0 * rz + q1 * ry - q2 * rx;
+    normalize_quaternion(q);
+}
+
+// Run for every gyro sample. dt in seconds
+void attitude_ekf_predict(const float gyro_dps[3], float dt)
+{
+    if (dt <= 0.0f)
+    {
+        return;
+    }
+
+    float wx = gyro_dps[0] * DEGREES_TO_RADIANS_F - m_state.gyro_bias[0];
+    float wy = gyro_dps[1] * DEGREES_TO_RADIANS_F - m_state.gyro_bias[1];
+    float wz = gyro_dps[2] * DEGREES_TO_RADIANS_F - m_state.gyro_bias[2];
+    rotate_quaternion(m_state.quaternion, wx * dt, wy * dt, wz * dt);
+    m_time_since_accelerometer += dt;
+
+    // P = F P F' + Q with F = [phi -dt*I; 0 I] and phi = I - [w]x * dt. Done in 3x3 blocks,
+    // P = [A B; B' C], which skips all the multiplies by zero and identity
+    float phi[3][3] = {
+        {1.0f,     wz * dt, -wy * dt},
+        {-wz * dt, 1.0f,     wx * dt},
+        {wy * dt,  -wx * dt, 1.0f}};
+
+    float (*p)[ATTITUDE_EKF_STATES] = m_state.covariance;
+    float top_left[3][3];  // phi * A - dt * B'
+    float top_right[3][3]; // phi * B - dt * C, the new B
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            top_left[i][k] = phi[i][0] * p[0][k] + phi[i][1] * p[1][k] + phi[i][2] * p[2][k] - dt * p[k][i + 3];
+            top_right[i][k] = phi[i][0] * p[0][k + 3] + phi[i][1] * p[1][k + 3] + phi[i][2] * p[2][k + 3] - dt * p[i + 3][k + 3];
+        }
+    }
+
+    // A = top_left * phi' - dt * top_right. Comes out symmetric so only half of it is computed
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = i; k < 3; k++)
+        {
+            float value = top_left[i][0] * phi[k][0] + top_left[i][1] * phi[k][1] + top_left[i][2] * phi[k][2] - dt * top_right[i][k];
+            p[i][k] = value;
+            p[k][i] = value;
+        }
+    }
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            p[i][k + 3] = top_right[i][k];
+            p[k + 3][i] = top_right[i][k];
+        }
+        p[i][i] += m_gyro_variance_density * dt;
+        p[i + 3][i + 3] += m_bias_variance_density * dt;
+    }
+}
+
+// One scalar measurement. h is the row of the measurement matrix, the correction adds up in error_state
+static void scalar_update(const float h[ATTITUDE_EKF_STATES], float residual, float variance, float error_state[ATTITUDE_EKF_STATES])
+{
+    float (*p)[ATTITUDE_EKF_STATES] = m_state.covariance;
+
+    float ph[ATTITUDE_EKF_STATES];
+    float innovation_variance = variance;
+    for (uint8_t i = 0; i < ATTITUDE_EKF_STATES; i++)
+    {
+        ph[i] = 0.0f;
+        for (uint8_t k = 0; k < ATTITUDE_EKF_STATES; k++)
+        {
+            ph[i] += p[i][k] * h[k];
+        }
+    }
+    for (uint8_t i = 0; i < ATTITUDE_EKF_STATES; i++)
+    {
+        innovation_variance += h[i] * ph[i];
+        residual -= h[i] * error_state[i]; // What the earlier measurements of this step already fixed
+    }
+
+    float inverse_variance = 1.0f / innovation_variance;
+    for (uint8_t i = 0; i < ATTITUDE_EKF_STATES; i++)
+    {
+        float gain = ph[i] * inverse_variance;
+        error_state[i] += gain * residual;
+        for (uint8_t k = i; k < ATTITUDE_EKF_STATES; k++)
+        {
+            p[i][k] -= gain * ph[k];
+            p[k][i] = p[i][k];
+        }
+    }
+}
+
+// Move the estimated error into the quaternion and the bias, the error is zero again after
+static void apply_error_state(const float error_state[ATTITUDE_EKF_STATES])
+{
+    rotate_quaternion(m_state.quaternion, error_state[0], error_state[1], error_state[2]);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_state.gyro_bias[i] += error_state[i + 3];
+    }
+}
+
+// Gravity direction. The further the reading is from 1g the larger its noise is taken to be.
+// Returns 0 if it was too far from 1g to be used
+uint8_t attitude_ekf_update_accelerometer(const float accelerometer[3])
+{
+    float up[3];
+    float trust = attitude_accelerometer_filter_update(&m_accelerometer_filter, accelerometer, m_time_since_accelerometer, up);
+    m_time_since_accelerometer = 0.0f;
+    if (trust < ACCELEROMETER_MIN_TRUST)
+    {
+        return 0;
+    }
+    float ax = up[0], ay = up[1], az = up[2];
+    float variance = m_accelerometer_variance / (trust * trust);
+
+    // Expected up in the drone frame, the third row of the rotation. An attitude error e changes it by up x e
+    float *q = m_state.quaternion;
+    float vx = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+    float vy = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+    float vz = 1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2]);
+
+    float error_state[ATTITUDE_EKF_STATES] = {0};
+    float h_x[ATTITUDE_EKF_STATES] = {0.0f, -vz, vy, 0.0f, 0.0f, 0.0f};
+    float h_y[ATTITUDE_EKF_STATES] = {vz, 0.0f, -vx, 0.0f, 0.0f, 0.0f};
+    float h_z[ATTITUDE_EKF_STATES] = {-vy, vx, 0.0f, 0.0f, 0.0f, 0.0f};
+    scalar_update(h_x, ax - vx, variance, error_state);
+    scalar_update(h_y, ay - vy, variance, error_state);
+    scalar_update(h_z, az - vz, variance, error_state);
+    apply_error_state(error_state);
+    return 1;
+}
+
+// Only the heading. The magnetometer is rotated to the world and its angle from north is the measurement,
+// so a disturbed field can not tilt the horizon. Returns 0 if there is no heading in the reading
+uint8_t attitude_ekf_update_magnetometer(const float magnetometer[3])
+{
+    float rotation[3][3];
+    attitude_quaternion_to_rotation_matrix(m_state.quaternion, rotation);
+
+    float mx = magnetometer[0], my = magnetometer[1], mz = magnetometer[2];
+    float world_x = rotation[0][0] * mx + rotation[0][1] * my + rotation[0][2] * mz;
+    float world_y = rotation[1][0] * mx + rotation[1][1] * my + rotation[1][2] * mz;
+    float horizontal_squared = world_x * world_x + world_y * world_y;
+    if (horizontal_squared < MAGNETOMETER_MIN_HORIZONTAL * MAGNETOMETER_MIN_HORIZONTAL * (mx * mx + my * my + mz * mz))
+    {
+        return 0;
+    }
+
+    // World x is magnetic north. A heading error turns the drone around the world up axis,
+    // which is the third row of the rotation in the drone frame
+    float error_state[ATTITUDE_EKF_STATES] = {0};
+    float h[ATTITUDE_EKF_STATES] = {rotation[2][0], rotation[2][1], rotation[2][2], 0.0f, 0.0f, 0.0f};
+    scalar_update(h, -fast_atan2f(world_y, world_x), m_heading_variance, error_state);
+    apply_error_state(error_state);
+    return 1;
+}
+
+void attitude_ekf_get_quaternion(float quaternion[4])
+{
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        quaternion[i] = m_state.quaternion[i];
+    }
+}
+
+void attitude_ekf_get_euler_degrees(float degrees[3])
+{
+    attitude_quaternion_to_euler_degrees(m_state.quaternion, degrees);
+}
+
+void attitude_ekf_get_rotation_matrix(float rotation[3][3])
+{
+    attitude_quaternion_to_rotation_matrix(m_state.quaternion, rotation);
+}
+
+void attitude_ekf_get_gyro_bias_dps(float bias[3])
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        bias[i] = m_state.gyro_bias[i] * RADIANS_TO_DEGREES_F;
+    }
+}
+
+// Cycles for each step and how much of a 1kHz loop a predict and an accelerometer update take.
+// The filter state is put back after so it can run at any time
+void attitude_ekf_print_benchmark()
+{
+    struct attitude_ekf_state saved_state = m_state;
+    struct attitude_accelerometer_filter saved_accelerometer_filter = m_accelerometer_filter;
+    float saved_time_since_accelerometer = m_time_since_accelerometer;
+
+    float gyro[3] = {1.0f, -2.0f, 0.5f};
+    float accelerometer[3] = {0.02f, -0.01f, 0.99f};
+    float magnetometer[3] = {20.0f, 5.0f, -40.0f};
+
+    uint32_t start = timebase_get_cycles();
+    for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        attitude_ekf_predict(gyro, 0.001f);
+    }
+    uint32_t predict_cycles = (timebase_get_cycles() - start) / BENCHMARK_RUNS;
+
+    start = timebase_get_cycles();
+    for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        attitude_ekf_update_accelerometer(accelerometer);
+    }
+    uint32_t accelerometer_cycles = (timebase_get_cycles() - start) / BENCHMARK_RUNS;
+
+    start = timebase_get_cycles();
+    for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        attitude_ekf_update_magnetometer(magnetometer);
+    }
+    uint32_t magnetometer_cycles = (timebase_get_cycles() - start) / BENCHMARK_RUNS;
+
+    m_state = saved_state;
+    m_accelerometer_filter = saved_accelerometer_filter;
+    m_time_since_accelerometer = saved_time_since_accelerometer;
+
+    uint32_t per_sample_micros = timebase_cycles_to_micros(predict_cycles + accelerometer_cycles);
+    printf("EKF cycles predict %lu, accelerometer %lu, magnetometer %lu\n",
+        (unsigned long)predict_cycles, (unsigned long)accelerometer_cycles, (unsigned long)magnetometer_cycles);
+    printf("EKF predict and accelerometer every sample at 1kHz: %lu us of 1000 us, %.1f%%\n",
+        (unsigned long)per_sample_micros, (predict_cycles + accelerometer_cycles) * 100.0f / (SystemCoreClock / 1000));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../timebase/timebase.h"
+#include "../fastmath/fastmath.h"
+#include "../attitude/attitude.h"
+
+// Extended Kalman filter for the attitude and the gyro bias. Same frames and outputs as lib/attitude.
+// The quaternion is kept outside the filter and the filter tracks the small error on top of it
+// (multiplicative EKF), 3 attitude error states and 3 gyro bias states. The accelerometer and the
+// magnetometer heading go in one number at a time so there is never a matrix to invert.
+// Everything is fixed size and static, nothing is allocated.
+//
+// The bias keeps getting estimated in flight, so it follows the drift with temperature that a calibration
+// at boot can not. The z bias is only seen through the magnetometer.
+
+#define ATTITUDE_EKF_STATES 6
+
+struct attitude_ekf_state{
+    float quaternion[4];   // Drone to world. w, x, y, z
+    float gyro_bias[3];    // rad/s, subtracted from the gyro
+    float covariance[ATTITUDE_EKF_STATES][ATTITUDE_EKF_STATES]; // attitude error (rad) then bias (rad/s)
+};
+
+uint8_t init_attitude_ekf(float gyro_noise_density_dps, float gyro_bias_walk_dps, float accelerometer_noise_g, float heading_noise_degrees);
+void attitude_ekf_set_quaternion(const float quaternion[4]);
+void attitude_ekf_predict(const float gyro_dps[3], float dt);
+uint8_t attitude_ekf_update_accelerometer(const float accelerometer[3]);
+uint8_t attitude_ekf_update_magnetometer(const float magnetometer[3]);
+void attitude_ekf_get_quaternion(float quaternion[4]);
+void attitude_ekf_get_euler_degrees(float degrees[3]);
+void attitude_ekf_get_rotation_matrix(float rotation[3][3]);
+void attitude_ekf_get_gyro_bias_dps(float bias[3]);
+void attitude_ekf_print_benchmark();
@@ -40,7 +40,7 @@ char* betaflight_blackbox_wrapper_get_header(uint16_t min_throttle, uint16_t max
     string_length = buffer_append(new_string, string_length_total, string_length, "H Data version:2\n");
     string_length = buffer_append(new_string, string_length_total, string_length, "H I interval: 1\n");
     string_length = buffer_append(new_string, string_length_total, string_length, "H P interval:1/1\n");
-    string_length = buffer_append(new_string, string_length_total, string_length, "H Field I name:loopIteration,time,axisP[0],axisP[1],axisP[2],axisI[0],axisI[1],axisI[2],axisD[0],axisD[1],axisF[0],axisF[1],axisF[2],rcCommand[0],rcCommand[1],rcCommand[2],rcCommand[3],setpoint[0],setpoint[1],setpoint[2],setpoint[3],gyroADC[0],gyroADC[1],gyroADC[2],accSmooth[0],accSmooth[1],accSmooth[2],motor[0],motor[1],motor[2],motor[3],magADC[0],magADC[1],magADC[2],BaroAlt,debug[0],debug[1],debug[2],debug[2]\n");
+    string_length = buffer_append(new_string, string_length_total, string_length, "H Field I name:loopIteration,time,axisP[0],axisP[1],axisP[2],axisI[0],axisI[1],axisI[2],axisD[0],axisD[1],axisF[0],axisF[1],axisF[2],rcCommand[0],rcCommand[1],rcCommand[2],rcCommand[3],setpoint[0],setpoint[1],setpoint[2],setpoint[3],gyroADC[0],gyroADC[1],gyroADC[2],accSmooth[0],accSmooth[1],accSmooth[2],motor[0],motor[1],motor[2],motor[3],magADC[0],magADC[1],magADC[2],BaroAlt,debug[0],debug[1],debug[2],debug[3]\n");
     string_length = buffer_append(new_string, string_length_total, string_length, "H Field I signed:0,0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,1,1,1,1,1,1,1,1,1,1,0,0,0,0,1,1,1,1,1,1,1,1\n");
     string_length = buffer_append(new_string, string_length_total, string_length, "H Field I predictor:0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n");
     string_length = buffer_append(new_string, string_length_total, string_length, "H Field I encoding:1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,1,1,1,1,0,0,0,0,0,0,0,0\n");
@@ -171,6 +171,7 @@ char* betaflight_blackbox_get_encoded_data_string(
     float* mag,
     float* gyro_post_sensor_fusion,
     float altitude,
+    int32_t debug, // Goes in the last debug field, the first three are the sensor fusion angles
     uint16_t* string_length_return
 ){
     uint16_t string_length_total = 200;
@@ -197,7 +198,7 @@ char* betaflight_blackbox_get_encoded_data_string(
     };
 
     int32_t mag_int[3] = {lrintf(mag[0]*scaling_factor), lrintf(mag[1]*scaling_factor), lrintf(mag[2]*scaling_factor)};
-    int32_t gyro_post_sensor_fusion_int[4] = {lrintf(gyro_post_sensor_fusion[0]*scaling_factor), lrintf(gyro_post_sensor_fusion[1]*scaling_factor), lrintf(gyro_post_sensor_fusion[2]*scaling_factor), 0};
+    int32_t gyro_post_sensor_fusion_int[4] = {lrintf(gyro_post_sensor_fusion[0]*scaling_factor), lrintf(gyro_post_sensor_fusion[1]*scaling_factor), lrintf(gyro_post_sensor_fusion[2]*scaling_factor), debug};
     int32_t altitude_int = lrintf(altitude*scaling_factor); // 10 float value is 1.0 meter after it arrives to the logger.
 
 
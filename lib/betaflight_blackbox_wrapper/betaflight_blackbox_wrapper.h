@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 char* betaflight_blackbox_wrapper_get_header(uint16_t min_throttle, uint16_t max_throttle, uint16_t* string_length_return);
 char* betaflight_blackbox_get_encoded_data_string(
@@ -19,6 +20,7 @@ char* betaflight_blackbox_get_encoded_data_string(
     float* mag,
     float* gyro_post_sensor_fusion,
     float altitude,
+    int32_t debug, // Goes in the last debug field, the first three are the sensor fusion angles
     uint16_t* string_length_return
 );
 char* betaflight_blackbox_get_end_of_log(uint16_t* string_length_return);
@@ -13,54 +13,28 @@
 #define PRES_MSB_REG 0xF7
 #define TEMP_MSB_REG 0xFA
 
+// Altitude from the pressure ratio is a series around 1 instead of pow. Good to about a centimeter for
+// ratios in this range, which is more than 1km up or down from the reference
+#define FAST_ALTITUDE_MIN_RATIO 0.85f
+#define FAST_ALTITUDE_MAX_RATIO 1.05f
+
 #define TEMP_LAPSE_RATE 0.0065
 #define CELSIUS_TO_KELVIN 273.15
 #define GRAVITY 9.80665
 #define DRY_AIR_MOLAR_MASS 0.0289644
 #define DRY_AIR_GAS_CONSTANT 287.058
 
-enum t_temp_oversampling {
-    OS_TEMP_1  = 0b00100000,
-    OS_TEMP_2  = 0b01000000,
-    OS_TEMP_4  = 0b01100000,
-    OS_TEMP_8  = 0b10000000,
-    OS_TEMP_16 = 0b10100000
-};
-
-enum t_pres_oversampling {
-    OS_PRES_1  = 0b00000100,
-    OS_PRES_2  = 0b00001000,
-    OS_PRES_4  = 0b00001100,
-    OS_PRES_8  = 0b00010000,
-    OS_PRES_16 = 0b00010100
-};
-
-enum t_power_modes {
-    SLEEP_MODE  = 0b00000000,
-    FORCED_MODE = 0b00000001,
-    NORMAL_MODE = 0b00000011,
-};
-
-enum t_standby_modes {
-    SB_MODE_0_5  = 0b00000000,
-    SB_MODE_62_5 = 0b00000001,
-    SB_MODE_125  = 0b00000010,
-    SB_MODE_250  = 0b00000011,
-    SB_MODE_500  = 0b00000100,
-    SB_MODE_1000 = 0b00000101,
-    SB_MODE_2000 = 0b00000110,
-    SB_MODE_4000 = 0b00000111,
-};
-
-enum t_filter_modes {
-    FILTER_MODE_1  = 0b00000000,
-    FILTER_MODE_2  = 0b00000100,
-    FILTER_MODE_4  = 0b00001000,
-    FILTER_MODE_8  = 0b00001100,
-    FILTER_MODE_16 = 0b00010000,
-};
-
-I2C_HandleTypeDef *i2c_handle;
+static I2C_HandleTypeDef *i2c_handle;
+
+// Pressure and temperature read through the i2c scheduler in one burst
+static uint8_t m_queued_data[6];
+static volatile enum t_i2c_read_state m_queued_state = I2C_READ_IDLE;
+
+// Normal mode converts on its own, there is only something new to read once per measurement period
+static uint32_t m_measurement_period_us = 0;
+static uint32_t m_last_read_time = 0;
+static float m_latest_temperature = 0.0;
+static float m_latest_pressure = 0.0;
 
 float reference_pressure = 0.0;
 
@@ -75,7 +49,7 @@ int32_t bmp280_convert_raw_temp(int32_t adc_T);
 uint32_t bmp280_convert_raw_pres(int32_t adc_P);
 uint8_t load_trim_registers();
 
-uint8_t init_bmp280(I2C_HandleTypeDef *i2c_handle_temp)
+uint8_t init_bmp280(I2C_HandleTypeDef *i2c_handle_temp, enum t_pres_oversampling pressure_oversampling, enum t_temp_oversampling temperature_oversampling, enum t_filter_modes filter, enum t_standby_modes standby)
 {
     i2c_handle = i2c_handle_temp;
 
@@ -108,10 +82,13 @@ uint8_t init_bmp280(I2C_HandleTypeDef *i2c_handle_temp)
         &reset_device, 
         1, 100);
 
+    // Let the reset finish before configuring, otherwise the settings can get lost
+    HAL_Delay(3);
+
     uint8_t ctrl_meas_register = 0b00000000;
     ctrl_meas_register |= NORMAL_MODE; // set it to normal mode
-    ctrl_meas_register |= OS_TEMP_1; // enable temp measurement oversampling x1
-    ctrl_meas_register |= OS_PRES_16; // set pressure oversampling to standard resolution 18bit/0.66 PA x4
+    ctrl_meas_register |= temperature_oversampling;
+    ctrl_meas_register |= pressure_oversampling;
     HAL_StatusTypeDef ret2 = HAL_I2C_Mem_Write(
         i2c_handle, 
         BMP280_I2C_ID, 
@@ -122,8 +99,8 @@ uint8_t init_bmp280(I2C_HandleTypeDef *i2c_handle_temp)
         100);
 
     uint8_t config_register = 0b00000000;
-    config_register |= SB_MODE_0_5; // Set standby time to 0.5mx, disable spi on last bit
-    config_register |= FILTER_MODE_16; // Set filter to coefficient 2
+    config_register |= standby << 5; // Time between the measurements, spi stays disabled on the last bit
+    config_register |= filter; // iir filter on the pressure, smooths out the noise but lags behind
     HAL_StatusTypeDef ret3 = HAL_I2C_Mem_Write(
         i2c_handle, 
         BMP280_I2C_ID, 
@@ -133,6 +110,12 @@ uint8_t init_bmp280(I2C_HandleTypeDef *i2c_handle_temp)
         1, 
         100);
 
+    // Datasheet maximum measurement time, 1.25ms + 2.3ms per temperature and pressure oversample + 0.575ms
+    uint32_t temperature_samples = 1 << ((temperature_oversampling >> 5) - 1);
+    uint32_t pressure_samples = 1 << ((pressure_oversampling >> 2) - 1);
+    uint32_t standby_times_us[] = {500, 62500, 125000, 250000, 500000, 1000000, 2000000, 4000000};
+    m_measurement_period_us = 1250 + 2300 * temperature_samples + 2300 * pressure_samples + 575 + standby_times_us[standby];
+
     printf("BMP280 initialized\n");
     HAL_Delay(100); // Wait a bit to let the new settings soak in
     uint8_t load_trims = load_trim_registers();
@@ -197,8 +180,8 @@ uint8_t load_trim_registers()
     dig_T1 = (trim_data[1] << 8) | trim_data[0];
     dig_T2 = (trim_data[3] << 8) | trim_data[2];
     dig_T3 = (trim_data[5] << 8) | trim_data[4];
-    dig_P1 = (trim_data[7] << 8) | trim_data[5];
-    dig_P2 = (trim_data[9] << 8) | trim_data[6];
+    dig_P1 = (trim_data[7] << 8) | trim_data[6];
+    dig_P2 = (trim_data[9] << 8) | trim_data[8];
     dig_P3 = (trim_data[11] << 8) | trim_data[10];
     dig_P4 = (trim_data[13] << 8) | trim_data[12];
     dig_P5 = (trim_data[15] << 8) | trim_data[14];
@@ -230,7 +213,7 @@ float bmp280_get_pressure_hPa()
 
     // Combine the 3 bytes in a specific way to get a 16-20 bit value
     int32_t combined_pres = ((int32_t)retrieved_data[0] << 12) | ((int32_t)retrieved_data[1]) << 4 | ((int32_t)retrieved_data[2] >> 4);
-    float pressure = ((float)bmp280_convert_raw_pres(combined_pres)) / 256.0;
+    float pressure = ((float)bmp280_convert_raw_pres(combined_pres)) / 256.0f;
 
     // Return the value after dividing by 100 to convert Pa -> hPa
     return pressure / 100;
@@ -256,24 +239,112 @@ float bmp280_get_temperature_celsius()
 
     // Combine the 3 bytes in a specific way to get a 16-20 bit value
     int32_t combined_temp = ((int32_t)retrieved_data[0] << 12) | ((int32_t)retrieved_data[1]) << 4 | ((int32_t)retrieved_data[2] >> 4);
-    float temperature = ((float)bmp280_convert_raw_temp(combined_temp)) / 100.0;
+    float temperature = ((float)bmp280_convert_raw_temp(combined_temp)) / 100.0f;
     return temperature;
 }
 
+// 44330 * (1 - ratio^0.1903). Taylor series of the power around 1, Horner form.
+// Outside the range where the series is good it falls back to fast_powf
+float bmp280_pressure_ratio_to_height_meters(float pressure_ratio)
+{
+    if(pressure_ratio < FAST_ALTITUDE_MIN_RATIO || pressure_ratio > FAST_ALTITUDE_MAX_RATIO){
+        return 44330.0f * (1.0f - fast_powf(pressure_ratio, 0.1903f));
+    }
+
+    float u = pressure_ratio - 1.0f;
+    float power = 0.02487362f;
+    power = power * u - 0.03264512f;
+    power = power * u + 0.04647488f;
+    power = power * u - 0.07704296f;
+    power = power * u + 0.1903f;
+    power = power * u; // The 1 of the series cancels out with the 1 in front
+    return -44330.0f * power;
+}
+
 float bmp280_get_height_meters_above_sea_level(float pressure_sea_level_hpa, float temperature_sea_level){
     float pressure = bmp280_get_pressure_hPa();
 
-    return 44330 * (1.0 - pow(pressure / pressure_sea_level_hpa, 0.1903));
+    return bmp280_pressure_ratio_to_height_meters(pressure / pressure_sea_level_hpa);
 }
 
 float bmp280_get_height_meters_from_reference(uint8_t reset_reference){
     float pressure = bmp280_get_pressure_hPa();
+    return bmp280_calculate_height_meters_from_reference(pressure, reset_reference);
+}
 
+float bmp280_calculate_height_meters_from_reference(float pressure, uint8_t reset_reference){
     if(reference_pressure == 0.0 || reset_reference == 1){
         // printf("data: %.2f %.2f\n",reference_pressure, pressure);
         reference_pressure = pressure;
     }
     
-    // printf("44330 * (1.0 - pow(%.2f / %.2f, 0.1903))\n", pressure, reference_pressure);
-    return 44330 * (1.0 - pow(pressure / reference_pressure, 0.1903));
-}
\ No newline at end of file
+    return bmp280_pressure_ratio_to_height_meters(pressure / reference_pressure);
+}
+
+// Runs in the dma interrupt
+static void queued_read_callback(uint8_t success)
+{
+    m_queued_state = success ? I2C_READ_DONE : I2C_READ_FAILED;
+}
+
+// Pressure and temperature registers are next to each other so both come in one read
+uint8_t bmp280_queue_read()
+{
+    if(m_queued_state == I2C_READ_PENDING){
+        return 0;
+    }
+
+    m_queued_state = I2C_READ_PENDING;
+    if(!i2c_scheduler_queue_read(BMP280_I2C_ID, PRES_MSB_REG, m_queued_data, 6, I2C_PRIORITY_LOW, queued_read_callback)){
+        m_queued_state = I2C_READ_FAILED;
+        return 0;
+    }
+    return 1;
+}
+
+// Returns 1 and the readings if the queued read finished
+uint8_t bmp280_get_queued_readings(float *temperature_celsius, float *pressure_hPa)
+{
+    if(m_queued_state != I2C_READ_DONE){
+        return 0;
+    }
+
+    int32_t combined_pres = ((int32_t)m_queued_data[0] << 12) | ((int32_t)m_queued_data[1]) << 4 | ((int32_t)m_queued_data[2] >> 4);
+    int32_t combined_temp = ((int32_t)m_queued_data[3] << 12) | ((int32_t)m_queued_data[4]) << 4 | ((int32_t)m_queued_data[5] >> 4);
+    m_queued_state = I2C_READ_IDLE;
+
+    // Temperature first, it sets t_fine that the pressure conversion needs
+    *temperature_celsius = ((float)bmp280_convert_raw_temp(combined_temp)) / 100.0f;
+    *pressure_hPa = ((float)bmp280_convert_raw_pres(combined_pres)) / 25600.0f;
+    return 1;
+}
+
+// Call as often as you like. Queues the burst read once per measurement period and picks up the result later.
+// Returns 1 when new readings came in, the latest ones stay available through the getters in between
+uint8_t bmp280_update()
+{
+    uint8_t new_readings = bmp280_get_queued_readings(&m_latest_temperature, &m_latest_pressure);
+
+    uint32_t now = timebase_get_micros();
+    if(m_queued_state != I2C_READ_PENDING && now - m_last_read_time >= m_measurement_period_us){
+        if(bmp280_queue_read()){
+            m_last_read_time = now;
+        }
+    }
+    return new_readings;
+}
+
+float bmp280_get_latest_pressure_hPa()
+{
+    return m_latest_pressure;
+}
+
+float bmp280_get_latest_temperature_celsius()
+{
+    return m_latest_temperature;
+}
+
+uint32_t bmp280_get_measurement_period_us()
+{
+    return m_measurement_period_us;
+}
@@ -106,12 +106,15 @@ uint8_t bn357_parse_and_store(unsigned char *gps_output_buffer, uint16_t size_of
     uint16_t latitude_temp = atoi(latitude_string);
     uint16_t latitude_degrees = ((latitude_temp % 10000) - (latitude_temp % 100)) / 100;
     m_latitude = (float)latitude_degrees + ((atof(latitude_string) - (float)latitude_degrees * 100)/60);
+    if(end[1] == 'S'){
+        m_latitude = -m_latitude; // South is negative
+    }
 #if(BN357_DEBUG)
     printf("Latitude: %f\n", m_latitude);
 #endif
 
     // find longitude
-    start = end+3; // skip the N character
+    start = end+3; // skip the N/S character
     if(start[0] == ','){
 #if(BN357_DEBUG)
         printf("Failed at longitude\n");
@@ -126,12 +129,15 @@ uint8_t bn357_parse_and_store(unsigned char *gps_output_buffer, uint16_t size_of
     uint16_t longitude_temp = atoi(longitude_string);
     uint16_t longitude_degrees = ((longitude_temp % 10000) - (longitude_temp % 100)) / 100;
     m_longitude = (float)longitude_degrees + ((atof(longitude_string) - (float)longitude_degrees * 100)/60);
+    if(end[1] == 'W'){
+        m_longitude = -m_longitude; // West is negative
+    }
 #if(BN357_DEBUG)
     printf("Longitude: %f\n", m_longitude);
 #endif
 
     // find fix quality
-    start = end+3; // skip the E character
+    start = end+3; // skip the E/W character
     if(start[0] == ','){
 #if(BN357_DEBUG)
         printf("Failed at fix quality\n");
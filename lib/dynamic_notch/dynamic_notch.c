@@ -0,0 +1,235 @@
+#include "./dynamic_notch.h"
+
+#define FFT_STAGES 7 // log2(DYNAMIC_NOTCH_FFT_SIZE)
+#define HALF_SIZE (DYNAMIC_NOTCH_FFT_SIZE / 2)
+
+// Window, the butterfly stages, then the peaks. One of these per step
+#define STEP_WINDOW 0
+#define STEP_PEAKS (FFT_STAGES + 1)
+#define STEP_COUNT (FFT_STAGES + 2)
+
+#define PEAK_TO_AVERAGE_MINIMUM 4.0f // A peak has to stand out this much from the band, otherwise the notches stay where they are
+#define FREQUENCY_SMOOTHING 0.5f     // How far a notch moves towards a new peak per analysis of its axis
+
+static float m_buffer[3][DYNAMIC_NOTCH_FFT_SIZE];
+static uint8_t m_buffer_index = 0;
+
+static float m_real[DYNAMIC_NOTCH_FFT_SIZE];
+static float m_imaginary[DYNAMIC_NOTCH_FFT_SIZE];
+static float m_window[DYNAMIC_NOTCH_FFT_SIZE];
+static float m_twiddle_cos[HALF_SIZE];
+static float m_twiddle_sin[HALF_SIZE];
+static uint8_t m_bit_reversed[DYNAMIC_NOTCH_FFT_SIZE];
+
+static float m_bin_hz = 0.0f;
+static uint8_t m_minimum_bin = 1;
+static uint8_t m_maximum_bin = HALF_SIZE - 2;
+static float m_minimum_hz = 0.0f;
+static float m_maximum_hz = 0.0f;
+static uint8_t m_peak_count = 1;
+static float m_frequencies[3][DYNAMIC_NOTCH_MAX_PEAKS];
+
+static uint8_t m_axis = 0;
+static uint8_t m_step = STEP_WINDOW;
+static uint32_t m_step_cycles[STEP_COUNT]; // Longest each step took so far, to know if the next one still fits
+
+// peak_count notches per axis, up to DYNAMIC_NOTCH_MAX_PEAKS. They all start at initial_hz
+uint8_t init_dynamic_notch(float sample_rate_hz, float minimum_hz, float maximum_hz, uint8_t peak_count, float initial_hz){
+    if(peak_count == 0 || peak_count > DYNAMIC_NOTCH_MAX_PEAKS || minimum_hz >= maximum_hz){
+        return 0;
+    }
+    m_bin_hz = sample_rate_hz / DYNAMIC_NOTCH_FFT_SIZE;
+    m_minimum_hz = minimum_hz;
+    m_maximum_hz = maximum_hz;
+    m_peak_count = peak_count;
+
+    // One bin of room on both sides for the interpolation
+    int16_t minimum_bin = (int16_t)(minimum_hz / m_bin_hz);
+    int16_t maximum_bin = (int16_t)(maximum_hz / m_bin_hz) + 1;
+    m_minimum_bin = minimum_bin < 1 ? 1 : minimum_bin;
+    m_maximum_bin = maximum_bin > HALF_SIZE - 2 ? HALF_SIZE - 2 : maximum_bin;
+    if(m_minimum_bin >= m_maximum_bin){
+        return 0;
+    }
+
+    // Hann window, without it the motor peak smears over the whole band
+    for(uint8_t i = 0; i < DYNAMIC_NOTCH_FFT_SIZE; i++){
+        m_window[i] = 0.5f - 0.5f * fast_cosf(2.0f * (float)M_PI * i / DYNAMIC_NOTCH_FFT_SIZE);
+
+        uint8_t reversed = 0;
+        for(uint8_t bit = 0; bit < FFT_STAGES; bit++){
+            if(i & (1 << bit)){
+                reversed |= 1 << (FFT_STAGES - 1 - bit);
+            }
+        }
+        m_bit_reversed[i] = reversed;
+    }
+    for(uint8_t i = 0; i < HALF_SIZE; i++){
+        m_twiddle_cos[i] = fast_cosf(2.0f * (float)M_PI * i / DYNAMIC_NOTCH_FFT_SIZE);
+        m_twiddle_sin[i] = fast_sinf(2.0f * (float)M_PI * i / DYNAMIC_NOTCH_FFT_SIZE);
+    }
+
+    for(uint8_t axis = 0; axis < 3; axis++){
+        for(uint8_t i = 0; i < DYNAMIC_NOTCH_FFT_SIZE; i++){
+            m_buffer[axis][i] = 0.0f;
+        }
+        for(uint8_t peak = 0; peak < DYNAMIC_NOTCH_MAX_PEAKS; peak++){
+            m_frequencies[axis][peak] = initial_hz;
+        }
+    }
+    for(uint8_t i = 0; i < STEP_COUNT; i++){
+        m_step_cycles[i] = 0;
+    }
+    m_buffer_index = 0;
+    m_axis = 0;
+    m_step = STEP_WINDOW;
+    return 1;
+}
+
+// Has to be the gyro before the notches, after them the peak is gone
+void dynamic_notch_push_sample(const float gyro[3]){
+    for(uint8_t axis = 0; axis < 3; axis++){
+        m_buffer[axis][m_buffer_index] = gyro[axis];
+    }
+    m_buffer_index = (m_buffer_index + 1) % DYNAMIC_NOTCH_FFT_SIZE;
+}
+
+// Oldest sample first, windowed and put straight into bit reversed order for the butterflies
+static void window_step(){
+    const float *samples = m_buffer[m_axis];
+    float average = 0.0f;
+    for(uint8_t i = 0; i < DYNAMIC_NOTCH_FFT_SIZE; i++){
+        average += samples[i];
+    }
+    average /= DYNAMIC_NOTCH_FFT_SIZE; // The rotation rate would leak into the low bins otherwise
+
+    for(uint8_t i = 0; i < DYNAMIC_NOTCH_FFT_SIZE; i++){
+        uint8_t index = (m_buffer_index + i) % DYNAMIC_NOTCH_FFT_SIZE;
+        m_real[m_bit_reversed[i]] = (samples[index] - average) * m_window[i];
+        m_imaginary[m_bit_reversed[i]] = 0.0f;
+    }
+}
+
+// Radix 2 decimation in time, stage 0 combines pairs
+static void butterfly_step(uint8_t stage){
+    uint8_t half = 1 << stage;
+    uint8_t twiddle_stride = HALF_SIZE >> stage;
+    for(uint8_t start = 0; start < DYNAMIC_NOTCH_FFT_SIZE; start += half * 2){
+        for(uint8_t k = 0; k < half; k++){
+            uint8_t top = start + k;
+            uint8_t bottom = top + half;
+            float c = m_twiddle_cos[k * twiddle_stride];
+            float s = m_twiddle_sin[k * twiddle_stride];
+            // (c - js) * bottom
+            float real = c * m_real[bottom] + s * m_imaginary[bottom];
+            float imaginary = c * m_imaginary[bottom] - s * m_real[bottom];
+            m_real[bottom] = m_real[top] - real;
+            m_imaginary[bottom] = m_imaginary[top] - imaginary;
+            m_real[top] += real;
+            m_imaginary[top] += imaginary;
+        }
+    }
+}
+
+// Strongest local maxima in the band, interpolated with a parabola through the bins around them
+static void peaks_step(){
+    // Magnitudes go over the real part, it is not needed anymore
+    float band_sum = 0.0f;
+    for(uint8_t bin = m_minimum_bin - 1; bin <= m_maximum_bin + 1; bin++){
+        m_real[bin] = fast_sqrtf(m_real[bin] * m_real[bin] + m_imaginary[bin] * m_imaginary[bin]);
+    }
+    for(uint8_t bin = m_minimum_bin; bin <= m_maximum_bin; bin++){
+        band_sum += m_real[bin];
+    }
+    float band_average = band_sum / (m_maximum_bin - m_minimum_bin + 1);
+
+    uint8_t peak_bins[DYNAMIC_NOTCH_MAX_PEAKS] = {0};
+    for(uint8_t bin = m_minimum_bin; bin <= m_maximum_bin; bin++){
+        float magnitude = m_real[bin];
+        if(magnitude <= m_real[bin - 1] || magnitude < m_real[bin + 1] || magnitude < band_average * PEAK_TO_AVERAGE_MINIMUM){
+            continue;
+        }
+        // Keep the strongest, sorted by magnitude
+        for(uint8_t peak = 0; peak < m_peak_count; peak++){
+            if(peak_bins[peak] == 0 || magnitude > m_real[peak_bins[peak]]){
+                for(uint8_t i = m_peak_count - 1; i > peak; i--){
+                    peak_bins[i] = peak_bins[i - 1];
+                }
+                peak_bins[peak] = bin;
+                break;
+            }
+        }
+    }
+
+    // Lowest frequency first so every notch keeps following the same peak
+    float found[DYNAMIC_NOTCH_MAX_PEAKS];
+    uint8_t found_count = 0;
+    for(uint8_t peak = 0; peak < m_peak_count && peak_bins[peak] != 0; peak++){
+        uint8_t bin = peak_bins[peak];
+        float before = m_real[bin - 1];
+        float center = m_real[bin];
+        float after = m_real[bin + 1];
+        float curvature = before - 2.0f * center + after;
+        float offset = curvature < 0.0f ? 0.5f * (before - after) / curvature : 0.0f;
+        float frequency = (bin + offset) * m_bin_hz;
+        if(frequency < m_minimum_hz){
+            frequency = m_minimum_hz;
+        }else if(frequency > m_maximum_hz){
+            frequency = m_maximum_hz;
+        }
+
+        uint8_t i = found_count++;
+        while(i > 0 && found[i - 1] > frequency){
+            found[i] = found[i - 1];
+            i--;
+        }
+        found[i] = frequency;
+    }
+
+    // With fewer peaks than notches (one motor speed for all motors) the spare notches go to the nearest found peak
+    for(uint8_t notch = 0; notch < m_peak_count && found_count > 0; notch++){
+        float target = found[notch < found_count ? notch : found_count - 1];
+        m_frequencies[m_axis][notch] += FREQUENCY_SMOOTHING * (target - m_frequencies[m_axis][notch]);
+    }
+}
+
+// Runs steps until the next one would not fit in budget_us anymore, at least one. Stops at the end of an axis.
+// Returns the axis that got new notch frequencies or -1
+int8_t dynamic_notch_update(uint32_t budget_us){
+    uint32_t budget_cycles = budget_us * (SystemCoreClock / 1000000);
+    uint32_t spent_cycles = 0;
+    do{
+        uint32_t start = timebase_get_cycles();
+        if(m_step == STEP_WINDOW){
+            window_step();
+        }else if(m_step == STEP_PEAKS){
+            peaks_step();
+        }else{
+            butterfly_step(m_step - 1);
+        }
+        uint32_t cycles = timebase_get_cycles() - start;
+        if(cycles > m_step_cycles[m_step]){
+            m_step_cycles[m_step] = cycles;
+        }
+        spent_cycles += cycles;
+
+        m_step++;
+        if(m_step == STEP_COUNT){
+            int8_t finished_axis = m_axis;
+            m_step = STEP_WINDOW;
+            m_axis = (m_axis + 1) % 3;
+            return finished_axis;
+        }
+    }while(spent_cycles + m_step_cycles[m_step] <= budget_cycles);
+    return -1;
+}
+
+void dynamic_notch_get_frequencies_hz(uint8_t axis, float *frequencies){
+    for(uint8_t peak = 0; peak < m_peak_count; peak++){
+        frequencies[peak] = m_frequencies[axis][peak];
+    }
+}
+
+uint8_t dynamic_notch_get_peak_count(){
+    return m_peak_count;
+}
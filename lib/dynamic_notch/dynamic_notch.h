@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../timebase/timebase.h"
+#include "../fastmath/fastmath.h"
+
+// Finds the motor and prop noise in the gyro so the notches in the gyro filters can follow it with the throttle.
+// Every unfiltered gyro sample goes into a ring buffer per axis. The FFT of the newest DYNAMIC_NOTCH_FFT_SIZE samples of one
+// axis at a time is done in small steps (window, one butterfly stage per step, peak search), as many steps per call
+// as fit in the cycle budget, so no single loop pays for a whole FFT. The axes take turns.
+// The strongest peaks between the minimum and maximum frequency become the notch frequencies, lowest first.
+//
+// 128 samples at 1kHz is 7.8Hz per bin, the peak is interpolated between the bins.
+
+#define DYNAMIC_NOTCH_FFT_SIZE 128
+#define DYNAMIC_NOTCH_MAX_PEAKS 2
+
+uint8_t init_dynamic_notch(float sample_rate_hz, float minimum_hz, float maximum_hz, uint8_t peak_count, float initial_hz);
+void dynamic_notch_push_sample(const float gyro[3]);
+int8_t dynamic_notch_update(uint32_t budget_us);
+void dynamic_notch_get_frequencies_hz(uint8_t axis, float *frequencies);
+uint8_t dynamic_notch_get_peak_count();
@@ -0,0 +1,286 @@
+#include "./fastmath.h"
+
+#define PI_F 3.14159265f
+#define HALF_PI_F 1.57079633f
+#define TWO_PI_F 6.28318531f
+#define INVERSE_TWO_PI_F 0.159154943f
+#define SQRT_2_F 1.41421356f
+#define LN_2_F 0.693147181f
+
+#define BENCHMARK_SPEED_SAMPLES 256
+#define BENCHMARK_ERROR_SAMPLES 20000
+
+// For getting at the bits of a float without breaking aliasing rules
+union float_bits {
+    float value;
+    uint32_t bits;
+};
+
+// The FPU has a square root instruction, 14 cycles. sqrtf would go through the library to set errno on negative numbers
+float fast_sqrtf(float x)
+{
+#if defined(__ARM_FP) && (__ARM_FP & 4)
+    float result;
+    __asm__("vsqrt.f32 %0, %1" : "=t"(result) : "t"(x));
+    return result;
+#else
+    return __builtin_sqrtf(x);
+#endif
+}
+
+// Bit trick first guess, then two Newton steps. No division and no square root
+float fast_inverse_sqrtf(float x)
+{
+    union float_bits guess = {x};
+    guess.bits = 0x5F375A86 - (guess.bits >> 1);
+
+    float half_x = 0.5f * x;
+    float y = guess.value;
+    y = y * (1.5f - half_x * y * y);
+    y = y * (1.5f - half_x * y * y);
+    return y;
+}
+
+// atan for -1 <= z <= 1. Abramowitz and Stegun 4.4.47, error about 1e-5 rad
+static float atan_unit_range(float z)
+{
+    float z2 = z * z;
+    return z * (0.9998660f + z2 * (-0.3302995f + z2 * (0.1801410f + z2 * (-0.0851330f + z2 * 0.0208351f))));
+}
+
+// Same quadrants as atan2f. The polynomial only works up to 45 degrees, above that the ratio is flipped
+float fast_atan2f(float y, float x)
+{
+    float abs_x = fabsf(x);
+    float abs_y = fabsf(y);
+    if (abs_x == 0.0f && abs_y == 0.0f)
+    {
+        return 0.0f;
+    }
+
+    if (abs_y > abs_x)
+    {
+        return (y > 0.0f ? HALF_PI_F : -HALF_PI_F) - atan_unit_range(x / y);
+    }
+
+    float angle = atan_unit_range(y / x);
+    if (x < 0.0f)
+    {
+        angle += y >= 0.0f ? PI_F : -PI_F;
+    }
+    return angle;
+}
+
+// Through atan2 so it keeps its accuracy near +-1 where asin gets steep
+float fast_asinf(float x)
+{
+    x = x > 1.0f ? 1.0f : (x < -1.0f ? -1.0f : x);
+    return fast_atan2f(x, fast_sqrtf((1.0f - x) * (1.0f + x)));
+}
+
+// Brought into -pi/2 to pi/2 where the series up to x^11 is good to about 1e-7
+float fast_sinf(float x)
+{
+    // To -pi..pi. Gets less accurate the bigger x is, the float only has so many digits
+    float turns = x * INVERSE_TWO_PI_F;
+    turns = (float)(int32_t)(turns + (turns >= 0.0f ? 0.5f : -0.5f));
+    x -= turns * TWO_PI_F;
+
+    // sin(pi - x) = sin(x)
+    if (x > HALF_PI_F)
+    {
+        x = PI_F - x;
+    }
+    else if (x < -HALF_PI_F)
+    {
+        x = -PI_F - x;
+    }
+
+    float x2 = x * x;
+    return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f + x2 * (-1.0f / 39916800.0f))))));
+}
+
+float fast_cosf(float x)
+{
+    return fast_sinf(x + HALF_PI_F);
+}
+
+// 2^(y * log2(x)). The log from the exponent bits and a series of the mantissa, the power of two from the
+// integer part put straight into the exponent bits and a series for the fraction
+float fast_powf(float x, float y)
+{
+    if (x <= 0.0f)
+    {
+        return x == 0.0f && y > 0.0f ? 0.0f : NAN;
+    }
+
+    union float_bits parts = {x};
+    int32_t exponent = (int32_t)((parts.bits >> 23) & 0xFF) - 127;
+    parts.bits = (parts.bits & 0x007FFFFF) | 0x3F800000;
+    float mantissa = parts.value; // 1 to 2
+    if (mantissa > SQRT_2_F)
+    {
+        mantissa *= 0.5f;
+        exponent++;
+    }
+
+    // log2(m) = 2 / ln2 * atanh(t), t is at most 0.172 so four terms are plenty
+    float t = (mantissa - 1.0f) / (mantissa + 1.0f);
+    float t2 = t * t;
+    float log2_x = (float)exponent + t * (2.0f / LN_2_F) * (1.0f + t2 * (1.0f / 3.0f + t2 * (1.0f / 5.0f + t2 * (1.0f / 7.0f))));
+
+    float power = y * log2_x;
+    if (power >= 128.0f)
+    {
+        return INFINITY;
+    }
+    if (power <= -125.0f)
+    {
+        return 0.0f;
+    }
+
+    int32_t whole = (int32_t)(power + (power >= 0.0f ? 0.5f : -0.5f));
+    float fraction = (power - (float)whole) * LN_2_F; // -0.347 to 0.347
+    float result = 1.0f + fraction * (1.0f + fraction * (1.0f / 2.0f + fraction * (1.0f / 6.0f + fraction * (1.0f / 24.0f + fraction * (1.0f / 120.0f + fraction * (1.0f / 720.0f))))));
+
+    parts.value = result;
+    parts.bits += (uint32_t)whole << 23;
+    return parts.value;
+}
+
+// Benchmark ##############################################################################################
+// Every column goes through the same kind of wrapper so the call overhead is the same for all of them.
+// The double column is what the code paid before, float in, double math, float out.
+
+static float fast_sqrt_case(float a, float b) { return fast_sqrtf(a); }
+static float float_sqrt_case(float a, float b) { return sqrtf(a); }
+static float double_sqrt_case(float a, float b) { return sqrt(a); }
+static double reference_sqrt(double a, double b) { return sqrt(a); }
+
+static float fast_inverse_sqrt_case(float a, float b) { return fast_inverse_sqrtf(a); }
+static float float_inverse_sqrt_case(float a, float b) { return 1.0f / sqrtf(a); }
+static float double_inverse_sqrt_case(float a, float b) { return 1.0 / sqrt(a); }
+static double reference_inverse_sqrt(double a, double b) { return 1.0 / sqrt(a); }
+
+static float fast_atan2_case(float a, float b) { return fast_atan2f(a, b); }
+static float float_atan2_case(float a, float b) { return atan2f(a, b); }
+static float double_atan2_case(float a, float b) { return atan2(a, b); }
+static double reference_atan2(double a, double b) { return atan2(a, b); }
+
+static float fast_asin_case(float a, float b) { return fast_asinf(a); }
+static float float_asin_case(float a, float b) { return asinf(a); }
+static float double_asin_case(float a, float b) { return asin(a); }
+static double reference_asin(double a, double b) { return asin(a); }
+
+static float fast_sin_case(float a, float b) { return fast_sinf(a); }
+static float float_sin_case(float a, float b) { return sinf(a); }
+static float double_sin_case(float a, float b) { return sin(a); }
+static double reference_sin(double a, double b) { return sin(a); }
+
+static float fast_cos_case(float a, float b) { return fast_cosf(a); }
+static float float_cos_case(float a, float b) { return cosf(a); }
+static float double_cos_case(float a, float b) { return cos(a); }
+static double reference_cos(double a, double b) { return cos(a); }
+
+static float fast_pow_case(float a, float b) { return fast_powf(a, b); }
+static float float_pow_case(float a, float b) { return powf(a, b); }
+static float double_pow_case(float a, float b) { return pow(a, b); }
+static double reference_pow(double a, double b) { return pow(a, b); }
+
+struct benchmark_case{
+    const char *name;
+    float (*fast)(float a, float b);
+    float (*single_precision)(float a, float b);
+    float (*double_precision)(float a, float b);
+    double (*reference)(double a, double b);
+    float min_a, max_a;
+    float min_b, max_b;
+    uint8_t relative; // Report the error relative to the value, otherwise absolute
+};
+
+static const struct benchmark_case m_benchmark_cases[] = {
+    {"sqrt",         fast_sqrt_case,         float_sqrt_case,         double_sqrt_case,         reference_sqrt,         0.0f,    1000.0f,  0.0f,   0.0f,  1},
+    {"inverse sqrt", fast_inverse_sqrt_case, float_inverse_sqrt_case, double_inverse_sqrt_case, reference_inverse_sqrt, 0.001f,  1000.0f,  0.0f,   0.0f,  1},
+    {"atan2",        fast_atan2_case,        float_atan2_case,        double_atan2_case,        reference_atan2,        -10.0f,  10.0f,    -10.0f, 10.0f, 0},
+    {"asin",         fast_asin_case,         float_asin_case,         double_asin_case,         reference_asin,         -1.0f,   1.0f,     0.0f,   0.0f,  0},
+    {"sin",          fast_sin_case,          float_sin_case,          double_sin_case,          reference_sin,          -100.0f, 100.0f,   0.0f,   0.0f,  0},
+    {"cos",          fast_cos_case,          float_cos_case,          double_cos_case,          reference_cos,          -100.0f, 100.0f,   0.0f,   0.0f,  0},
+    {"pow",          fast_pow_case,          float_pow_case,          double_pow_case,          reference_pow,          0.01f,   100.0f,   -3.0f,  3.0f,  1},
+};
+
+static uint32_t m_random_state = 1;
+
+// Deterministic so runs compare, 0 to 1
+static float random_unit()
+{
+    m_random_state = m_random_state * 1664525 + 1013904223;
+    return (float)(m_random_state >> 8) / 16777216.0f;
+}
+
+// Average cycles per call over the inputs
+static uint32_t measure_cycles(float (*function)(float a, float b), const float *inputs_a, const float *inputs_b)
+{
+    volatile float sink = 0.0f;
+    uint32_t start = timebase_get_cycles();
+    for (uint16_t i = 0; i < BENCHMARK_SPEED_SAMPLES; i++)
+    {
+        sink = function(inputs_a[i], inputs_b[i]);
+    }
+    uint32_t end = timebase_get_cycles();
+    (void)sink;
+    return (end - start) / BENCHMARK_SPEED_SAMPLES;
+}
+
+// Speed against sinf and friends and the double functions, and the worst error against double libm.
+// Blocks for a while, only for the bench
+void fastmath_print_benchmark()
+{
+    float inputs_a[BENCHMARK_SPEED_SAMPLES];
+    float inputs_b[BENCHMARK_SPEED_SAMPLES];
+
+    printf("FASTMATH cycles per call, fast float double, worst error against double libm\n");
+    for (uint8_t c = 0; c < sizeof(m_benchmark_cases) / sizeof(m_benchmark_cases[0]); c++)
+    {
+        const struct benchmark_case *test = &m_benchmark_cases[c];
+
+        m_random_state = 1;
+        for (uint16_t i = 0; i < BENCHMARK_SPEED_SAMPLES; i++)
+        {
+            inputs_a[i] = test->min_a + (test->max_a - test->min_a) * random_unit();
+            inputs_b[i] = test->min_b + (test->max_b - test->min_b) * random_unit();
+        }
+
+        uint32_t fast_cycles = measure_cycles(test->fast, inputs_a, inputs_b);
+        uint32_t single_cycles = measure_cycles(test->single_precision, inputs_a, inputs_b);
+        uint32_t double_cycles = measure_cycles(test->double_precision, inputs_a, inputs_b);
+
+        double worst_error = 0.0;
+        for (uint32_t i = 0; i < BENCHMARK_ERROR_SAMPLES; i++)
+        {
+            float a = test->min_a + (test->max_a - test->min_a) * random_unit();
+            float b = test->min_b + (test->max_b - test->min_b) * random_unit();
+            double reference = test->reference(a, b);
+            double error = fabs((double)test->fast(a, b) - reference);
+            if (test->relative)
+            {
+                if (reference == 0.0)
+                {
+                    continue;
+                }
+                error /= fabs(reference);
+            }
+            if (error > worst_error)
+            {
+                worst_error = error;
+            }
+        }
+
+        printf("%-13s %5lu %5lu %6lu  %s %.2e\n",
+            test->name,
+            (unsigned long)fast_cycles,
+            (unsigned long)single_cycles,
+            (unsigned long)double_cycles,
+            test->relative ? "relative" : "absolute",
+            worst_error);
+    }
+}
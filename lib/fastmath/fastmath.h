@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../timebase/timebase.h"
+#include <math.h>
+
+// Float only math for the hot paths. The F411 FPU does single precision in hardware, anything double
+// (pow, sqrt, sin, atan2 without the f) goes through the software library and costs hundreds of cycles.
+// Worst case errors over the whole input range, measured with fastmath_print_benchmark against double libm:
+//
+//   fast_sqrtf           hardware vsqrt, exact
+//   fast_inverse_sqrtf   relative 5e-6
+//   fast_atan2f          absolute 1.2e-5 rad
+//   fast_asinf           absolute 1.2e-5 rad
+//   fast_sinf, fast_cosf absolute 2e-7 within +-pi, 1e-5 out to +-100 rad from the range reduction
+//   fast_powf            relative 1e-6 * (1 + |y * log2(x)|), x has to be a positive normal float
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+// M_PI is a double, 180 / M_PI would drag the whole expression into double math
+#define RADIANS_TO_DEGREES_F 57.2957795f
+#define DEGREES_TO_RADIANS_F 0.0174532925f
+
+float fast_sqrtf(float x);
+float fast_inverse_sqrtf(float x);
+float fast_atan2f(float y, float x);
+float fast_asinf(float x);
+float fast_sinf(float x);
+float fast_cosf(float x);
+float fast_powf(float x, float y);
+void fastmath_print_benchmark();
@@ -0,0 +1,172 @@
+#include "./filters.h"
+
+#define BENCHMARK_RUNS 1000
+#define BENCHMARK_BLOCK_SIZE 5
+
+// Coefficients from the audio eq cookbook (Robert Bristow-Johnson), divided through by a0
+static uint8_t calculate_coefficients(const struct filter_stage *stage, float sample_rate_hz, float *coefficients){
+    if(stage->frequency_hz <= 0.0f || stage->frequency_hz >= 0.5f * sample_rate_hz){
+        return 0;
+    }
+    if(stage->type != FILTER_PT1 && stage->q <= 0.0f){
+        return 0;
+    }
+
+    float omega = 2.0f * (float)M_PI * stage->frequency_hz / sample_rate_hz;
+    if(stage->type == FILTER_PT1){
+        // y = y1 + k * (x - y1)
+        float k = omega / (omega + 1.0f);
+        coefficients[0] = k;
+        coefficients[1] = 0.0f;
+        coefficients[2] = 0.0f;
+        coefficients[3] = 1.0f - k;
+        coefficients[4] = 0.0f;
+        return 1;
+    }
+
+    float sin_omega = fast_sinf(omega);
+    float cos_omega = fast_cosf(omega);
+    float alpha = sin_omega / (2.0f * stage->q);
+    float inverse_a0 = 1.0f / (1.0f + alpha);
+
+    if(stage->type == FILTER_LOWPASS){
+        coefficients[0] = 0.5f * (1.0f - cos_omega) * inverse_a0;
+        coefficients[1] = (1.0f - cos_omega) * inverse_a0;
+        coefficients[2] = coefficients[0];
+    }else{
+        coefficients[0] = inverse_a0;
+        coefficients[1] = -2.0f * cos_omega * inverse_a0;
+        coefficients[2] = inverse_a0;
+    }
+    coefficients[3] = 2.0f * cos_omega * inverse_a0;
+    coefficients[4] = -(1.0f - alpha) * inverse_a0;
+    return 1;
+}
+
+// stages are copied, the array does not have to stay around. Returns 0 when there are too many stages or
+// a frequency is not below half the sample rate
+uint8_t init_filter_chain(struct filter_chain *chain, const struct filter_stage *stages, uint8_t stage_count, float sample_rate_hz){
+    chain->stage_count = 0;
+    chain->sample_rate_hz = sample_rate_hz;
+    if(stage_count > FILTER_CHAIN_MAX_STAGES){
+        return 0;
+    }
+    for(uint8_t i = 0; i < stage_count; i++){
+        if(!calculate_coefficients(&stages[i], sample_rate_hz, &chain->coefficients[i * 5])){
+            return 0;
+        }
+    }
+    chain->stage_count = stage_count;
+
+#ifdef FILTERS_USE_CMSIS_DSP
+    arm_biquad_cascade_df1_init_f32(&chain->instance, stage_count, chain->coefficients, chain->state);
+#endif
+    filter_chain_reset(chain);
+    return 1;
+}
+
+// Swap one stage for another without touching the rest of the chain or the history, for a notch that moves
+uint8_t filter_chain_set_stage(struct filter_chain *chain, uint8_t stage_index, const struct filter_stage *stage){
+    if(stage_index >= chain->stage_count){
+        return 0;
+    }
+    float coefficients[5];
+    if(!calculate_coefficients(stage, chain->sample_rate_hz, coefficients)){
+        return 0;
+    }
+    for(uint8_t i = 0; i < 5; i++){
+        chain->coefficients[stage_index * 5 + i] = coefficients[i];
+    }
+    return 1;
+}
+
+void filter_chain_reset(struct filter_chain *chain){
+    for(uint8_t i = 0; i < FILTER_CHAIN_MAX_STAGES * 4; i++){
+        chain->state[i] = 0.0f;
+    }
+}
+
+#ifndef FILTERS_USE_CMSIS_DSP
+// Direct form 1 the same way CMSIS-DSP does it, so both give the same numbers
+static float apply_sample(struct filter_chain *chain, float input){
+    float value = input;
+    for(uint8_t i = 0; i < chain->stage_count; i++){
+        const float *c = &chain->coefficients[i * 5];
+        float *s = &chain->state[i * 4];
+        float output = c[0] * value + c[1] * s[0] + c[2] * s[1] + c[3] * s[2] + c[4] * s[3];
+        s[1] = s[0];
+        s[0] = value;
+        s[3] = s[2];
+        s[2] = output;
+        value = output;
+    }
+    return value;
+}
+#endif
+
+float filter_chain_apply(struct filter_chain *chain, float input){
+    if(chain->stage_count == 0){
+        return input;
+    }
+#ifdef FILTERS_USE_CMSIS_DSP
+    float output;
+    arm_biquad_cascade_df1_f32(&chain->instance, &input, &output, 1);
+    return output;
+#else
+    return apply_sample(chain, input);
+#endif
+}
+
+// input and output can be the same array
+void filter_chain_apply_block(struct filter_chain *chain, const float *input, float *output, uint16_t count){
+    if(chain->stage_count == 0){
+        for(uint16_t i = 0; i < count; i++){
+            output[i] = input[i];
+        }
+        return;
+    }
+#ifdef FILTERS_USE_CMSIS_DSP
+    arm_biquad_cascade_df1_f32(&chain->instance, (float *)input, output, count);
+#else
+    for(uint16_t i = 0; i < count; i++){
+        output[i] = apply_sample(chain, input[i]);
+    }
+#endif
+}
+
+// Cycles per sample of a notch and a low pass, the gyro chain in main, one sample at a time and in blocks
+// like a drain after a late loop gives them. Also how much of a 1kHz loop three axes of it take
+void filters_print_benchmark(){
+    struct filter_stage stages[] = {
+        {FILTER_NOTCH, 235.0f, 2.5f},
+        {FILTER_LOWPASS, 100.0f, 0.7071f},
+    };
+    struct filter_chain chain;
+    init_filter_chain(&chain, stages, 2, 1000.0f);
+
+    float block[BENCHMARK_BLOCK_SIZE];
+    float output = 0.0f;
+    uint32_t start = timebase_get_cycles();
+    for(uint16_t i = 0; i < BENCHMARK_RUNS; i++){
+        output = filter_chain_apply(&chain, (float)(i & 0x0F) + output * 0.001f);
+    }
+    uint32_t single_cycles = (timebase_get_cycles() - start) / BENCHMARK_RUNS;
+
+    start = timebase_get_cycles();
+    for(uint16_t i = 0; i < BENCHMARK_RUNS / BENCHMARK_BLOCK_SIZE; i++){
+        for(uint8_t k = 0; k < BENCHMARK_BLOCK_SIZE; k++){
+            block[k] = (float)((i + k) & 0x0F);
+        }
+        filter_chain_apply_block(&chain, block, block, BENCHMARK_BLOCK_SIZE);
+    }
+    uint32_t block_cycles = (timebase_get_cycles() - start) / BENCHMARK_RUNS;
+
+#ifdef FILTERS_USE_CMSIS_DSP
+    const char *backend = "CMSIS-DSP";
+#else
+    const char *backend = "plain C";
+#endif
+    printf("Filter chain (notch and low pass, %s) cycles per sample %lu, in blocks of %d %lu\n",
+        backend, (unsigned long)single_cycles, BENCHMARK_BLOCK_SIZE, (unsigned long)block_cycles);
+    printf("Three axes at 1kHz: %.2f%% of the cpu\n", 3 * block_cycles * 100.0f / (SystemCoreClock / 1000));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../timebase/timebase.h"
+#include "../fastmath/fastmath.h"
+
+// Low pass, notch and PT1 filters for the gyro.
+// The coefficients are made for one fixed sample rate. The pid D term has its own PT1 in pid.c instead, it runs on the
+// measured loop time, which is not always the same.
+// A chain is a few stages one after the other on one signal, so every axis has its own chain.
+// Every stage is stored as a biquad, a PT1 is one with the second order part left at zero, so the whole chain
+// is one biquad cascade. Built with FILTERS_USE_CMSIS_DSP that runs through arm_biquad_cascade_df1_f32,
+// otherwise through the same direct form 1 in plain C (the native build always uses that).
+// The block functions take all the samples of one fifo drain at once. The rate loop wakes for every gyro sample,
+// so that is usually one, more when a loop came late.
+
+#ifdef FILTERS_USE_CMSIS_DSP
+#include "arm_math.h"
+#endif
+
+#define FILTER_CHAIN_MAX_STAGES 4
+
+enum t_filter_type {
+    FILTER_PT1,     // First order low pass, q is not used
+    FILTER_LOWPASS, // Second order low pass, q 0.7071 is flat (butterworth)
+    FILTER_NOTCH,   // q is the center frequency over the width of the notch
+};
+
+struct filter_stage {
+    enum t_filter_type type;
+    float frequency_hz;
+    float q;
+};
+
+struct filter_chain {
+    uint8_t stage_count;
+    float sample_rate_hz;
+    float coefficients[FILTER_CHAIN_MAX_STAGES * 5]; // b0, b1, b2, a1, a2 per stage. a1 and a2 negated the way CMSIS-DSP has them
+    float state[FILTER_CHAIN_MAX_STAGES * 4];        // x[n-1], x[n-2], y[n-1], y[n-2] per stage
+#ifdef FILTERS_USE_CMSIS_DSP
+    arm_biquad_casd_df1_inst_f32 instance;
+#endif
+};
+
+uint8_t init_filter_chain(struct filter_chain *chain, const struct filter_stage *stages, uint8_t stage_count, float sample_rate_hz);
+uint8_t filter_chain_set_stage(struct filter_chain *chain, uint8_t stage_index, const struct filter_stage *stage);
+void filter_chain_reset(struct filter_chain *chain);
+float filter_chain_apply(struct filter_chain *chain, float input);
+void filter_chain_apply_block(struct filter_chain *chain, const float *input, float *output, uint16_t count);
+void filters_print_benchmark();
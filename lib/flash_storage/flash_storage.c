@@ -0,0 +1,89 @@
+#include "./flash_storage.h"
+
+#define FLASH_STORAGE_ADDRESS (FLASH_BASE + 0x60000)
+#define FLASH_STORAGE_SECTOR FLASH_SECTOR_7
+#define SLOT_MAGIC 0x51F7C0DEU // Change when the slot layout changes, old slots then read as missing
+
+struct flash_storage_slot {
+    uint32_t magic;
+    uint16_t size;
+    uint16_t checksum;
+    uint8_t data[FLASH_STORAGE_SLOT_DATA_SIZE];
+};
+
+// Everything in the sector, so one slot can be rewritten after the erase took the others with it
+static struct flash_storage_slot m_slots[FLASH_STORAGE_SLOT_COUNT];
+
+// Fletcher-16, catches a write that got cut off by a power loss
+static uint16_t calculate_checksum(const uint8_t *data, uint16_t size){
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    for(uint16_t i = 0; i < size; i++){
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+static uint8_t slot_valid(const struct flash_storage_slot *slot){
+    return slot->magic == SLOT_MAGIC &&
+           slot->size <= FLASH_STORAGE_SLOT_DATA_SIZE &&
+           slot->checksum == calculate_checksum(slot->data, slot->size);
+}
+
+// Copies the sector into ram, flash is memory mapped so this is just a read
+uint8_t init_flash_storage(){
+    memcpy(m_slots, (const void *)FLASH_STORAGE_ADDRESS, sizeof(m_slots));
+    return 1;
+}
+
+// 0 when the slot is missing or was stored with a different size
+uint8_t flash_storage_read(enum t_flash_storage_slot slot, void *data, uint16_t size){
+    if(slot >= FLASH_STORAGE_SLOT_COUNT || !slot_valid(&m_slots[slot]) || m_slots[slot].size != size){
+        return 0;
+    }
+    memcpy(data, m_slots[slot].data, size);
+    return 1;
+}
+
+// Erases the sector and writes all the slots back with the new one in it
+uint8_t flash_storage_write(enum t_flash_storage_slot slot, const void *data, uint16_t size){
+    if(slot >= FLASH_STORAGE_SLOT_COUNT || size > FLASH_STORAGE_SLOT_DATA_SIZE){
+        return 0;
+    }
+
+    memset(&m_slots[slot], 0xFF, sizeof(m_slots[slot]));
+    memcpy(m_slots[slot].data, data, size);
+    m_slots[slot].magic = SLOT_MAGIC;
+    m_slots[slot].size = size;
+    m_slots[slot].checksum = calculate_checksum(m_slots[slot].data, size);
+
+    FLASH_EraseInitTypeDef erase = {0};
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = FLASH_STORAGE_SECTOR;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3; // 2.7 to 3.6V, programs 32 bits at a time
+    uint32_t sector_error = 0;
+
+    HAL_FLASH_Unlock();
+    if(HAL_FLASHEx_Erase(&erase, &sector_error) != HAL_OK){
+        HAL_FLASH_Lock();
+        printf("Flash storage erase failed\n");
+        return 0;
+    }
+
+    // The slots are a multiple of 4 bytes
+    const uint32_t *words = (const uint32_t *)m_slots;
+    for(uint32_t i = 0; i < sizeof(m_slots) / 4; i++){
+        if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, FLASH_STORAGE_ADDRESS + i * 4, words[i]) != HAL_OK){
+            HAL_FLASH_Lock();
+            printf("Flash storage write failed\n");
+            return 0;
+        }
+    }
+    HAL_FLASH_Lock();
+
+    // Read back what actually ended up in flash
+    init_flash_storage();
+    return slot_valid(&m_slots[slot]);
+}
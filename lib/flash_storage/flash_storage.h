@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+
+// Calibrations that survive a power cycle, kept in the last flash sector (sector 7, 128KB at 0x08060000).
+// The program has to stay below 384KB so it never reaches that sector, STM32F411CEUX_FLASH.ld in the project root makes the link fail when it does not.
+// Every setting has its own slot with its size and a checksum. A slot that was never written, or was written
+// with a different struct size, reads as missing.
+// Writing erases the whole sector, which stalls the cpu for 1-2 seconds. Only write on the ground.
+
+enum t_flash_storage_slot {
+    FLASH_STORAGE_SLOT_GYRO_TEMPERATURE_MODEL = 0,
+    FLASH_STORAGE_SLOT_MAGNETOMETER_CALIBRATION,
+    FLASH_STORAGE_SLOT_COUNT
+};
+
+#define FLASH_STORAGE_SLOT_DATA_SIZE 64
+
+uint8_t init_flash_storage();
+uint8_t flash_storage_read(enum t_flash_storage_slot slot, void *data, uint16_t size);
+uint8_t flash_storage_write(enum t_flash_storage_slot slot, const void *data, uint16_t size);
@@ -0,0 +1,287 @@
+#include "./i2c_scheduler.h"
+
+struct i2c_transaction{
+    uint8_t used;
+    uint8_t write;
+    uint8_t device_address; // Already shifted, same as the drivers pass to the HAL
+    uint8_t register_address;
+    uint8_t *data;
+    uint16_t size;
+    enum t_i2c_priority priority;
+    uint32_t order;
+    void (*callback)(uint8_t success);
+};
+
+static I2C_HandleTypeDef *i2c_handle;
+
+static struct i2c_transaction m_queue[I2C_SCHEDULER_QUEUE_SIZE];
+static volatile int8_t m_active_index = -1;
+static volatile uint32_t m_active_start_time = 0;
+static uint32_t m_order_counter = 0;
+
+static volatile uint32_t m_failed_count = 0;
+static volatile uint32_t m_timeout_count = 0;
+
+static void start_next_transaction();
+static uint8_t enter_critical();
+static void exit_critical(uint8_t interrupts_were_disabled);
+
+uint8_t init_i2c_scheduler(I2C_HandleTypeDef *i2c_handle_temp)
+{
+    i2c_handle = i2c_handle_temp;
+
+    for (uint8_t i = 0; i < I2C_SCHEDULER_QUEUE_SIZE; i++)
+    {
+        m_queue[i].used = 0;
+    }
+    m_active_index = -1;
+
+    return 1;
+}
+
+// Find the waiting transaction with the best priority. -1 if nothing is waiting
+static int8_t find_next_transaction()
+{
+    int8_t best = -1;
+    for (uint8_t i = 0; i < I2C_SCHEDULER_QUEUE_SIZE; i++)
+    {
+        if (!m_queue[i].used || i == m_active_index)
+        {
+            continue;
+        }
+
+        if (best == -1 ||
+            m_queue[i].priority < m_queue[best].priority ||
+            (m_queue[i].priority == m_queue[best].priority && (int32_t)(m_queue[i].order - m_queue[best].order) < 0))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Free the active slot and tell the driver how it went
+static void finish_active_transaction(uint8_t success)
+{
+    void (*callback)(uint8_t success) = m_queue[m_active_index].callback;
+    m_queue[m_active_index].used = 0;
+    m_active_index = -1;
+
+    if (!success)
+    {
+        m_failed_count++;
+    }
+
+    if (callback != NULL)
+    {
+        callback(success);
+    }
+}
+
+// The dma complete interrupt can come from inside HAL_I2C_Mem_Read_DMA so the active index is set before starting
+static void start_next_transaction()
+{
+    while (m_active_index == -1)
+    {
+        int8_t next = find_next_transaction();
+        if (next == -1)
+        {
+            return;
+        }
+
+        m_active_index = next;
+        m_active_start_time = HAL_GetTick();
+
+        HAL_StatusTypeDef status;
+        if (m_queue[next].write)
+        {
+            // Writes are a few bytes of config, not worth a dma stream
+            status = HAL_I2C_Mem_Write_IT(
+                i2c_handle,
+                m_queue[next].device_address,
+                m_queue[next].register_address,
+                I2C_MEMADD_SIZE_8BIT,
+                m_queue[next].data,
+                m_queue[next].size);
+        }
+        else
+        {
+            status = HAL_I2C_Mem_Read_DMA(
+                i2c_handle,
+                m_queue[next].device_address + 1,
+                m_queue[next].register_address,
+                I2C_MEMADD_SIZE_8BIT,
+                m_queue[next].data,
+                m_queue[next].size);
+        }
+
+        if (status == HAL_OK)
+        {
+            return;
+        }
+
+        // Could not even start it, give up on this one and try the next
+        finish_active_transaction(0);
+    }
+}
+
+// Callbacks may queue the next transaction from the interrupt, so only turn interrupts back on if they were on
+static uint8_t enter_critical()
+{
+    uint8_t interrupts_were_disabled = __get_PRIMASK() != 0;
+    __disable_irq();
+    return interrupts_were_disabled;
+}
+
+static void exit_critical(uint8_t interrupts_were_disabled)
+{
+    if (!interrupts_were_disabled)
+    {
+        __enable_irq();
+    }
+}
+
+static uint8_t queue_transaction(uint8_t write, uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size, enum t_i2c_priority priority, void (*callback)(uint8_t success))
+{
+    uint8_t interrupts_were_disabled = enter_critical();
+
+    int8_t free_index = -1;
+    for (uint8_t i = 0; i < I2C_SCHEDULER_QUEUE_SIZE; i++)
+    {
+        if (!m_queue[i].used)
+        {
+            free_index = i;
+            break;
+        }
+    }
+
+    if (free_index == -1)
+    {
+        exit_critical(interrupts_were_disabled);
+        return 0;
+    }
+
+    m_queue[free_index].write = write;
+    m_queue[free_index].device_address = device_address;
+    m_queue[free_index].register_address = register_address;
+    m_queue[free_index].data = data;
+    m_queue[free_index].size = size;
+    m_queue[free_index].priority = priority;
+    m_queue[free_index].order = m_order_counter++;
+    m_queue[free_index].callback = callback;
+    m_queue[free_index].used = 1;
+
+    if (m_active_index == -1)
+    {
+        start_next_transaction();
+    }
+
+    exit_critical(interrupts_were_disabled);
+    return 1;
+}
+
+// Queue a read of size bytes starting at register_address. Returns 0 if the queue is full
+uint8_t i2c_scheduler_queue_read(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size, enum t_i2c_priority priority, void (*callback)(uint8_t success))
+{
+    return queue_transaction(0, device_address, register_address, data, size, priority, callback);
+}
+
+// Queue a write. The data has to stay untouched until the callback
+uint8_t i2c_scheduler_queue_write(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size, enum t_i2c_priority priority, void (*callback)(uint8_t success))
+{
+    return queue_transaction(1, device_address, register_address, data, size, priority, callback);
+}
+
+// Call this from the loop. A device that holds the bus gets its read aborted instead of stalling everything
+void i2c_scheduler_check_timeout()
+{
+    uint8_t interrupts_were_disabled = enter_critical();
+    if (m_active_index == -1 ||
+        HAL_GetTick() - m_active_start_time < I2C_SCHEDULER_TIMEOUT_MS + m_queue[m_active_index].size / I2C_SCHEDULER_BYTES_PER_MS)
+    {
+        exit_critical(interrupts_were_disabled);
+        return;
+    }
+
+    // Take the transaction out first so a late dma interrupt does not finish it twice
+    int8_t timed_out_index = m_active_index;
+    void (*callback)(uint8_t success) = m_queue[timed_out_index].callback;
+    m_queue[timed_out_index].used = 0;
+    m_active_index = -1;
+    m_timeout_count++;
+    m_failed_count++;
+    exit_critical(interrupts_were_disabled);
+
+    // Resetting the peripheral also stops the dma stream. Has to run with interrupts on as it waits on the tick
+    HAL_I2C_DeInit(i2c_handle);
+    HAL_I2C_Init(i2c_handle);
+
+    if (callback != NULL)
+    {
+        callback(0);
+    }
+
+    interrupts_were_disabled = enter_critical();
+    if (m_active_index == -1)
+    {
+        start_next_transaction();
+    }
+    exit_critical(interrupts_were_disabled);
+}
+
+uint8_t i2c_scheduler_is_idle()
+{
+    uint8_t interrupts_were_disabled = enter_critical();
+    uint8_t idle = m_active_index == -1 && find_next_transaction() == -1;
+    exit_critical(interrupts_were_disabled);
+    return idle;
+}
+
+// Block until everything queued is done or failed. Returns 0 if it ran out of time
+uint8_t i2c_scheduler_wait_until_idle(uint32_t timeout_ms)
+{
+    uint32_t start_time = HAL_GetTick();
+    while (!i2c_scheduler_is_idle())
+    {
+        i2c_scheduler_check_timeout();
+        if (HAL_GetTick() - start_time >= timeout_ms)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Call from HAL_I2C_MemRxCpltCallback and HAL_I2C_MemTxCpltCallback
+void i2c_scheduler_transfer_complete_callback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c != i2c_handle || m_active_index == -1)
+    {
+        return;
+    }
+
+    finish_active_transaction(1);
+    start_next_transaction();
+}
+
+// Call from HAL_I2C_ErrorCallback. Nack or arbitration lost, the HAL has already released the bus
+void i2c_scheduler_error_callback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c != i2c_handle || m_active_index == -1)
+    {
+        return;
+    }
+
+    finish_active_transaction(0);
+    start_next_transaction();
+}
+
+uint32_t i2c_scheduler_get_failed_count()
+{
+    return m_failed_count;
+}
+
+uint32_t i2c_scheduler_get_timeout_count()
+{
+    return m_timeout_count;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "stm32f4xx_hal_i2c.h"
+#include "../printf/retarget.h"
+
+// Queued dma reads and interrupt writes on one i2c bus. Transfers are started in the background and the
+// drivers get a callback when their data is in the buffer. The callbacks run in
+// interrupt context so keep them short, just mark the data as ready.
+
+#define I2C_SCHEDULER_QUEUE_SIZE 8
+#define I2C_SCHEDULER_TIMEOUT_MS 2 // A read that takes longer than this is aborted and the bus is reset
+#define I2C_SCHEDULER_BYTES_PER_MS 40 // Long reads get more time on top of the timeout. About 44 bytes fit in a ms at 400kHz
+
+// Lower value goes first. Same priority goes in the order it was queued
+enum t_i2c_priority {
+    I2C_PRIORITY_HIGH   = 0,
+    I2C_PRIORITY_MEDIUM = 1,
+    I2C_PRIORITY_LOW    = 2,
+};
+
+// For the drivers to track their own queued read
+enum t_i2c_read_state {
+    I2C_READ_IDLE    = 0,
+    I2C_READ_PENDING = 1,
+    I2C_READ_DONE    = 2,
+    I2C_READ_FAILED  = 3,
+};
+
+uint8_t init_i2c_scheduler(I2C_HandleTypeDef *i2c_handle_temp);
+uint8_t i2c_scheduler_queue_read(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size, enum t_i2c_priority priority, void (*callback)(uint8_t success));
+uint8_t i2c_scheduler_queue_write(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size, enum t_i2c_priority priority, void (*callback)(uint8_t success));
+void i2c_scheduler_check_timeout();
+uint8_t i2c_scheduler_is_idle();
+uint8_t i2c_scheduler_wait_until_idle(uint32_t timeout_ms);
+void i2c_scheduler_transfer_complete_callback(I2C_HandleTypeDef *hi2c);
+void i2c_scheduler_error_callback(I2C_HandleTypeDef *hi2c);
+uint32_t i2c_scheduler_get_failed_count();
+uint32_t i2c_scheduler_get_timeout_count();
@@ -0,0 +1,122 @@
+#include "./inertial_navigation.h"
+
+#define STATES 3
+#define AXES 2
+
+// How unsure the filter is when the origin is taken
+#define INITIAL_POSITION_SIGMA 3.0f     // m, about one gps fix
+#define INITIAL_VELOCITY_SIGMA 0.5f     // m/s
+#define INITIAL_BIAS_SIGMA 0.3f         // m/s^2
+
+// Equator radius, plenty for the few kilometers a drone flies from its origin
+#define METERS_PER_DEGREE 111319.49f
+
+// Per axis, north then east: position, velocity, accelerometer bias
+static float m_state[AXES][STATES];
+static float m_covariance[AXES][STATES][STATES];
+
+static float m_accelerometer_variance = 0.0f;   // (m/s^2)^2
+static float m_bias_variance_density = 0.0f;    // (m/s^2)^2 per second
+static float m_gps_variance = 0.0f;             // m^2 at a horizontal dilution of 1
+
+static float m_declination_sin = 0.0f;
+static float m_declination_cos = 1.0f;
+
+static float m_origin_latitude = 0.0f;
+static float m_origin_longitude = 0.0f;
+static float m_meters_per_degree_longitude = METERS_PER_DEGREE;
+static uint8_t m_origin_set = 0;
+
+// accelerometer_noise_mps2 is the noise on the horizontal acceleration with the motors running.
+// accelerometer_bias_walk_mps2 is how fast the bias can wander, per sqrt(second). A small tilt error shows up as bias.
+// gps_noise_meters is the horizontal error of a fix with a dilution of 1.
+// magnetic_declination_degrees is east positive, from the noaa calculator for where it flies
+uint8_t init_inertial_navigation(float accelerometer_noise_mps2, float accelerometer_bias_walk_mps2, float gps_noise_meters, float magnetic_declination_degrees){
+    m_accelerometer_variance = accelerometer_noise_mps2 * accelerometer_noise_mps2;
+    m_bias_variance_density = accelerometer_bias_walk_mps2 * accelerometer_bias_walk_mps2;
+    m_gps_variance = gps_noise_meters * gps_noise_meters;
+    m_declination_sin = fast_sinf(magnetic_declination_degrees * DEGREES_TO_RADIANS_F);
+    m_declination_cos = fast_cosf(magnetic_declination_degrees * DEGREES_TO_RADIANS_F);
+
+    inertial_navigation_reset();
+    return 1;
+}
+
+// Forget the origin, the next gps fix becomes the new one
+void inertial_navigation_reset(){
+    for(uint8_t axis = 0; axis < AXES; axis++){
+        for(uint8_t i = 0; i < STATES; i++){
+            m_state[axis][i] = 0.0f;
+            for(uint8_t k = 0; k < STATES; k++){
+                m_covariance[axis][i][k] = 0.0f;
+            }
+        }
+        m_covariance[axis][0][0] = INITIAL_POSITION_SIGMA * INITIAL_POSITION_SIGMA;
+        m_covariance[axis][1][1] = INITIAL_VELOCITY_SIGMA * INITIAL_VELOCITY_SIGMA;
+        m_covariance[axis][2][2] = INITIAL_BIAS_SIGMA * INITIAL_BIAS_SIGMA;
+    }
+    m_origin_set = 0;
+}
+
+// Nothing is integrated before there is an origin, the velocity would have run off by then
+void inertial_navigation_predict(const float north_east_acceleration_mps2[2], float dt){
+    if(!m_origin_set){
+        return;
+    }
+    for(uint8_t axis = 0; axis < AXES; axis++){
+        // Same model as the vertical estimator, one axis at a time
+        vertical_estimator_predict_axis(m_state[axis], m_covariance[axis], north_east_acceleration_mps2[axis], dt, m_accelerometer_variance, m_bias_variance_density);
+    }
+}
+
+// horizontal_dilution is the hdop from the fix, bn357_get_accuracy. The error grows with it
+void inertial_navigation_update_gps(float latitude_degrees, float longitude_degrees, float horizontal_dilution){
+    if(!m_origin_set){
+        m_origin_latitude = latitude_degrees;
+        m_origin_longitude = longitude_degrees;
+        m_meters_per_degree_longitude = METERS_PER_DEGREE * fast_cosf(latitude_degrees * DEGREES_TO_RADIANS_F);
+        m_origin_set = 1;
+        return;
+    }
+
+    // Flat earth around the origin
+    float position[AXES] = {
+        (latitude_degrees - m_origin_latitude) * METERS_PER_DEGREE,
+        (longitude_degrees - m_origin_longitude) * m_meters_per_degree_longitude
+    };
+    float dilution = horizontal_dilution > 1.0f ? horizontal_dilution : 1.0f;
+    float variance = m_gps_variance * dilution * dilution;
+    for(uint8_t axis = 0; axis < AXES; axis++){
+        vertical_estimator_update_axis(m_state[axis], m_covariance[axis], position[axis], variance);
+    }
+}
+
+uint8_t inertial_navigation_has_origin(){
+    return m_origin_set;
+}
+
+void inertial_navigation_get_position_meters(float *north_east){
+    north_east[0] = m_state[0][0];
+    north_east[1] = m_state[1][0];
+}
+
+void inertial_navigation_get_velocity_mps(float *north_east){
+    north_east[0] = m_state[0][1];
+    north_east[1] = m_state[1][1];
+}
+
+// One sigma of the worse axis. Grows while the gps is gone, a position hold should give up when it gets large
+float inertial_navigation_get_position_uncertainty_meters(){
+    float variance = m_covariance[0][0][0] > m_covariance[1][0][0] ? m_covariance[0][0][0] : m_covariance[1][0][0];
+    return fast_sqrtf(variance);
+}
+
+// The accelerometer turned into the world frame like vertical_estimator_get_vertical_acceleration_mps2 does.
+// The world frame is x magnetic north, y west, z up, so east is minus y before the declination turns it to true north
+void inertial_navigation_get_horizontal_acceleration_mps2(const float rotation[3][3], const float accelerometer_g[3], float *north_east){
+    float magnetic_north_g = rotation[0][0] * accelerometer_g[0] + rotation[0][1] * accelerometer_g[1] + rotation[0][2] * accelerometer_g[2];
+    float magnetic_east_g = -(rotation[1][0] * accelerometer_g[0] + rotation[1][1] * accelerometer_g[1] + rotation[1][2] * accelerometer_g[2]);
+
+    north_east[0] = (magnetic_north_g * m_declination_cos - magnetic_east_g * m_declination_sin) * GRAVITY_MPS2;
+    north_east[1] = (magnetic_north_g * m_declination_sin + magnetic_east_g * m_declination_cos) * GRAVITY_MPS2;
+}
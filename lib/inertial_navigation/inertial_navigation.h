@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../fastmath/fastmath.h"
+#include "../vertical_estimator/vertical_estimator.h"
+
+// Horizontal position and velocity from the accelerometer and the gps (loosely coupled, Kalman filter per axis).
+// The accelerometer is turned into north and east with the attitude and integrated every loop, so there is a
+// smooth position between the 1Hz gps fixes. Every fix pulls position, velocity and the accelerometer bias back.
+// North and east do not mix in the model, so it is two 3 state filters instead of one 6 state one.
+//
+// Position is in meters north and east of the first gps fix, the origin. Altitude stays with the
+// vertical estimator, together they make a full NED position.
+// The attitude gives magnetic north, the declination turns that into true north like the gps uses.
+//
+// bn357 gives latitude and longitude as float, which is only good to about half a meter.
+// They are signed, south and west are negative, so it works on both sides of the equator and of Greenwich.
+
+uint8_t init_inertial_navigation(float accelerometer_noise_mps2, float accelerometer_bias_walk_mps2, float gps_noise_meters, float magnetic_declination_degrees);
+void inertial_navigation_reset();
+void inertial_navigation_predict(const float north_east_acceleration_mps2[2], float dt);
+void inertial_navigation_update_gps(float latitude_degrees, float longitude_degrees, float horizontal_dilution);
+uint8_t inertial_navigation_has_origin();
+void inertial_navigation_get_position_meters(float *north_east);
+void inertial_navigation_get_velocity_mps(float *north_east);
+float inertial_navigation_get_position_uncertainty_meters();
+void inertial_navigation_get_horizontal_acceleration_mps2(const float rotation[3][3], const float accelerometer_g[3], float *north_east);
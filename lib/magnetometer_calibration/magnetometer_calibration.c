@@ -0,0 +1,389 @@
+#include "./magnetometer_calibration.h"
+
+#define PARAMETERS 9
+#define INITIAL_COVARIANCE 1000.0f  // Nothing known about the ellipsoid at the start
+#define RESIDUAL_SMOOTHING 0.02f
+
+// What a usable fit has to look like
+#define MINIMUM_SAMPLES 150
+#define MAXIMUM_AXIS_RATIO 2.0f      // Longest over shortest ellipsoid axis. Soft iron this bad means a bad fit
+#define MINIMUM_COVERAGE 1.2f        // Range of the samples on each axis, in ellipsoid radii. 2 would be all the way around
+#define MAXIMUM_FIT_ERROR 0.05f      // Relative error of the radius
+#define MAXIMUM_CENTER_OFFSET 1.0f   // In radii. A center guess further off than this is replaced and the fit starts over
+
+#define JACOBI_SWEEPS 10
+
+static float m_field_norm = 50.0f;
+static float m_forgetting_factor = 1.0f;
+static float m_minimum_sample_distance = 0.0f;
+
+// Samples are moved by the center guess and scaled to about 1 before the fit, float runs out of digits otherwise
+static float m_center_guess[3];
+static float m_scale = 0.0f;
+
+static float m_parameters[PARAMETERS];
+static float m_covariance[PARAMETERS][PARAMETERS];
+static float m_residual_squared = 0.0f;
+static float m_fit_error = 1.0f;
+
+static float m_last_sample[3];
+static float m_sample_min[3];
+static float m_sample_max[3];
+static uint32_t m_sample_count = 0;
+
+// field_norm is what the calibrated readings should measure, the local field strength in the same units.
+// forgetting_factor just under 1 lets old samples fade in flight, 1 keeps all of them.
+// minimum_sample_distance is how far a raw sample has to be from the last used one
+uint8_t init_magnetometer_calibration(float field_norm, float forgetting_factor, float minimum_sample_distance)
+{
+    m_field_norm = field_norm;
+    m_forgetting_factor = forgetting_factor;
+    m_minimum_sample_distance = minimum_sample_distance;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_center_guess[i] = 0.0f;
+    }
+    magnetometer_calibration_reset();
+    return 1;
+}
+
+// Start the fit over. The center guess is the hard iron currently in use, the better it is the better the fit
+// is conditioned. Call with all zeros when there is none
+void magnetometer_calibration_reset_with_center(const float center_guess[3])
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_center_guess[i] = center_guess[i];
+    }
+    magnetometer_calibration_reset();
+}
+
+void magnetometer_calibration_reset()
+{
+    for (uint8_t i = 0; i < PARAMETERS; i++)
+    {
+        m_parameters[i] = 0.0f;
+        for (uint8_t k = 0; k < PARAMETERS; k++)
+        {
+            m_covariance[i][k] = i == k ? INITIAL_COVARIANCE : 0.0f;
+        }
+    }
+    m_scale = 0.0f;
+    m_residual_squared = 0.0f;
+    m_fit_error = 1.0f;
+    m_sample_count = 0;
+}
+
+// Uncalibrated sample in sensor axes. Returns 1 when it was used, 0 when it was too close to the last one
+uint8_t magnetometer_calibration_add_sample(const float raw[3])
+{
+    float distance_squared = 0.0f;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        float difference = raw[i] - m_last_sample[i];
+        distance_squared += difference * difference;
+    }
+    if (m_sample_count > 0 && distance_squared < m_minimum_sample_distance * m_minimum_sample_distance)
+    {
+        return 0;
+    }
+
+    float x = raw[0] - m_center_guess[0];
+    float y = raw[1] - m_center_guess[1];
+    float z = raw[2] - m_center_guess[2];
+    if (m_scale == 0.0f)
+    {
+        float norm_squared = x * x + y * y + z * z;
+        if (norm_squared == 0.0f)
+        {
+            return 0;
+        }
+        m_scale = fast_inverse_sqrtf(norm_squared);
+    }
+    x *= m_scale;
+    y *= m_scale;
+    z *= m_scale;
+
+    // x^2 + y^2 + z^2 from the rest. With the sphere part taken out of the regressors and a constant in them the
+    // fit works wherever the origin is, even close to the surface of the ellipsoid
+    float x2 = x * x;
+    float y2 = y * y;
+    float z2 = z * z;
+    float target = x2 + y2 + z2;
+    float regressors[PARAMETERS] = {x2 + y2 - 2.0f * z2, x2 + z2 - 2.0f * y2, 2.0f * x * y, 2.0f * x * z, 2.0f * y * z, 2.0f * x, 2.0f * y, 2.0f * z, 1.0f};
+
+    // Recursive least squares
+    float covariance_regressors[PARAMETERS];
+    float denominator = m_forgetting_factor;
+    float residual = target;
+    for (uint8_t i = 0; i < PARAMETERS; i++)
+    {
+        float sum = 0.0f;
+        for (uint8_t k = 0; k < PARAMETERS; k++)
+        {
+            sum += m_covariance[i][k] * regressors[k];
+        }
+        covariance_regressors[i] = sum;
+        denominator += regressors[i] * sum;
+        residual -= regressors[i] * m_parameters[i];
+    }
+
+    float inverse_denominator = 1.0f / denominator;
+    float inverse_forgetting_factor = 1.0f / m_forgetting_factor;
+    for (uint8_t i = 0; i < PARAMETERS; i++)
+    {
+        float gain = covariance_regressors[i] * inverse_denominator;
+        m_parameters[i] += gain * residual;
+        for (uint8_t k = i; k < PARAMETERS; k++)
+        {
+            float value = (m_covariance[i][k] - gain * covariance_regressors[k]) * inverse_forgetting_factor;
+            m_covariance[i][k] = value;
+            m_covariance[k][i] = value;
+        }
+    }
+
+    m_residual_squared += RESIDUAL_SMOOTHING * (residual * residual - m_residual_squared);
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (m_sample_count == 0 || raw[i] < m_sample_min[i])
+        {
+            m_sample_min[i] = raw[i];
+        }
+        if (m_sample_count == 0 || raw[i] > m_sample_max[i])
+        {
+            m_sample_max[i] = raw[i];
+        }
+        m_last_sample[i] = raw[i];
+    }
+    m_sample_count++;
+    return 1;
+}
+
+uint32_t magnetometer_calibration_get_sample_count()
+{
+    return m_sample_count;
+}
+
+// Relative error of the radius over the last 50 or so samples, from the last solve
+float magnetometer_calibration_get_fit_error()
+{
+    return m_fit_error;
+}
+
+static uint8_t invert_3x3(float m[3][3], float inverse[3][3])
+{
+    float determinant =
+        m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+        m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+        m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (determinant == 0.0f)
+    {
+        return 0;
+    }
+
+    float inverse_determinant = 1.0f / determinant;
+    inverse[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inverse_determinant;
+    inverse[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inverse_determinant;
+    inverse[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inverse_determinant;
+    inverse[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inverse_determinant;
+    inverse[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inverse_determinant;
+    inverse[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inverse_determinant;
+    inverse[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inverse_determinant;
+    inverse[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inverse_determinant;
+    inverse[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inverse_determinant;
+    return 1;
+}
+
+// Eigenvalues and vectors (columns) of a symmetric matrix by Jacobi rotations. m is destroyed,
+// the eigenvalues end up on its diagonal
+static void symmetric_eigen_3x3(float m[3][3], float vectors[3][3])
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            vectors[i][k] = i == k ? 1.0f : 0.0f;
+        }
+    }
+
+    for (uint8_t sweep = 0; sweep < JACOBI_SWEEPS; sweep++)
+    {
+        float off_diagonal = fabsf(m[0][1]) + fabsf(m[0][2]) + fabsf(m[1][2]);
+        if (off_diagonal < 1e-9f * (fabsf(m[0][0]) + fabsf(m[1][1]) + fabsf(m[2][2])))
+        {
+            return;
+        }
+
+        for (uint8_t p = 0; p < 2; p++)
+        {
+            for (uint8_t q = p + 1; q < 3; q++)
+            {
+                if (m[p][q] == 0.0f)
+                {
+                    continue;
+                }
+
+                // Rotation that zeroes m[p][q]
+                float theta = (m[q][q] - m[p][p]) / (2.0f * m[p][q]);
+                float t = (theta >= 0.0f ? 1.0f : -1.0f) / (fabsf(theta) + fast_sqrtf(theta * theta + 1.0f));
+                float c = fast_inverse_sqrtf(t * t + 1.0f);
+                float s = t * c;
+
+                for (uint8_t k = 0; k < 3; k++)
+                {
+                    float mkp = m[k][p];
+                    float mkq = m[k][q];
+                    m[k][p] = c * mkp - s * mkq;
+                    m[k][q] = s * mkp + c * mkq;
+                }
+                for (uint8_t k = 0; k < 3; k++)
+                {
+                    float mpk = m[p][k];
+                    float mqk = m[q][k];
+                    m[p][k] = c * mpk - s * mqk;
+                    m[q][k] = s * mpk + c * mqk;
+                }
+                for (uint8_t k = 0; k < 3; k++)
+                {
+                    float vkp = vectors[k][p];
+                    float vkq = vectors[k][q];
+                    vectors[k][p] = c * vkp - s * vkq;
+                    vectors[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+// The ellipsoid so far as hard and soft iron for qmc5883l_set_calibration. Returns 0 and leaves calibration alone
+// when there are too few samples, the samples do not go around far enough or the ellipsoid does not look real
+uint8_t magnetometer_calibration_solve(struct magnetometer_calibration *calibration)
+{
+    if (m_sample_count < MINIMUM_SAMPLES)
+    {
+        return 0;
+    }
+
+    // Back to x'Ax + 2v'x + constant = 0
+    float quadric[3][3] = {
+        {m_parameters[0] + m_parameters[1] - 1.0f, m_parameters[2], m_parameters[3]},
+        {m_parameters[2], m_parameters[0] - 2.0f * m_parameters[1] - 1.0f, m_parameters[4]},
+        {m_parameters[3], m_parameters[4], m_parameters[1] - 2.0f * m_parameters[0] - 1.0f}};
+    float linear[3] = {m_parameters[5], m_parameters[6], m_parameters[7]};
+    float constant = m_parameters[8];
+
+    float quadric_inverse[3][3];
+    if (!invert_3x3(quadric, quadric_inverse))
+    {
+        return 0;
+    }
+
+    // Center is -A^-1 v, around it the ellipsoid is y'Ay = c'Ac - constant
+    float center[3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        center[i] = -(quadric_inverse[i][0] * linear[0] + quadric_inverse[i][1] * linear[1] + quadric_inverse[i][2] * linear[2]);
+    }
+    float level = -constant;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            level += center[i] * quadric[i][k] * center[k];
+        }
+    }
+    if (level == 0.0f)
+    {
+        return 0;
+    }
+
+    // Samples far from the origin leave float too few digits for the shape. Start over around this center,
+    // it is close enough even when the shape is not
+    float center_distance_squared = center[0] * center[0] + center[1] * center[1] + center[2] * center[2];
+    if (center_distance_squared > MAXIMUM_CENTER_OFFSET * MAXIMUM_CENTER_OFFSET * fabsf(level))
+    {
+        float new_center[3];
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            new_center[i] = m_center_guess[i] + center[i] / m_scale;
+        }
+        magnetometer_calibration_reset_with_center(new_center);
+        return 0;
+    }
+
+    // The residual is about 2 * level * the relative error of the radius, the trace of A is always -3
+    m_fit_error = fast_sqrtf(m_residual_squared) / (2.0f * fabsf(level));
+    if (m_fit_error > MAXIMUM_FIT_ERROR)
+    {
+        return 0;
+    }
+
+    // Normalized shape, y'My = 1. Its eigenvalues are 1 / radius^2 along each ellipsoid axis
+    float shape[3][3];
+    float shape_eigen[3][3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            shape[i][k] = quadric[i][k] / level;
+            shape_eigen[i][k] = shape[i][k];
+        }
+    }
+    float vectors[3][3];
+    symmetric_eigen_3x3(shape_eigen, vectors);
+
+    float eigenvalues[3] = {shape_eigen[0][0], shape_eigen[1][1], shape_eigen[2][2]};
+    float smallest = eigenvalues[0];
+    float largest = eigenvalues[0];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (eigenvalues[i] <= 0.0f)
+        {
+            return 0; // Not an ellipsoid
+        }
+        smallest = eigenvalues[i] < smallest ? eigenvalues[i] : smallest;
+        largest = eigenvalues[i] > largest ? eigenvalues[i] : largest;
+    }
+    if (largest > MAXIMUM_AXIS_RATIO * MAXIMUM_AXIS_RATIO * smallest)
+    {
+        return 0;
+    }
+
+    // How far the ellipsoid reaches along each sensor axis is sqrt of the diagonal of M^-1
+    float shape_inverse[3][3];
+    if (!invert_3x3(shape, shape_inverse))
+    {
+        return 0;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        float reach = fast_sqrtf(shape_inverse[i][i]) / m_scale;
+        if (m_sample_max[i] - m_sample_min[i] < MINIMUM_COVERAGE * reach)
+        {
+            return 0;
+        }
+    }
+
+    // Soft iron is field_norm * sqrt(M), the symmetric square root so the axes are not turned.
+    // Undo the scaling the samples got before the fit
+    float root_eigenvalues[3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        root_eigenvalues[i] = fast_sqrtf(eigenvalues[i]);
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            float root = 0.0f;
+            for (uint8_t j = 0; j < 3; j++)
+            {
+                root += vectors[i][j] * root_eigenvalues[j] * vectors[k][j];
+            }
+            calibration->soft_iron[i][k] = m_field_norm * m_scale * root;
+        }
+        calibration->hard_iron[i] = m_center_guess[i] + center[i] / m_scale;
+    }
+    return 1;
+}
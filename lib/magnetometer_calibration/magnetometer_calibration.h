@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../fastmath/fastmath.h"
+
+// Hard and soft iron calibration worked out on the drone, the same thing Magneto does on a laptop.
+// Raw magnetometer samples lie on an ellipsoid, x'Ax + 2v'x + d = 0. Its 9 numbers are fitted with recursive least
+// squares one sample at a time (about 250 multiplies), so it can run in the background while the drone is turned
+// around in every direction or slowly in flight. Solving turns the ellipsoid into a center (hard iron) and a
+// symmetric matrix (soft iron) that maps it onto a sphere with the local field strength. That part has an
+// eigen decomposition in it and only needs doing once in a while.
+//
+// Samples are only taken when they are far enough from the last one, so sitting still or hovering does not
+// wash out the directions seen before.
+
+struct magnetometer_calibration {
+    float hard_iron[3];     // Sensor axes, taken off first
+    float soft_iron[3][3];
+};
+
+uint8_t init_magnetometer_calibration(float field_norm, float forgetting_factor, float minimum_sample_distance);
+void magnetometer_calibration_reset();
+void magnetometer_calibration_reset_with_center(const float center_guess[3]);
+uint8_t magnetometer_calibration_add_sample(const float raw[3]);
+uint8_t magnetometer_calibration_solve(struct magnetometer_calibration *calibration);
+uint32_t magnetometer_calibration_get_sample_count();
+float magnetometer_calibration_get_fit_error();
@@ -9,8 +9,32 @@
 #define ID_REG 0x75
 #define ID_VALUE 104
 #define PWR_MGMT_REG 0x6B
+#define SMPLRT_DIV_REG 0x19
+#define CONFIG_REG 0x1A
+#define GYRO_CONFIG_REG 0x1B
+#define ACCEL_CONFIG_REG 0x1C
+#define FIFO_EN_REG 0x23
+#define INT_PIN_CFG_REG 0x37
+#define INT_ENABLE_REG 0x38
 #define ACCEL_XOUT_H_REG 0x3B
+#define TEMP_OUT_H_REG 0x41
 #define GYRO_XOUT_H_REG 0x43
+#define USER_CTRL_REG 0x6A
+#define FIFO_COUNT_H_REG 0x72
+#define FIFO_R_W_REG 0x74
+#define SAMPLE_SIZE 14 // accelerometer, temperature, gyro
+#define FIFO_SIZE 1024
+
+// Temperature in C = raw / 340 + 36.53, from the register map
+#define TEMPERATURE_LSB_PER_CELSIUS 340.0f
+#define TEMPERATURE_OFFSET_CELSIUS 36.53f
+
+// Fixed point path. Samples stay integers through the alignment and the corrections, in raw LSB with
+// FIXED_FRACTION_BITS below the point. The only float work left per sample is one multiply per axis at the end
+#define FIXED_FRACTION_BITS 8
+#define FIXED_ALIGNMENT_BITS 14
+#define FIXED_TEMPERATURE_STEP 34 // Raw temperature change (0.1C) before the gyro bias from the temperature model is redone
+#define BENCHMARK_RUNS 1000
 
 volatile float m_accelerometer_correction[3] = {
     0, 0, 0};
@@ -18,15 +42,137 @@ volatile float m_accelerometer_correction[3] = {
 volatile float m_gyro_correction[3] = {
     0, 0, 0};
 
-volatile int64_t m_previous_time = 0;
+// Sensor axes to board axes, the corrections above are subtracted after it so they are in board axes
+static float m_alignment[3][3] = SENSOR_ALIGNMENT_CW0;
+static uint8_t m_alignment_is_identity = 1;
+
+// When set it replaces m_gyro_correction, the bias follows the temperature of the last converted sample
+static struct mpu6050_gyro_temperature_model m_gyro_temperature_model;
+static uint8_t m_gyro_temperature_model_set = 0;
+static float m_temperature_celsius = 25.0f;
+
+volatile uint32_t m_previous_time = 0; // microseconds
 volatile float m_complementary_ratio = 0.0;
+static float m_complementary_time_constant = 1.0f; // seconds, the ratio at every step comes from this and the measured time
+
+static I2C_HandleTypeDef *i2c_handle;
+
+// Power on defaults, 2g and 250dps
+static float m_accelerometer_lsb_per_g = 16384.0;
+static float m_gyro_lsb_per_dps = 131.0;
+
+// Integer copies of the alignment and corrections. Redone whenever the float ones change
+static uint8_t m_use_fixed_point = 0;
+static int32_t m_fixed_alignment[3][3];
+static int32_t m_fixed_accelerometer_offset[3];
+static int32_t m_fixed_gyro_offset[3];
+static int16_t m_fixed_gyro_offset_temperature = 0;
+static uint8_t m_fixed_gyro_offset_valid = 0;
+static float m_fixed_accelerometer_scale = 1.0f / (16384.0f * (1 << FIXED_FRACTION_BITS));
+static float m_fixed_gyro_scale = 1.0f / (131.0f * (1 << FIXED_FRACTION_BITS));
+
+static volatile uint8_t m_data_ready = 0;
+static volatile uint16_t m_samples_per_data_ready = 1;
+static volatile uint16_t m_samples_since_data_ready = 0;
+
+// Fifo drain through the i2c scheduler. First the count, then that many whole samples
+static uint8_t m_fifo_count_data[2];
+static uint8_t m_fifo_data[MPU6050_FIFO_MAX_SAMPLES * SAMPLE_SIZE];
+static uint8_t m_fifo_reset_data;
+static volatile uint8_t m_fifo_sample_count = 0;
+static volatile uint32_t m_fifo_time = 0;
+static volatile enum t_i2c_read_state m_fifo_state = I2C_READ_IDLE;
+static volatile uint32_t m_fifo_overflow_count = 0;
+
+// Sample read through the i2c scheduler
+static uint8_t m_queued_sample_data[SAMPLE_SIZE];
+static volatile uint32_t m_queued_sample_time = 0;
+static volatile enum t_i2c_read_state m_queued_sample_state = I2C_READ_IDLE;
+
+static int32_t round_to_int(float value)
+{
+    return (int32_t)(value + (value >= 0.0f ? 0.5f : -0.5f));
+}
+
+static float convert_temperature_celsius(int16_t raw)
+{
+    return (float)raw / TEMPERATURE_LSB_PER_CELSIUS + TEMPERATURE_OFFSET_CELSIUS;
+}
 
-I2C_HandleTypeDef *i2c_handle;
+// The corrections are in g and dps, the fixed path takes them off in LSB
+static void update_fixed_corrections()
+{
+    float fixed_one = (float)(1 << FIXED_FRACTION_BITS);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            m_fixed_alignment[i][k] = round_to_int(m_alignment[i][k] * (1 << FIXED_ALIGNMENT_BITS));
+        }
+        m_fixed_accelerometer_offset[i] = round_to_int(m_accelerometer_correction[i] * m_accelerometer_lsb_per_g * fixed_one);
+    }
+    m_fixed_accelerometer_offset[2] -= round_to_int(m_accelerometer_lsb_per_g * fixed_one); // 1g stays on z
+    m_fixed_accelerometer_scale = 1.0f / (m_accelerometer_lsb_per_g * fixed_one);
+    m_fixed_gyro_scale = 1.0f / (m_gyro_lsb_per_dps * fixed_one);
+    m_fixed_gyro_offset_valid = 0;
+}
 
-uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, float accelerometer_correction[3], float gyro_correction[3], float refresh_rate_hz, float complementary_ratio)
+// The temperature model bias only changes with the temperature, so it is not worked out for every sample
+static void update_fixed_gyro_offset(int16_t raw_temperature)
+{
+    int32_t temperature_change = (int32_t)raw_temperature - m_fixed_gyro_offset_temperature;
+    if (m_fixed_gyro_offset_valid && temperature_change < FIXED_TEMPERATURE_STEP && temperature_change > -FIXED_TEMPERATURE_STEP)
+    {
+        return;
+    }
+
+    m_temperature_celsius = convert_temperature_celsius(raw_temperature);
+    float fixed_lsb_per_dps = m_gyro_lsb_per_dps * (1 << FIXED_FRACTION_BITS);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        float bias = m_gyro_correction[i];
+        if (m_gyro_temperature_model_set)
+        {
+            bias = m_gyro_temperature_model.bias_dps[i] +
+                   m_gyro_temperature_model.slope_dps_per_celsius[i] * (m_temperature_celsius - m_gyro_temperature_model.reference_celsius);
+        }
+        m_fixed_gyro_offset[i] = round_to_int(bias * fixed_lsb_per_dps);
+    }
+    m_fixed_gyro_offset_temperature = raw_temperature;
+    m_fixed_gyro_offset_valid = 1;
+}
+
+// Alignment entries are 0 and +-1 for the usual mountings, exact in Q14, and the sums stay inside 32 bits
+static void align_and_correct_fixed(const int16_t *raw, const int32_t *offset, int32_t *data)
+{
+    if (m_alignment_is_identity)
+    {
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            data[i] = (int32_t)raw[i] * (1 << FIXED_FRACTION_BITS) - offset[i];
+        }
+        return;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        int32_t aligned = m_fixed_alignment[i][0] * raw[0] + m_fixed_alignment[i][1] * raw[1] + m_fixed_alignment[i][2] * raw[2];
+        data[i] = (aligned >> (FIXED_ALIGNMENT_BITS - FIXED_FRACTION_BITS)) - offset[i];
+    }
+}
+
+uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, float accelerometer_correction[3], float gyro_correction[3], const float alignment[3][3], float refresh_rate_hz, float complementary_ratio)
 {
     i2c_handle = i2c_handle_temp;
 
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            m_alignment[i][k] = alignment[i][k];
+        }
+    }
+    m_alignment_is_identity = sensor_alignment_is_identity(alignment);
+
     if (apply_calibration)
     {
         // assign the correction for gyro
@@ -41,8 +187,14 @@ uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibrati
             m_accelerometer_correction[i] = accelerometer_correction[i];
         }
     }
+    update_fixed_corrections();
 
     m_complementary_ratio = complementary_ratio;
+    // complementary_ratio is for a step of 1 / refresh_rate_hz, ratio = dt / (time constant + dt)
+    if (complementary_ratio > 0.0f && refresh_rate_hz > 0.0f)
+    {
+        m_complementary_time_constant = (1.0f - complementary_ratio) / (complementary_ratio * refresh_rate_hz);
+    }
 
     uint8_t check;
     HAL_I2C_Mem_Read(i2c_handle, MPU6050 + 1, ID_REG, 1, &check, 1, 100);
@@ -55,7 +207,6 @@ uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibrati
 
     uint8_t reset_device1 = 0b00000000;
     reset_device1 |= PWR_RESET;
-    reset_device1 |= PWR_TEMP_DIS;
     reset_device1 |= PWR_CLOCK_INTERNAL_8MHZ;
 
     HAL_I2C_Mem_Write(
@@ -81,8 +232,8 @@ uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibrati
         100);
     HAL_Delay(100);
 
+    // The temperature sensor stays on, the gyro bias depends on it
     uint8_t reset_device3 = 0b00000000;
-    reset_device3 |= PWR_TEMP_DIS;
     reset_device3 |= PWR_CLOCK_INTERNAL_8MHZ;
 
     HAL_I2C_Mem_Write(
@@ -97,6 +248,131 @@ uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibrati
     printf("MPU6050 initialized\n");
     return 1;
 }
+// Sample rate, low pass filter and ranges. The sample rate is what the data ready interrupt and the fifo run at
+uint8_t mpu6050_configure(float sample_rate_hz, enum t_dlpf_config dlpf, enum t_gyro_full_scale gyro_full_scale, enum t_accelerometer_full_scale accelerometer_full_scale)
+{
+    // Sample rate = gyro output rate / (1 + SMPLRT_DIV)
+    float gyro_output_rate_hz = dlpf == DLPF_260HZ ? 8000.0 : 1000.0;
+    uint8_t sample_rate_divider = (uint8_t)(gyro_output_rate_hz / sample_rate_hz - 1);
+
+    uint8_t config = dlpf;
+    uint8_t gyro_config = gyro_full_scale;
+    uint8_t accelerometer_config = accelerometer_full_scale;
+
+    HAL_StatusTypeDef ret1 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, CONFIG_REG, 1, &config, 1, 100);
+    HAL_StatusTypeDef ret2 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, SMPLRT_DIV_REG, 1, &sample_rate_divider, 1, 100);
+    HAL_StatusTypeDef ret3 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, GYRO_CONFIG_REG, 1, &gyro_config, 1, 100);
+    HAL_StatusTypeDef ret4 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, ACCEL_CONFIG_REG, 1, &accelerometer_config, 1, 100);
+
+    // Every step up in range halves the resolution
+    m_gyro_lsb_per_dps = 131.0 / (float)(1 << (gyro_full_scale >> 3));
+    m_accelerometer_lsb_per_g = 16384.0 / (float)(1 << (accelerometer_full_scale >> 3));
+    update_fixed_corrections();
+
+    return ret1 == HAL_OK && ret2 == HAL_OK && ret3 == HAL_OK && ret4 == HAL_OK;
+}
+
+// Pulse the INT pin every time a new sample is in the registers. mpu6050_wait_for_data_ready returns
+// every samples_per_data_ready samples, so the sensor can sample faster than the loop runs.
+uint8_t mpu6050_enable_data_ready_interrupt(uint16_t samples_per_data_ready)
+{
+    uint8_t interrupt_pin_config = INT_PIN_ACTIVE_HIGH | INT_PIN_PUSH_PULL | INT_PIN_PULSE_50US;
+    uint8_t interrupt_enable = INT_DATA_READY_ENABLE;
+
+    m_samples_per_data_ready = samples_per_data_ready == 0 ? 1 : samples_per_data_ready;
+    m_samples_since_data_ready = 0;
+    m_data_ready = 0;
+
+    HAL_StatusTypeDef ret1 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, INT_PIN_CFG_REG, 1, &interrupt_pin_config, 1, 100);
+    HAL_StatusTypeDef ret2 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, INT_ENABLE_REG, 1, &interrupt_enable, 1, 100);
+
+    return ret1 == HAL_OK && ret2 == HAL_OK;
+}
+
+// Push accelerometer, temperature and gyro into the fifo every sample. Same layout as the burst read
+uint8_t mpu6050_enable_fifo()
+{
+    uint8_t fifo_enable = FIFO_ACCEL | FIFO_TEMP | FIFO_XG | FIFO_YG | FIFO_ZG;
+    uint8_t user_control = USER_CTRL_FIFO_ENABLE | USER_CTRL_FIFO_RESET;
+
+    HAL_StatusTypeDef ret1 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, FIFO_EN_REG, 1, &fifo_enable, 1, 100);
+    HAL_StatusTypeDef ret2 = HAL_I2C_Mem_Write(i2c_handle, MPU6050, USER_CTRL_REG, 1, &user_control, 1, 100);
+
+    return ret1 == HAL_OK && ret2 == HAL_OK;
+}
+
+// Call from HAL_GPIO_EXTI_Callback for the pin the INT is wired to
+void mpu6050_data_ready_interrupt()
+{
+    m_samples_since_data_ready++;
+    if (m_samples_since_data_ready >= m_samples_per_data_ready)
+    {
+        m_samples_since_data_ready = 0;
+        m_data_ready = 1;
+    }
+}
+
+// Wait for the next sample. Returns 0 if it did not come in time
+uint8_t mpu6050_wait_for_data_ready(uint32_t timeout_ms)
+{
+    uint32_t start_time = HAL_GetTick();
+    while (!m_data_ready && HAL_GetTick() - start_time < timeout_ms);
+
+    if (!m_data_ready)
+    {
+        return 0;
+    }
+
+    m_data_ready = 0;
+    return 1;
+}
+
+// Same as mpu6050_wait_for_data_ready without the waiting. Returns 1 once for every data ready
+uint8_t mpu6050_check_data_ready()
+{
+    if (!m_data_ready)
+    {
+        return 0;
+    }
+
+    m_data_ready = 0;
+    return 1;
+}
+
+// Turned into board axes first, then the corrections. Straight mounted sensors skip the multiply
+static void align(float *data)
+{
+    if (!m_alignment_is_identity)
+    {
+        sensor_alignment_apply(m_alignment, data);
+    }
+}
+
+static void align_and_correct_accelerometer(float *data)
+{
+    align(data);
+    data[0] -= m_accelerometer_correction[0];
+    data[1] -= m_accelerometer_correction[1];
+    data[2] -= m_accelerometer_correction[2] - 1;
+}
+
+static void align_and_correct_gyro(float *data)
+{
+    align(data);
+    if (m_gyro_temperature_model_set)
+    {
+        float temperature_difference = m_temperature_celsius - m_gyro_temperature_model.reference_celsius;
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            data[i] -= m_gyro_temperature_model.bias_dps[i] + m_gyro_temperature_model.slope_dps_per_celsius[i] * temperature_difference;
+        }
+        return;
+    }
+    data[0] -= m_gyro_correction[0];
+    data[1] -= m_gyro_correction[1];
+    data[2] -= m_gyro_correction[2];
+}
+
 // Read accelerometer in gravity units
 void mpu6050_get_accelerometer_readings_gravity(float *data)
 {
@@ -115,40 +391,355 @@ void mpu6050_get_accelerometer_readings_gravity(float *data)
     int16_t Y = ((int16_t)retrieved_data[2] << 8) | (int16_t)retrieved_data[3];
     int16_t Z = ((int16_t)retrieved_data[4] << 8) | (int16_t)retrieved_data[5];
 
-    float X_out = ((float)X) / 16384.0;
-    float Y_out = ((float)Y) / 16384.0;
-    float Z_out = ((float)Z) / 16384.0;
-
-    data[0] = X_out - (m_accelerometer_correction[0]);
-    data[1] = Y_out - (m_accelerometer_correction[1]);
-    data[2] = Z_out - (m_accelerometer_correction[2] - 1);
+    data[0] = ((float)X) / m_accelerometer_lsb_per_g;
+    data[1] = ((float)Y) / m_accelerometer_lsb_per_g;
+    data[2] = ((float)Z) / m_accelerometer_lsb_per_g;
+    align_and_correct_accelerometer(data);
 }
 
-// Read gyro in degrees per second units 
+// Read gyro in degrees per second units. The temperature in front of it comes along for the temperature model
 void mpu6050_get_gyro_readings_dps(float *data)
 {
-    uint8_t retrieved_data[] = {0, 0, 0, 0, 0, 0};
+    uint8_t retrieved_data[] = {0, 0, 0, 0, 0, 0, 0, 0};
 
     HAL_I2C_Mem_Read(
         i2c_handle,
         MPU6050 + 1,
-        GYRO_XOUT_H_REG,
+        TEMP_OUT_H_REG,
         1,
         retrieved_data,
-        6,  // Read all of the gyroscope registers
+        8,  // Read the temperature and all of the gyroscope registers
         100);
 
-    int16_t X = ((int16_t)retrieved_data[0] << 8) | (int16_t)retrieved_data[1];
-    int16_t Y = ((int16_t)retrieved_data[2] << 8) | (int16_t)retrieved_data[3];
-    int16_t Z = ((int16_t)retrieved_data[4] << 8) | (int16_t)retrieved_data[5];
+    int16_t temperature = ((int16_t)retrieved_data[0] << 8) | (int16_t)retrieved_data[1];
+    int16_t X = ((int16_t)retrieved_data[2] << 8) | (int16_t)retrieved_data[3];
+    int16_t Y = ((int16_t)retrieved_data[4] << 8) | (int16_t)retrieved_data[5];
+    int16_t Z = ((int16_t)retrieved_data[6] << 8) | (int16_t)retrieved_data[7];
+    m_temperature_celsius = convert_temperature_celsius(temperature);
+
+    data[0] = ((float)X) / m_gyro_lsb_per_dps;
+    data[1] = ((float)Y) / m_gyro_lsb_per_dps;
+    data[2] = ((float)Z) / m_gyro_lsb_per_dps;
+    align_and_correct_gyro(data);
+}
+
+static void parse_sample(uint8_t *retrieved_data, struct mpu6050_sample *sample)
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        sample->accelerometer[i] = ((int16_t)retrieved_data[i * 2] << 8) | (int16_t)retrieved_data[i * 2 + 1];
+        sample->gyro[i] = ((int16_t)retrieved_data[8 + i * 2] << 8) | (int16_t)retrieved_data[8 + i * 2 + 1];
+    }
+    sample->temperature = ((int16_t)retrieved_data[6] << 8) | (int16_t)retrieved_data[7];
+}
+
+// Read accelerometer, temperature and gyro in one burst so all values are from the same sensor update
+uint8_t mpu6050_read_sample(struct mpu6050_sample *sample)
+{
+    uint8_t retrieved_data[SAMPLE_SIZE];
+
+    HAL_StatusTypeDef status = HAL_I2C_Mem_Read(
+        i2c_handle,
+        MPU6050 + 1,
+        ACCEL_XOUT_H_REG,
+        1,
+        retrieved_data,
+        SAMPLE_SIZE,
+        100);
+    sample->time = timebase_get_micros();
+
+    if(status != HAL_OK){
+        return 0;
+    }
 
-    float X_out = ((float)X) / 131.0;
-    float Y_out = ((float)Y) / 131.0;
-    float Z_out = ((float)Z) / 131.0;
+    parse_sample(retrieved_data, sample);
+    return 1;
+}
 
-    data[0] = X_out - (m_gyro_correction[0]);
-    data[1] = Y_out - (m_gyro_correction[1]);
-    data[2] = Z_out - (m_gyro_correction[2]);
+// Runs in the dma interrupt
+static void queued_sample_read_callback(uint8_t success)
+{
+    m_queued_sample_time = timebase_get_micros();
+    m_queued_sample_state = success ? I2C_READ_DONE : I2C_READ_FAILED;
+}
+
+// Same burst as mpu6050_read_sample but in the background. Highest priority on the bus
+uint8_t mpu6050_queue_sample_read()
+{
+    if(m_queued_sample_state == I2C_READ_PENDING){
+        return 0;
+    }
+
+    m_queued_sample_state = I2C_READ_PENDING;
+    if(!i2c_scheduler_queue_read(MPU6050, ACCEL_XOUT_H_REG, m_queued_sample_data, SAMPLE_SIZE, I2C_PRIORITY_HIGH, queued_sample_read_callback)){
+        m_queued_sample_state = I2C_READ_FAILED;
+        return 0;
+    }
+    return 1;
+}
+
+// Returns 1 if the queued read finished and gives the sample. Every queued sample can be taken once
+uint8_t mpu6050_get_queued_sample(struct mpu6050_sample *sample)
+{
+    if(m_queued_sample_state != I2C_READ_DONE){
+        return 0;
+    }
+
+    parse_sample(m_queued_sample_data, sample);
+    sample->time = m_queued_sample_time;
+    m_queued_sample_state = I2C_READ_IDLE;
+    return 1;
+}
+
+// Fifo got out of step or overflowed, start over. Runs in the dma interrupt
+static void reset_fifo()
+{
+    m_fifo_overflow_count++;
+    m_fifo_reset_data = USER_CTRL_FIFO_ENABLE | USER_CTRL_FIFO_RESET;
+    i2c_scheduler_queue_write(MPU6050, USER_CTRL_REG, &m_fifo_reset_data, 1, I2C_PRIORITY_HIGH, NULL);
+}
+
+static void fifo_data_read_callback(uint8_t success)
+{
+    m_fifo_time = timebase_get_micros();
+    m_fifo_state = success ? I2C_READ_DONE : I2C_READ_FAILED;
+}
+
+// The count is known now, read that many whole samples in the same drain
+static void fifo_count_read_callback(uint8_t success)
+{
+    if (!success)
+    {
+        m_fifo_state = I2C_READ_FAILED;
+        return;
+    }
+
+    uint16_t count = ((uint16_t)m_fifo_count_data[0] << 8) | m_fifo_count_data[1];
+    if (count % SAMPLE_SIZE != 0 || count >= FIFO_SIZE - SAMPLE_SIZE)
+    {
+        // Partial sample means the fifo overflowed and lost the alignment
+        reset_fifo();
+        m_fifo_state = I2C_READ_FAILED;
+        return;
+    }
+
+    uint8_t sample_count = count / SAMPLE_SIZE;
+    if (sample_count > MPU6050_FIFO_MAX_SAMPLES)
+    {
+        sample_count = MPU6050_FIFO_MAX_SAMPLES; // the rest stays for the next drain
+    }
+
+    if (sample_count == 0)
+    {
+        m_fifo_sample_count = 0;
+        m_fifo_time = timebase_get_micros();
+        m_fifo_state = I2C_READ_DONE;
+        return;
+    }
+
+    m_fifo_sample_count = sample_count;
+    if (!i2c_scheduler_queue_read(MPU6050, FIFO_R_W_REG, m_fifo_data, sample_count * SAMPLE_SIZE, I2C_PRIORITY_HIGH, fifo_data_read_callback))
+    {
+        m_fifo_state = I2C_READ_FAILED;
+    }
+}
+
+// Read out everything the fifo collected since the last drain
+uint8_t mpu6050_queue_fifo_read()
+{
+    if (m_fifo_state == I2C_READ_PENDING)
+    {
+        return 0;
+    }
+
+    m_fifo_state = I2C_READ_PENDING;
+    if (!i2c_scheduler_queue_read(MPU6050, FIFO_COUNT_H_REG, m_fifo_count_data, 2, I2C_PRIORITY_HIGH, fifo_count_read_callback))
+    {
+        m_fifo_state = I2C_READ_FAILED;
+        return 0;
+    }
+    return 1;
+}
+
+// Wait for the queued drain only, other transfers queued behind it on the bus are not waited for.
+// The i2c scheduler timeout still aborts a stuck read. Returns 0 if the drain did not finish in time
+uint8_t mpu6050_wait_for_fifo_read(uint32_t timeout_ms)
+{
+    uint32_t start_time = HAL_GetTick();
+    while (m_fifo_state == I2C_READ_PENDING)
+    {
+        i2c_scheduler_check_timeout();
+        if (HAL_GetTick() - start_time >= timeout_ms)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns how many samples the queued drain got, oldest first. All of them get the time the drain finished
+uint8_t mpu6050_get_queued_fifo_samples(struct mpu6050_sample *samples, uint8_t max_samples)
+{
+    if (m_fifo_state != I2C_READ_DONE)
+    {
+        return 0;
+    }
+
+    uint8_t sample_count = m_fifo_sample_count < max_samples ? m_fifo_sample_count : max_samples;
+    for (uint8_t i = 0; i < sample_count; i++)
+    {
+        parse_sample(&m_fifo_data[i * SAMPLE_SIZE], &samples[i]);
+        samples[i].time = m_fifo_time;
+    }
+    m_fifo_state = I2C_READ_IDLE;
+    return sample_count;
+}
+
+// Decimate a drain to one sample. Averaging is a crude low pass but it keeps what happened between the loops
+void mpu6050_average_samples(struct mpu6050_sample *samples, uint8_t sample_count, struct mpu6050_sample *average)
+{
+    if (sample_count == 0)
+    {
+        return;
+    }
+
+    int32_t accelerometer_sum[3] = {0, 0, 0};
+    int32_t gyro_sum[3] = {0, 0, 0};
+    int32_t temperature_sum = 0;
+    for (uint8_t i = 0; i < sample_count; i++)
+    {
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            accelerometer_sum[axis] += samples[i].accelerometer[axis];
+            gyro_sum[axis] += samples[i].gyro[axis];
+        }
+        temperature_sum += samples[i].temperature;
+    }
+
+    for (uint8_t axis = 0; axis < 3; axis++)
+    {
+        average->accelerometer[axis] = accelerometer_sum[axis] / sample_count;
+        average->gyro[axis] = gyro_sum[axis] / sample_count;
+    }
+    average->temperature = temperature_sum / sample_count;
+    average->time = samples[sample_count - 1].time;
+}
+
+uint32_t mpu6050_get_fifo_overflow_count()
+{
+    return m_fifo_overflow_count;
+}
+
+// Convert a raw sample to gravity and degrees per second units with the corrections applied
+void mpu6050_convert_sample(struct mpu6050_sample *sample, float *accelerometer_data, float *gyro_data)
+{
+    if (m_use_fixed_point)
+    {
+        struct mpu6050_fixed_sample fixed;
+        mpu6050_correct_sample_fixed(sample, &fixed);
+        mpu6050_fixed_sample_to_float(&fixed, accelerometer_data, gyro_data);
+        return;
+    }
+
+    m_temperature_celsius = convert_temperature_celsius(sample->temperature);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        accelerometer_data[i] = ((float)sample->accelerometer[i]) / m_accelerometer_lsb_per_g;
+        gyro_data[i] = ((float)sample->gyro[i]) / m_gyro_lsb_per_dps;
+    }
+    align_and_correct_accelerometer(accelerometer_data);
+    align_and_correct_gyro(gyro_data);
+}
+
+// mpu6050_convert_sample goes through the fixed point path from now on
+void mpu6050_use_fixed_point(uint8_t enabled)
+{
+    m_use_fixed_point = enabled;
+}
+
+// Alignment and corrections done in integers. Sums of these can be averaged or filtered without any float
+void mpu6050_correct_sample_fixed(const struct mpu6050_sample *sample, struct mpu6050_fixed_sample *fixed)
+{
+    update_fixed_gyro_offset(sample->temperature);
+    align_and_correct_fixed(sample->accelerometer, m_fixed_accelerometer_offset, fixed->accelerometer);
+    align_and_correct_fixed(sample->gyro, m_fixed_gyro_offset, fixed->gyro);
+}
+
+// mpu6050_average_samples for corrected samples, the fixed path decimates in integers and converts once after.
+// A full drain of LSB times 256 still fits in the 32 bit sums
+void mpu6050_average_fixed_samples(const struct mpu6050_fixed_sample *samples, uint8_t sample_count, struct mpu6050_fixed_sample *average)
+{
+    if (sample_count == 0)
+    {
+        return;
+    }
+
+    int32_t accelerometer_sum[3] = {0, 0, 0};
+    int32_t gyro_sum[3] = {0, 0, 0};
+    for (uint8_t i = 0; i < sample_count; i++)
+    {
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            accelerometer_sum[axis] += samples[i].accelerometer[axis];
+            gyro_sum[axis] += samples[i].gyro[axis];
+        }
+    }
+
+    for (uint8_t axis = 0; axis < 3; axis++)
+    {
+        average->accelerometer[axis] = accelerometer_sum[axis] / sample_count;
+        average->gyro[axis] = gyro_sum[axis] / sample_count;
+    }
+}
+
+void mpu6050_fixed_sample_to_float(const struct mpu6050_fixed_sample *fixed, float *accelerometer_data, float *gyro_data)
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        accelerometer_data[i] = (float)fixed->accelerometer[i] * m_fixed_accelerometer_scale;
+        gyro_data[i] = (float)fixed->gyro[i] * m_fixed_gyro_scale;
+    }
+}
+
+// Cycles per sample of the float and the fixed point conversion, and how far apart they end up
+void mpu6050_print_benchmark()
+{
+    uint8_t saved_use_fixed_point = m_use_fixed_point;
+    struct mpu6050_sample sample = {{410, -330, 16020}, -2500, {-350, 410, 85}, 0};
+    float accelerometer_data[3];
+    float gyro_data[3];
+    float fixed_accelerometer_data[3];
+    float fixed_gyro_data[3];
+
+    uint32_t cycles[2];
+    for (uint8_t fixed_point = 0; fixed_point < 2; fixed_point++)
+    {
+        m_use_fixed_point = fixed_point;
+        uint32_t start = timebase_get_cycles();
+        for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+        {
+            sample.gyro[0] = -350 + (i & 0x0F); // Different every time so nothing gets hoisted out of the loop
+            mpu6050_convert_sample(&sample, accelerometer_data, gyro_data);
+        }
+        cycles[fixed_point] = (timebase_get_cycles() - start) / BENCHMARK_RUNS;
+    }
+
+    m_use_fixed_point = 0;
+    mpu6050_convert_sample(&sample, accelerometer_data, gyro_data);
+    m_use_fixed_point = 1;
+    mpu6050_convert_sample(&sample, fixed_accelerometer_data, fixed_gyro_data);
+    m_use_fixed_point = saved_use_fixed_point;
+
+    float accelerometer_error = 0.0f;
+    float gyro_error = 0.0f;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        accelerometer_error = fmaxf(accelerometer_error, fabsf(accelerometer_data[i] - fixed_accelerometer_data[i]));
+        gyro_error = fmaxf(gyro_error, fabsf(gyro_data[i] - fixed_gyro_data[i]));
+    }
+
+    printf("MPU6050 sample conversion cycles float %lu, fixed point %lu\n", (unsigned long)cycles[0], (unsigned long)cycles[1]);
+    printf("MPU6050 fixed point difference accelerometer %.6f g, gyro %.6f dps\n", accelerometer_error, gyro_error);
 }
 
 void calculate_pitch_and_roll(float *data, float *roll, float *pitch)
@@ -157,16 +748,16 @@ void calculate_pitch_and_roll(float *data, float *roll, float *pitch)
     float y = data[1];
     float z = data[2];
 
-    float acc_vector_length = sqrt(pow(x, 2) + pow(y, 2) + pow(z, 2));
-    x = x / acc_vector_length;
-    y = y / acc_vector_length;
-    z = z / acc_vector_length;
+    float inverse_acc_vector_length = fast_inverse_sqrtf(x * x + y * y + z * z);
+    x = x * inverse_acc_vector_length;
+    y = y * inverse_acc_vector_length;
+    z = z * inverse_acc_vector_length;
 
     // rotation around the x axis
-    *roll = atan2f(y, z) * (180 / M_PI);
+    *roll = fast_atan2f(y, z) * RADIANS_TO_DEGREES_F;
 
     // rotation around the y axis
-    *pitch = -(asinf(x) * (180 / M_PI));
+    *pitch = -(fast_asinf(x) * RADIANS_TO_DEGREES_F);
     // i put a minus on the pitch calculation as i have found that the pitch has opposite values of actual
 }
 
@@ -177,9 +768,9 @@ void calculate_degrees_x_y(float *data, float *rotation_around_x, float *rotatio
     float y = data[1];
     float z = data[2];
 
-    *rotation_around_x = atan2f(y, sqrtf(x * x + z * z)) * (180.0 / M_PI);
+    *rotation_around_x = fast_atan2f(y, fast_sqrtf(x * x + z * z)) * RADIANS_TO_DEGREES_F;
     // added minus to match actual dps direction the values are supposed to go
-    *rotation_around_y = -(atan2f(x, sqrtf(y * y + z * z)) * (180.0 / M_PI));
+    *rotation_around_y = -(fast_atan2f(x, fast_sqrtf(y * y + z * z)) * RADIANS_TO_DEGREES_F);
 }
 
 // Get many values of the accelerometer error and average them together. Then print out the result
@@ -315,6 +906,112 @@ void find_and_return_gyro_error(uint64_t sample_size, float *return_array)
     return_array[2] = z_sum / sample_size;
 }
 
+// Temperature of the last sample that was converted or read
+float mpu6050_get_temperature_celsius()
+{
+    return m_temperature_celsius;
+}
+
+// Replaces the fixed gyro correction, NULL goes back to it
+void mpu6050_set_gyro_temperature_model(const struct mpu6050_gyro_temperature_model *model)
+{
+    if (model == NULL)
+    {
+        m_gyro_temperature_model_set = 0;
+        m_fixed_gyro_offset_valid = 0;
+        return;
+    }
+    m_gyro_temperature_model = *model;
+    m_gyro_temperature_model_set = 1;
+    m_fixed_gyro_offset_valid = 0;
+}
+
+// Fits the gyro bias against temperature, a straight line per axis by least squares. The drone has to stand still
+// the whole time while the temperature changes, powering it up cold and letting it warm up does that.
+// Returns 0 when the temperature did not change by at least minimum_temperature_span_celsius, a slope from a
+// smaller span is mostly noise. Blocks for duration_ms
+uint8_t mpu6050_fit_gyro_temperature_model(uint32_t duration_ms, float minimum_temperature_span_celsius, struct mpu6050_gyro_temperature_model *model)
+{
+    struct mpu6050_sample sample;
+    float gyro[3];
+
+    // Around the first temperature so the float sums do not lose the small differences
+    float first_temperature = 0.0f;
+    float min_temperature = 0.0f;
+    float max_temperature = 0.0f;
+    uint32_t count = 0;
+    float temperature_sum = 0.0f;
+    float temperature_squared_sum = 0.0f;
+    float bias_sum[3] = {0, 0, 0};
+    float bias_temperature_sum[3] = {0, 0, 0};
+
+    printf("Gyro temperature calibration, keep the drone still for %lu seconds\n", (unsigned long)(duration_ms / 1000));
+    uint32_t start_time = HAL_GetTick();
+    uint32_t last_print_time = start_time;
+    while (HAL_GetTick() - start_time < duration_ms)
+    {
+        HAL_Delay(10);
+        if (!mpu6050_read_sample(&sample))
+        {
+            continue;
+        }
+
+        float temperature = convert_temperature_celsius(sample.temperature);
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            gyro[i] = (float)sample.gyro[i] / m_gyro_lsb_per_dps;
+        }
+        align(gyro);
+
+        if (count == 0)
+        {
+            first_temperature = temperature;
+            min_temperature = temperature;
+            max_temperature = temperature;
+        }
+        min_temperature = temperature < min_temperature ? temperature : min_temperature;
+        max_temperature = temperature > max_temperature ? temperature : max_temperature;
+
+        float relative_temperature = temperature - first_temperature;
+        count++;
+        temperature_sum += relative_temperature;
+        temperature_squared_sum += relative_temperature * relative_temperature;
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            bias_sum[i] += gyro[i];
+            bias_temperature_sum[i] += gyro[i] * relative_temperature;
+        }
+
+        if (HAL_GetTick() - last_print_time >= 10000)
+        {
+            last_print_time = HAL_GetTick();
+            printf("%lu s, %.2f C, span %.2f C\n", (unsigned long)((last_print_time - start_time) / 1000), temperature, max_temperature - min_temperature);
+        }
+    }
+
+    float temperature_variance = count * temperature_squared_sum - temperature_sum * temperature_sum;
+    if (count < 2 || max_temperature - min_temperature < minimum_temperature_span_celsius || temperature_variance <= 0.0f)
+    {
+        printf("Gyro temperature calibration failed, the temperature only changed by %.2f C\n", max_temperature - min_temperature);
+        return 0;
+    }
+
+    // The line goes through the averages, so the average temperature is the reference
+    model->reference_celsius = first_temperature + temperature_sum / count;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        model->bias_dps[i] = bias_sum[i] / count;
+        model->slope_dps_per_celsius[i] = (count * bias_temperature_sum[i] - temperature_sum * bias_sum[i]) / temperature_variance;
+    }
+
+    printf(
+        "GYRO temperature model at %.2f C: bias %f, %f, %f dps, slope %f, %f, %f dps/C\n",
+        model->reference_celsius,
+        model->bias_dps[0], model->bias_dps[1], model->bias_dps[2],
+        model->slope_dps_per_celsius[0], model->slope_dps_per_celsius[1], model->slope_dps_per_celsius[2]);
+    return 1;
+}
+
 void mpu6050_apply_calibrations(float accelerometer_correction[3], float gyro_correction[3]){
     // assign the correction for gyro
     for (uint8_t i = 0; i < 3; i++)
@@ -327,23 +1024,31 @@ void mpu6050_apply_calibrations(float accelerometer_correction[3], float gyro_co
     {
         m_accelerometer_correction[i] = accelerometer_correction[i];
     }
+    update_fixed_corrections();
 }
 
 
+// A loop that ran late gets more of the accelerometer, the same as the gyro it integrated for longer
+static float complementary_ratio_for(float elapsed_time_sec)
+{
+    return elapsed_time_sec / (m_complementary_time_constant + elapsed_time_sec);
+}
+
 // Do complementary filter for x(pitch) and y(roll) and z(yaw). Combine accelerometer and gyro to get a more usable gyro value. Please make sure the coefficient is scaled by refresh rate. It helps a lot.
-void convert_angular_rotation_to_degrees(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, float rotation_around_z, int64_t time){
+void convert_angular_rotation_to_degrees(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, float rotation_around_z, uint32_t time){
     if(m_previous_time == 0){
         m_previous_time = time;
         return;
     }
 
-    float elapsed_time_sec= (((float)time/1000.0)-((float)m_previous_time/1000.0));
+    float elapsed_time_sec= timebase_get_seconds_between(m_previous_time, time);
     m_previous_time = time;
 
     // Convert degrees per second and add the complementary filter with accelerometer degrees
-    gyro_degrees[0] = (1.0 - m_complementary_ratio) * (gyro_degrees[0] + gyro_angular[0] * elapsed_time_sec) + m_complementary_ratio * rotation_around_x;
-    gyro_degrees[1] = (1.0 - m_complementary_ratio) * (gyro_degrees[1] + gyro_angular[1] * elapsed_time_sec) + m_complementary_ratio * rotation_around_y;
-    gyro_degrees[2] = (1.0 - m_complementary_ratio) * (gyro_degrees[2] + gyro_angular[2] * elapsed_time_sec) + m_complementary_ratio * rotation_around_z;
+    float ratio = complementary_ratio_for(elapsed_time_sec);
+    gyro_degrees[0] = (1.0 - ratio) * (gyro_degrees[0] + gyro_angular[0] * elapsed_time_sec) + ratio * rotation_around_x;
+    gyro_degrees[1] = (1.0 - ratio) * (gyro_degrees[1] + gyro_angular[1] * elapsed_time_sec) + ratio * rotation_around_y;
+    gyro_degrees[2] = (1.0 - ratio) * (gyro_degrees[2] + gyro_angular[2] * elapsed_time_sec) + ratio * rotation_around_z;
 
     // I dont want to track how many times the degrees went over the 360 degree mark, no point.
     while (gyro_degrees[0] > 180.0) {
@@ -369,21 +1074,22 @@ void convert_angular_rotation_to_degrees(float* gyro_angular, float* gyro_degree
 }
 
 // Do complementary filter for x(pitch) and y(roll). Combine accelerometer and gyro to get a more usable gyro value. Please make sure the coefficient is scaled by refresh rate. It helps a lot.
-void convert_angular_rotation_to_degrees_x_y(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, int64_t time, uint8_t set_timestamp){
+void convert_angular_rotation_to_degrees_x_y(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, uint32_t time, uint8_t set_timestamp){
 
     if(m_previous_time == 0){
         m_previous_time = time;
         return;
     }
 
-    float elapsed_time_sec= (((float)time/1000.0)-((float)m_previous_time/1000.0));
+    float elapsed_time_sec= timebase_get_seconds_between(m_previous_time, time);
     if(set_timestamp == 1){
         m_previous_time = time;
     }
 
     // Convert degrees per second and add the complementary filter with accelerometer degrees
-    gyro_degrees[0] = (1.0 - m_complementary_ratio) * (gyro_degrees[0] + gyro_angular[0] * elapsed_time_sec) + m_complementary_ratio * rotation_around_x;
-    gyro_degrees[1] = (1.0 - m_complementary_ratio) * (gyro_degrees[1] + gyro_angular[1] * elapsed_time_sec) + m_complementary_ratio * rotation_around_y;
+    float ratio = complementary_ratio_for(elapsed_time_sec);
+    gyro_degrees[0] = (1.0 - ratio) * (gyro_degrees[0] + gyro_angular[0] * elapsed_time_sec) + ratio * rotation_around_x;
+    gyro_degrees[1] = (1.0 - ratio) * (gyro_degrees[1] + gyro_angular[1] * elapsed_time_sec) + ratio * rotation_around_y;
 
     // I dont want to track how many times the degrees went over the 360 degree mark, no point.
     while (gyro_degrees[0] > 180.0) {
@@ -423,7 +1129,7 @@ float angle_difference(float a, float b) {
 }
 
 // Do complementary filter to merge magnetometer and gyro values
-void convert_angular_rotation_to_degrees_z(float* gyro_angular, float* gyro_degrees, float rotation_around_z, int64_t time){
+void convert_angular_rotation_to_degrees_z(float* gyro_angular, float* gyro_degrees, float rotation_around_z, uint32_t time){
     // Convert angular velocity to actual degrees that it moved and add it to the integral (dead reckoning not PID)
 
     if(m_previous_time == 0){
@@ -431,7 +1137,7 @@ void convert_angular_rotation_to_degrees_z(float* gyro_angular, float* gyro_degr
         return;
     }
 
-    float elapsed_time_sec = (((float)time/1000.0)-((float)m_previous_time/1000.0));
+    float elapsed_time_sec = timebase_get_seconds_between(m_previous_time, time);
     m_previous_time = time;
 
     // Gyro without magnetometer
@@ -449,7 +1155,7 @@ void convert_angular_rotation_to_degrees_z(float* gyro_angular, float* gyro_degr
     // gyro_degrees[2] = (1.0 - m_complementary_ratio) * gyro_integration + m_complementary_ratio * (gyro_integration + angle_diff);
 
     // Works very good adding it on top. Not as good as raw magnetometer yaw though
-    gyro_degrees[2] = gyro_integration + m_complementary_ratio * angle_diff;
+    gyro_degrees[2] = gyro_integration + complementary_ratio_for(elapsed_time_sec) * angle_diff;
 
     // I dont want to track how many times the degrees went over the 360 degree mark, no point.
     while (gyro_degrees[2] > 180.0) {
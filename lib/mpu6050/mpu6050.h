@@ -4,6 +4,10 @@
 #include "stm32f4xx_hal.h"
 #include "stm32f4xx_hal_i2c.h"
 #include "../printf/retarget.h"
+#include "../i2c_scheduler/i2c_scheduler.h"
+#include "../timebase/timebase.h"
+#include "../fastmath/fastmath.h"
+#include "../sensor_alignment/sensor_alignment.h"
 #include <math.h>
 
 enum t_power_management {
@@ -15,16 +19,120 @@ enum t_power_management {
     PWR_CLOCK_INTERNAL_STOP = 0b00000111,
 };
 
-uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, float accelerometer_correction[3], float gyro_correction[3], float refresh_rate_hz, float complementary_ratio);
+// Digital low pass filter. Anything other than 260Hz makes the gyro output rate 1kHz instead of 8kHz
+enum t_dlpf_config {
+    DLPF_260HZ = 0b00000000,
+    DLPF_184HZ = 0b00000001,
+    DLPF_94HZ  = 0b00000010,
+    DLPF_44HZ  = 0b00000011,
+    DLPF_21HZ  = 0b00000100,
+    DLPF_10HZ  = 0b00000101,
+    DLPF_5HZ   = 0b00000110,
+};
+
+enum t_gyro_full_scale {
+    GYRO_FULL_SCALE_250DPS  = 0b00000000,
+    GYRO_FULL_SCALE_500DPS  = 0b00001000,
+    GYRO_FULL_SCALE_1000DPS = 0b00010000,
+    GYRO_FULL_SCALE_2000DPS = 0b00011000,
+};
+
+enum t_accelerometer_full_scale {
+    ACCEL_FULL_SCALE_2G  = 0b00000000,
+    ACCEL_FULL_SCALE_4G  = 0b00001000,
+    ACCEL_FULL_SCALE_8G  = 0b00010000,
+    ACCEL_FULL_SCALE_16G = 0b00011000,
+};
+
+// What gets pushed into the fifo every sample. The order in the fifo is the register order
+enum t_fifo_enable {
+    FIFO_TEMP  = 0b10000000,
+    FIFO_XG    = 0b01000000,
+    FIFO_YG    = 0b00100000,
+    FIFO_ZG    = 0b00010000,
+    FIFO_ACCEL = 0b00001000,
+};
+
+enum t_user_control {
+    USER_CTRL_FIFO_ENABLE = 0b01000000,
+    USER_CTRL_FIFO_RESET  = 0b00000100,
+};
+
+enum t_interrupt_pin_config {
+    INT_PIN_ACTIVE_HIGH   = 0b00000000,
+    INT_PIN_ACTIVE_LOW    = 0b10000000,
+    INT_PIN_PUSH_PULL     = 0b00000000,
+    INT_PIN_OPEN_DRAIN    = 0b01000000,
+    INT_PIN_PULSE_50US    = 0b00000000,
+    INT_PIN_LATCH         = 0b00100000,
+    INT_PIN_CLEAR_ON_READ = 0b00010000,
+};
+
+enum t_interrupt_enable {
+    INT_DATA_READY_ENABLE    = 0b00000001,
+    INT_FIFO_OVERFLOW_ENABLE = 0b00010000,
+};
+
+// Whole samples (accelerometer, temperature and gyro, 14 bytes) read out of the fifo in one drain.
+// 1kHz sampling is about a third of the 400kHz bus, 8kHz would not fit on it at all.
+#define MPU6050_FIFO_MAX_SAMPLES 16
+
+// One coherent sample of all the measurement registers, read in a single transaction
+struct mpu6050_sample{
+    int16_t accelerometer[3];
+    int16_t temperature;
+    int16_t gyro[3];
+    uint32_t time; // timebase microseconds when the sample was read
+};
+
+// A sample with the alignment and corrections applied but still in integers, raw LSB times 256.
+// mpu6050_average_fixed_samples decimates them without leaving integers, mpu6050_fixed_sample_to_float turns
+// them into g and dps. The gyro filter chains are float biquads, so the per sample gyro is converted before them
+struct mpu6050_fixed_sample{
+    int32_t accelerometer[3];
+    int32_t gyro[3];
+};
+
+// Gyro bias as a straight line over temperature, per axis, in board axes
+struct mpu6050_gyro_temperature_model{
+    float reference_celsius;
+    float bias_dps[3];              // At the reference temperature
+    float slope_dps_per_celsius[3];
+};
+
+uint8_t init_mpu6050(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, float accelerometer_correction[3], float gyro_correction[3], const float alignment[3][3], float refresh_rate_hz, float complementary_ratio);
+uint8_t mpu6050_configure(float sample_rate_hz, enum t_dlpf_config dlpf, enum t_gyro_full_scale gyro_full_scale, enum t_accelerometer_full_scale accelerometer_full_scale);
+uint8_t mpu6050_enable_data_ready_interrupt(uint16_t samples_per_data_ready);
+uint8_t mpu6050_enable_fifo();
+uint8_t mpu6050_queue_fifo_read();
+uint8_t mpu6050_wait_for_fifo_read(uint32_t timeout_ms);
+uint8_t mpu6050_get_queued_fifo_samples(struct mpu6050_sample *samples, uint8_t max_samples);
+void mpu6050_average_samples(struct mpu6050_sample *samples, uint8_t sample_count, struct mpu6050_sample *average);
+uint32_t mpu6050_get_fifo_overflow_count();
+void mpu6050_data_ready_interrupt();
+uint8_t mpu6050_wait_for_data_ready(uint32_t timeout_ms);
+uint8_t mpu6050_check_data_ready();
 void mpu6050_get_accelerometer_readings_gravity(float *data);
 void mpu6050_get_gyro_readings_dps(float *data);
+uint8_t mpu6050_read_sample(struct mpu6050_sample *sample);
+uint8_t mpu6050_queue_sample_read();
+uint8_t mpu6050_get_queued_sample(struct mpu6050_sample *sample);
+void mpu6050_convert_sample(struct mpu6050_sample *sample, float *accelerometer_data, float *gyro_data);
+void mpu6050_use_fixed_point(uint8_t enabled);
+void mpu6050_correct_sample_fixed(const struct mpu6050_sample *sample, struct mpu6050_fixed_sample *fixed);
+void mpu6050_average_fixed_samples(const struct mpu6050_fixed_sample *samples, uint8_t sample_count, struct mpu6050_fixed_sample *average);
+void mpu6050_fixed_sample_to_float(const struct mpu6050_fixed_sample *fixed, float *accelerometer_data, float *gyro_data);
+void mpu6050_print_benchmark();
 void calculate_pitch_and_roll(float *data, float *roll, float *pitch);
 void calculate_degrees_x_y(float *data, float *rotation_around_x, float *rotation_around_y);
 void find_accelerometer_error(uint64_t sample_size);
 void find_gyro_error(uint64_t sample_size);
-void convert_angular_rotation_to_degrees(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, float rotation_around_z, int64_t time);
-void convert_angular_rotation_to_degrees_x_y(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, int64_t time, uint8_t set_timestamp);
+void convert_angular_rotation_to_degrees(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, float rotation_around_z, uint32_t time);
+void convert_angular_rotation_to_degrees_x_y(float* gyro_angular, float* gyro_degrees, float rotation_around_x, float rotation_around_y, uint32_t time, uint8_t set_timestamp);
 float angle_difference(float a, float b);
-void convert_angular_rotation_to_degrees_z(float* gyro_angular, float* gyro_degrees, float rotation_around_z, int64_t time);
+void convert_angular_rotation_to_degrees_z(float* gyro_angular, float* gyro_degrees, float rotation_around_z, uint32_t time);
 void find_and_return_gyro_error(uint64_t sample_size, float *return_array);
-void mpu6050_apply_calibrations(float accelerometer_correction[3], float gyro_correction[3]);
\ No newline at end of file
+void mpu6050_apply_calibrations(float accelerometer_correction[3], float gyro_correction[3]);
+float mpu6050_get_temperature_celsius();
+void mpu6050_set_gyro_temperature_model(const struct mpu6050_gyro_temperature_model *model);
+uint8_t mpu6050_fit_gyro_temperature_model(uint32_t duration_ms, float minimum_temperature_span_celsius, struct mpu6050_gyro_temperature_model *model);
\ No newline at end of file
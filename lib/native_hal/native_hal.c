@@ -0,0 +1,474 @@
+#include "./native_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Stop the program after this much virtual time so runs on the workstation end by themselves.
+// 0 means run forever.
+#ifndef NATIVE_HAL_RUN_TIME_MS
+#define NATIVE_HAL_RUN_TIME_MS 0
+#endif
+
+// The real board runs the core at 75MHz, cycle counts are scaled to that
+#define NATIVE_HAL_CORE_CLOCK_HZ 75000000
+#define NATIVE_HAL_TIMER_CLOCK_HZ 75000000
+
+uint32_t SystemCoreClock = NATIVE_HAL_CORE_CLOCK_HZ;
+
+GPIO_TypeDef native_hal_gpioa, native_hal_gpiob, native_hal_gpioc, native_hal_gpioh;
+I2C_TypeDef native_hal_i2c1;
+SPI_TypeDef native_hal_spi1, native_hal_spi3;
+TIM_TypeDef native_hal_tim1, native_hal_tim2, native_hal_tim5;
+USART_TypeDef native_hal_usart1, native_hal_usart2;
+CoreDebug_Type native_hal_core_debug;
+
+static DWT_Type m_dwt;
+
+static struct timespec m_start_time;
+static uint64_t m_delay_offset_us = 0;
+static uint8_t m_initialized = 0;
+
+static uint8_t m_i2c_registers[128][256];
+static uint32_t m_i2c_transaction_count = 0;
+static uint32_t m_i2c_byte_count = 0;
+static uint8_t m_i2c_stuck_devices[128];
+
+static uint8_t m_irq_disabled = 0;
+
+// 512KB like the F411CE
+#define NATIVE_HAL_FLASH_SIZE (512 * 1024)
+static uint8_t m_flash[NATIVE_HAL_FLASH_SIZE];
+static uint8_t m_flash_initialized = 0;
+static uint8_t m_flash_locked = 1;
+
+// One dma or interrupt transfer in flight, finished after the time it would take on a 400kHz bus
+static I2C_HandleTypeDef *m_i2c_dma_handle = NULL;
+static uint8_t m_i2c_dma_write = 0;
+static uint8_t m_i2c_dma_device_address = 0;
+static uint8_t m_i2c_dma_register_address = 0;
+static uint8_t *m_i2c_dma_data = NULL;
+static uint16_t m_i2c_dma_size = 0;
+static uint64_t m_i2c_dma_done_time_us = 0;
+
+static void native_hal_service_interrupts();
+
+// Time #################################################################################################
+
+static void native_hal_start_clock(){
+    if(!m_initialized){
+        clock_gettime(CLOCK_MONOTONIC, &m_start_time);
+        m_initialized = 1;
+    }
+}
+
+uint64_t native_hal_get_micros(){
+    native_hal_start_clock();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t elapsed_us = (uint64_t)(now.tv_sec - m_start_time.tv_sec) * 1000000 +
+                          (now.tv_nsec - m_start_time.tv_nsec) / 1000;
+    return elapsed_us + m_delay_offset_us;
+}
+
+HAL_StatusTypeDef HAL_Init(void){
+    native_hal_start_clock();
+    native_hal_devices_init();
+    return HAL_OK;
+}
+
+static void check_run_time(uint32_t tick){
+    if(NATIVE_HAL_RUN_TIME_MS != 0 && tick >= NATIVE_HAL_RUN_TIME_MS){
+        printf("\nnative_hal: run time of %d ms reached\n", NATIVE_HAL_RUN_TIME_MS);
+        exit(0);
+    }
+}
+
+uint32_t HAL_GetTick(void){
+    native_hal_service_interrupts();
+    uint32_t tick = native_hal_get_micros() / 1000;
+    check_run_time(tick);
+    return tick;
+}
+
+void HAL_Delay(uint32_t Delay){
+    m_delay_offset_us += (uint64_t)Delay * 1000;
+}
+
+DWT_Type *native_hal_dwt(void){
+    m_dwt.CYCCNT = (uint32_t)(native_hal_get_micros() * (NATIVE_HAL_CORE_CLOCK_HZ / 1000000));
+    return &m_dwt;
+}
+
+// Cortex ###############################################################################################
+
+void native_hal_disable_irq(void){
+    m_irq_disabled = 1;
+}
+
+void native_hal_enable_irq(void){
+    m_irq_disabled = 0;
+    native_hal_service_interrupts();
+}
+
+uint32_t native_hal_get_primask(void){
+    return m_irq_disabled;
+}
+
+// Runs the "interrupt handlers" of everything that finished since the last call
+static void native_hal_service_interrupts(){
+    if(m_irq_disabled){
+        return;
+    }
+
+    m_irq_disabled = 1;
+    native_hal_devices_service_interrupts(native_hal_get_micros());
+    m_irq_disabled = 0;
+
+    if(m_i2c_dma_handle == NULL || native_hal_get_micros() < m_i2c_dma_done_time_us){
+        return;
+    }
+
+    I2C_HandleTypeDef *hi2c = m_i2c_dma_handle;
+    m_i2c_dma_handle = NULL;
+
+    m_irq_disabled = 1;
+    if(m_i2c_dma_write){
+        native_hal_devices_i2c_write(m_i2c_dma_device_address, m_i2c_dma_register_address, m_i2c_dma_data, m_i2c_dma_size);
+        HAL_I2C_MemTxCpltCallback(hi2c);
+    }else{
+        native_hal_devices_i2c_read(m_i2c_dma_device_address, m_i2c_dma_register_address, m_i2c_dma_data, m_i2c_dma_size);
+        HAL_I2C_MemRxCpltCallback(hi2c);
+    }
+    m_irq_disabled = 0;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority){}
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn){}
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn){}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct){
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency){
+    return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void){
+    return SystemCoreClock;
+}
+
+// GPIO #################################################################################################
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init){}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState){
+    if(PinState == GPIO_PIN_SET){
+        GPIOx->ODR |= GPIO_Pin;
+    }else{
+        GPIOx->ODR &= ~GPIO_Pin;
+    }
+    native_hal_spi_device_select(GPIOx, GPIO_Pin, PinState);
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin){
+    return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin){
+    GPIOx->ODR ^= GPIO_Pin;
+}
+
+void HAL_GPIO_EXTI_IRQHandler(uint16_t GPIO_Pin){
+    HAL_GPIO_EXTI_Callback(GPIO_Pin);
+}
+
+__attribute__((weak)) void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin){}
+
+// I2C ##################################################################################################
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c){
+    return HAL_OK;
+}
+
+// Also drops a transfer that is in flight, same as resetting the peripheral on the chip
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c){
+    if(m_i2c_dma_handle == hi2c){
+        m_i2c_dma_handle = NULL;
+    }
+    return HAL_OK;
+}
+
+void native_hal_i2c_set_device_stuck(uint8_t device_address, uint8_t stuck){
+    m_i2c_stuck_devices[device_address & 0x7F] = stuck;
+}
+
+void native_hal_i2c_set_registers(uint8_t device_address, uint8_t register_address, const uint8_t *data, uint16_t size){
+    for(uint16_t i = 0; i < size; i++){
+        m_i2c_registers[device_address & 0x7F][(uint8_t)(register_address + i)] = data[i];
+    }
+}
+
+void native_hal_i2c_get_registers(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size){
+    for(uint16_t i = 0; i < size; i++){
+        data[i] = m_i2c_registers[device_address & 0x7F][(uint8_t)(register_address + i)];
+    }
+}
+
+void native_hal_i2c_set_register_int16_big_endian(uint8_t device_address, uint8_t register_address, int16_t value){
+    uint8_t data[2] = {(uint16_t)value >> 8, (uint16_t)value & 0xFF};
+    native_hal_i2c_set_registers(device_address, register_address, data, 2);
+}
+
+// The drivers pass the 8 bit address with the read bit set or not, the register file uses 7 bits
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout){
+    native_hal_service_interrupts();
+    if(m_i2c_dma_handle != NULL){
+        return HAL_BUSY;
+    }
+    m_i2c_transaction_count++;
+    m_i2c_byte_count += Size;
+    native_hal_devices_i2c_write(DevAddress >> 1, MemAddress, pData, Size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout){
+    native_hal_service_interrupts();
+    if(m_i2c_dma_handle != NULL){
+        return HAL_BUSY;
+    }
+    m_i2c_transaction_count++;
+    m_i2c_byte_count += Size;
+    native_hal_devices_i2c_read(DevAddress >> 1, MemAddress, pData, Size);
+    return HAL_OK;
+}
+
+static HAL_StatusTypeDef start_background_transfer(I2C_HandleTypeDef *hi2c, uint8_t write, uint16_t DevAddress, uint16_t MemAddress, uint8_t *pData, uint16_t Size){
+    native_hal_service_interrupts();
+    if(m_i2c_dma_handle != NULL){
+        return HAL_BUSY;
+    }
+    m_i2c_transaction_count++;
+    m_i2c_byte_count += Size;
+
+    m_i2c_dma_handle = hi2c;
+    m_i2c_dma_write = write;
+    m_i2c_dma_device_address = DevAddress >> 1;
+    m_i2c_dma_register_address = MemAddress;
+    m_i2c_dma_data = pData;
+    m_i2c_dma_size = Size;
+
+    // Start, address, register, repeated start, address and the data. 9 clocks per byte at 400kHz
+    m_i2c_dma_done_time_us = native_hal_get_micros() + ((uint64_t)(Size + 3) * 9 * 1000000) / 400000;
+    if(m_i2c_stuck_devices[DevAddress >> 1]){
+        m_i2c_dma_done_time_us = UINT64_MAX;
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size){
+    return start_background_transfer(hi2c, 0, DevAddress, MemAddress, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size){
+    return start_background_transfer(hi2c, 1, DevAddress, MemAddress, pData, Size);
+}
+
+__attribute__((weak)) void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c){}
+__attribute__((weak)) void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c){}
+__attribute__((weak)) void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c){}
+
+uint32_t native_hal_i2c_get_transaction_count(){
+    return m_i2c_transaction_count;
+}
+
+uint32_t native_hal_i2c_get_byte_count(){
+    return m_i2c_byte_count;
+}
+
+void native_hal_i2c_reset_statistics(){
+    m_i2c_transaction_count = 0;
+    m_i2c_byte_count = 0;
+}
+
+// SPI ##################################################################################################
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi){
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout){
+    native_hal_spi_device_transmit(hspi, pData, Size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout){
+    native_hal_spi_device_receive(hspi, pData, Size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout){
+    native_hal_spi_device_transmit(hspi, pTxData, Size);
+    memset(pRxData, 0, Size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size){
+    native_hal_spi_device_transmit(hspi, pData, Size);
+    return HAL_OK;
+}
+
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi){
+    return HAL_SPI_STATE_READY;
+}
+
+// TIM ##################################################################################################
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim){
+    htim->Instance->PSC = htim->Init.Prescaler;
+    htim->Instance->ARR = htim->Init.Period;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim){
+    htim->Instance->CR1 |= 1;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef *htim, TIM_ClockConfigTypeDef *sClockSourceConfig){
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Init(TIM_HandleTypeDef *htim){
+    return HAL_TIM_Base_Init(htim);
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel){
+    return HAL_TIM_Base_Start(htim);
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef *sConfig, uint32_t Channel){
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef *htim, TIM_MasterConfigTypeDef *sMasterConfig){
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef *htim, TIM_BreakDeadTimeConfigTypeDef *sBreakDeadTimeConfig){
+    return HAL_OK;
+}
+
+void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim){}
+
+// Code that polls a timer instead of the tick still sees the interrupts happen
+uint32_t native_hal_tim_get_counter(TIM_HandleTypeDef *htim){
+    native_hal_service_interrupts();
+    check_run_time(native_hal_get_micros() / 1000);
+
+    if(!(htim->Instance->CR1 & 1)){
+        return htim->Instance->CNT;
+    }
+
+    uint64_t ticks = native_hal_get_micros() * (NATIVE_HAL_TIMER_CLOCK_HZ / 1000000) / (htim->Instance->PSC + 1);
+    if(htim->Instance->ARR != 0 && htim->Instance->ARR != 0xFFFFFFFF){
+        ticks = ticks % ((uint64_t)htim->Instance->ARR + 1);
+    }
+    htim->Instance->CNT = (uint32_t)ticks;
+    return htim->Instance->CNT;
+}
+
+// FLASH ################################################################################################
+
+uint8_t *native_hal_flash_memory(void){
+    if(!m_flash_initialized){
+        memset(m_flash, 0xFF, sizeof(m_flash));
+        m_flash_initialized = 1;
+    }
+    return m_flash;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void){
+    m_flash_locked = 0;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void){
+    m_flash_locked = 1;
+    return HAL_OK;
+}
+
+// Sectors 0 to 3 are 16KB, 4 is 64KB and 5 to 7 are 128KB
+static void flash_sector_range(uint32_t sector, uint32_t *start, uint32_t *size){
+    if(sector < 4){
+        *start = sector * 16 * 1024;
+        *size = 16 * 1024;
+    }else if(sector == 4){
+        *start = 64 * 1024;
+        *size = 64 * 1024;
+    }else{
+        *start = (sector - 4) * 128 * 1024;
+        *size = 128 * 1024;
+    }
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError){
+    *SectorError = 0xFFFFFFFFU;
+    if(m_flash_locked) return HAL_ERROR;
+
+    uint8_t *flash = native_hal_flash_memory();
+    for(uint32_t sector = pEraseInit->Sector; sector < pEraseInit->Sector + pEraseInit->NbSectors; sector++){
+        if(sector > FLASH_SECTOR_7){
+            *SectorError = sector;
+            return HAL_ERROR;
+        }
+        uint32_t start, size;
+        flash_sector_range(sector, &start, &size);
+        memset(flash + start, 0xFF, size);
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uintptr_t Address, uint64_t Data){
+    uint8_t *flash = native_hal_flash_memory();
+    uint32_t size = TypeProgram == FLASH_TYPEPROGRAM_WORD ? 4 : 1;
+    if(m_flash_locked || Address < (uintptr_t)flash || Address + size > (uintptr_t)flash + NATIVE_HAL_FLASH_SIZE){
+        return HAL_ERROR;
+    }
+
+    uint8_t *target = (uint8_t *)Address;
+    for(uint32_t i = 0; i < size; i++){
+        target[i] &= (uint8_t)(Data >> (8 * i));
+    }
+    return HAL_OK;
+}
+
+// UART #################################################################################################
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart){
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_DeInit(UART_HandleTypeDef *huart){
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout){
+    fwrite(pData, 1, Size, stdout);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout){
+    return HAL_TIMEOUT;
+}
+
+// The gps never sends anything on the workstation
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size){
+    return HAL_OK;
+}
+
+void RetargetInit(UART_HandleTypeDef *huart){}
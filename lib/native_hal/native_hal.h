@@ -0,0 +1,33 @@
+#pragma once
+
+// Native only helpers for poking at the simulated hardware behind the fake HAL
+
+#include "stm32f4xx_hal.h"
+
+// Time since HAL_Init. HAL_Delay only moves the virtual clock forward so boot delays are free
+uint64_t native_hal_get_micros();
+
+// Register file of the simulated i2c devices. Address is the 7 bit address, not shifted.
+void native_hal_i2c_set_registers(uint8_t device_address, uint8_t register_address, const uint8_t *data, uint16_t size);
+void native_hal_i2c_get_registers(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size);
+void native_hal_i2c_set_register_int16_big_endian(uint8_t device_address, uint8_t register_address, int16_t value);
+
+// A stuck device holds the bus and never finishes a dma read, for testing timeouts
+void native_hal_i2c_set_device_stuck(uint8_t device_address, uint8_t stuck);
+
+// Bus statistics so benchmarks can count transactions per loop
+uint32_t native_hal_i2c_get_transaction_count();
+uint32_t native_hal_i2c_get_byte_count();
+void native_hal_i2c_reset_statistics();
+
+// The simulated devices. Every i2c transfer goes through them so a device can update its data
+// registers or stream out of a fifo. Interrupt servicing lets a device pulse its pins.
+void native_hal_devices_init();
+void native_hal_devices_i2c_read(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size);
+void native_hal_devices_i2c_write(uint8_t device_address, uint8_t register_address, const uint8_t *data, uint16_t size);
+void native_hal_devices_service_interrupts(uint64_t time_us);
+
+// Simulated spi device that is selected by a chip select pin
+void native_hal_spi_device_select(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+void native_hal_spi_device_transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+void native_hal_spi_device_receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
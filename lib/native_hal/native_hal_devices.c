@@ -0,0 +1,300 @@
+#include "./native_hal.h"
+
+#include <string.h>
+
+// Simulated devices on the fake buses. They only have to look real enough for the drivers
+// to initialize and for the flight code to chew on believable numbers.
+
+#define MPU6050_ADDRESS 0x68
+#define QMC5883L_ADDRESS 0x0D
+#define BMP280_ADDRESS 0x76
+
+// mpu6050 INT is wired to PB8
+#define MPU6050_INT_PIN GPIO_PIN_8
+
+// nrf24 chip select is PB1
+#define NRF24_CS_PORT GPIOB
+#define NRF24_CS_PIN GPIO_PIN_1
+
+static uint32_t m_noise_state = 12345;
+
+// Small deterministic noise so runs can be compared with each other
+static int16_t noise(int16_t amplitude){
+    m_noise_state = m_noise_state * 1103515245 + 12345;
+    return (int16_t)((int32_t)((m_noise_state >> 16) % (2 * amplitude + 1)) - amplitude);
+}
+
+static void mpu6050_init(){
+    uint8_t who_am_i = 104;
+    native_hal_i2c_set_registers(MPU6050_ADDRESS, 0x75, &who_am_i, 1);
+}
+
+// Level and still, 1g on z
+static void mpu6050_update(){
+    native_hal_i2c_set_register_int16_big_endian(MPU6050_ADDRESS, 0x3B, 400 + noise(60));
+    native_hal_i2c_set_register_int16_big_endian(MPU6050_ADDRESS, 0x3D, -330 + noise(60));
+    native_hal_i2c_set_register_int16_big_endian(MPU6050_ADDRESS, 0x3F, 18750 + noise(60));
+    native_hal_i2c_set_register_int16_big_endian(MPU6050_ADDRESS, 0x41, -3920 + noise(10)); // 25 C
+    native_hal_i2c_set_register_int16_big_endian(MPU6050_ADDRESS, 0x43, -347 + noise(20));
+    native_hal_i2c_set_register_int16_big_endian(MPU6050_ADDRESS, 0x45, 413 + noise(20));
+    native_hal_i2c_set_register_int16_big_endian(MPU6050_ADDRESS, 0x47, 84 + noise(20));
+}
+
+static uint64_t m_mpu6050_next_sample_time_us = 0;
+static uint8_t m_mpu6050_fifo[1024];
+static uint16_t m_mpu6050_fifo_start = 0;
+static uint16_t m_mpu6050_fifo_count = 0;
+
+static void mpu6050_fifo_push(uint8_t value){
+    if(m_mpu6050_fifo_count == sizeof(m_mpu6050_fifo)){
+        // Full, the oldest byte is lost like on the chip
+        m_mpu6050_fifo_start = (m_mpu6050_fifo_start + 1) % sizeof(m_mpu6050_fifo);
+        m_mpu6050_fifo_count--;
+    }
+    m_mpu6050_fifo[(m_mpu6050_fifo_start + m_mpu6050_fifo_count) % sizeof(m_mpu6050_fifo)] = value;
+    m_mpu6050_fifo_count++;
+}
+
+static uint8_t mpu6050_fifo_pop(){
+    if(m_mpu6050_fifo_count == 0){
+        return 0;
+    }
+    uint8_t value = m_mpu6050_fifo[m_mpu6050_fifo_start];
+    m_mpu6050_fifo_start = (m_mpu6050_fifo_start + 1) % sizeof(m_mpu6050_fifo);
+    m_mpu6050_fifo_count--;
+    return value;
+}
+
+// New sample in the data registers, and in the fifo if USER_CTRL and FIFO_EN say so. Order is the register order
+static void mpu6050_take_sample(){
+    mpu6050_update();
+
+    uint8_t user_control;
+    uint8_t fifo_enable;
+    native_hal_i2c_get_registers(MPU6050_ADDRESS, 0x6A, &user_control, 1);
+    native_hal_i2c_get_registers(MPU6050_ADDRESS, 0x23, &fifo_enable, 1);
+    if(!(user_control & 0x40)){
+        return;
+    }
+
+    uint8_t data[14];
+    native_hal_i2c_get_registers(MPU6050_ADDRESS, 0x3B, data, 14);
+    for(uint8_t i = 0; i < 14; i++){
+        uint8_t enabled =
+            (i < 6 && (fifo_enable & 0x08)) ||              // accelerometer
+            (i >= 6 && i < 8 && (fifo_enable & 0x80)) ||    // temperature
+            (i >= 8 && i < 10 && (fifo_enable & 0x40)) ||   // gyro x
+            (i >= 10 && i < 12 && (fifo_enable & 0x20)) ||  // gyro y
+            (i >= 12 && (fifo_enable & 0x10));              // gyro z
+        if(enabled){
+            mpu6050_fifo_push(data[i]);
+        }
+    }
+}
+
+// Samples at the rate set by SMPLRT_DIV and CONFIG. Pulses the INT pin when data ready is enabled
+static void mpu6050_service_interrupts(uint64_t time_us){
+    uint8_t registers[2];
+    uint8_t interrupt_enable;
+    native_hal_i2c_get_registers(MPU6050_ADDRESS, 0x19, registers, 2);
+    native_hal_i2c_get_registers(MPU6050_ADDRESS, 0x38, &interrupt_enable, 1);
+
+    uint32_t gyro_output_rate_hz = (registers[1] & 0x07) == 0 ? 8000 : 1000;
+    uint64_t sample_period_us = 1000000 * (1 + (uint64_t)registers[0]) / gyro_output_rate_hz;
+
+    if(m_mpu6050_next_sample_time_us == 0 || time_us > m_mpu6050_next_sample_time_us + 1000000){
+        // First call or the clock jumped over a long HAL_Delay, no point in simulating all of it
+        m_mpu6050_next_sample_time_us = time_us + sample_period_us;
+        return;
+    }
+
+    uint8_t new_sample = 0;
+    while(m_mpu6050_next_sample_time_us <= time_us){
+        m_mpu6050_next_sample_time_us += sample_period_us;
+        mpu6050_take_sample();
+        new_sample = 1;
+    }
+
+    // Missed pulses are lost, same as on the real pin
+    if(new_sample && (interrupt_enable & 0x01)){
+        HAL_GPIO_EXTI_Callback(MPU6050_INT_PIN);
+    }
+}
+
+static void qmc5883l_init(){
+    uint8_t chip_id = 0xFF;
+    native_hal_i2c_set_registers(QMC5883L_ADDRESS, 0x0D, &chip_id, 1);
+}
+
+// Little endian, 20 steps per micro tesla, roughly the hard iron offset of the real sensor.
+// DRDY is set with every measurement, DOR too if the last one was never read
+static void qmc5883l_update(){
+    int16_t values[3] = {-400 + noise(8), 6300 + noise(8), 3900 + noise(8)};
+    uint8_t data[7];
+    for(uint8_t i = 0; i < 3; i++){
+        data[i * 2] = (uint16_t)values[i] & 0xFF;
+        data[i * 2 + 1] = (uint16_t)values[i] >> 8;
+    }
+    native_hal_i2c_get_registers(QMC5883L_ADDRESS, 0x06, &data[6], 1);
+    data[6] |= (data[6] & 0b00000001) << 2;
+    data[6] |= 0b00000001;
+    native_hal_i2c_set_registers(QMC5883L_ADDRESS, 0x00, data, 7);
+}
+
+static uint64_t m_qmc5883l_next_sample_time_us = 0;
+
+// Measures at the output data rate in CONTROL1 when in continuous mode
+static void qmc5883l_service_interrupts(uint64_t time_us){
+    uint8_t control1;
+    native_hal_i2c_get_registers(QMC5883L_ADDRESS, 0x09, &control1, 1);
+    if((control1 & 0x03) != 0x01){
+        m_qmc5883l_next_sample_time_us = 0;
+        return;
+    }
+
+    uint32_t output_data_rates_hz[] = {10, 50, 100, 200};
+    uint64_t sample_period_us = 1000000 / output_data_rates_hz[(control1 >> 2) & 0x03];
+
+    if(m_qmc5883l_next_sample_time_us == 0 || time_us > m_qmc5883l_next_sample_time_us + 1000000){
+        m_qmc5883l_next_sample_time_us = time_us + sample_period_us;
+        return;
+    }
+
+    while(m_qmc5883l_next_sample_time_us <= time_us){
+        m_qmc5883l_next_sample_time_us += sample_period_us;
+        qmc5883l_update();
+    }
+}
+
+// Trim values and raw readings are the example from the bmp280 datasheet
+static void bmp280_init(){
+    uint8_t chip_id = 0x58;
+    native_hal_i2c_set_registers(BMP280_ADDRESS, 0xD0, &chip_id, 1);
+
+    uint16_t trims[12] = {27504, 26435, (uint16_t)-1000, 36477, (uint16_t)-10685, 3024, 2855, 140, (uint16_t)-7, 15500, (uint16_t)-14600, 6000};
+    uint8_t trim_data[26] = {0};
+    for(uint8_t i = 0; i < 12; i++){
+        trim_data[i * 2] = trims[i] & 0xFF;
+        trim_data[i * 2 + 1] = trims[i] >> 8;
+    }
+    native_hal_i2c_set_registers(BMP280_ADDRESS, 0x88, trim_data, 26);
+}
+
+static void bmp280_update(){
+    uint32_t pressure = 415148 + noise(20);
+    uint32_t temperature = 519888 + noise(20);
+    uint8_t data[6] = {
+        pressure >> 12, (pressure >> 4) & 0xFF, (pressure & 0x0F) << 4,
+        temperature >> 12, (temperature >> 4) & 0xFF, (temperature & 0x0F) << 4
+    };
+    native_hal_i2c_set_registers(BMP280_ADDRESS, 0xF7, data, 6);
+}
+
+void native_hal_devices_init(){
+    mpu6050_init();
+    qmc5883l_init();
+    bmp280_init();
+    mpu6050_update();
+    qmc5883l_update();
+    bmp280_update();
+}
+
+void native_hal_devices_service_interrupts(uint64_t time_us){
+    mpu6050_service_interrupts(time_us);
+    qmc5883l_service_interrupts(time_us);
+}
+
+void native_hal_devices_i2c_read(uint8_t device_address, uint8_t register_address, uint8_t *data, uint16_t size){
+    switch (device_address){
+    case MPU6050_ADDRESS:
+        if(register_address == 0x74){
+            // FIFO_R_W does not auto increment, every byte comes out of the fifo
+            for(uint16_t i = 0; i < size; i++){
+                data[i] = mpu6050_fifo_pop();
+            }
+            return;
+        }
+        if(register_address <= 0x73 && register_address + size > 0x72){
+            uint8_t count[2] = {m_mpu6050_fifo_count >> 8, m_mpu6050_fifo_count & 0xFF};
+            native_hal_i2c_set_registers(MPU6050_ADDRESS, 0x72, count, 2);
+        }
+        if(register_address >= 0x3B && register_address <= 0x48) mpu6050_update();
+        break;
+    case BMP280_ADDRESS:
+        if(register_address >= 0xF7 && register_address <= 0xFC) bmp280_update();
+        break;
+    }
+
+    native_hal_i2c_get_registers(device_address, register_address, data, size);
+
+    // Reading any of the qmc5883l data registers clears DRDY and DOR
+    if(device_address == QMC5883L_ADDRESS && register_address <= 0x05){
+        uint8_t status;
+        native_hal_i2c_get_registers(QMC5883L_ADDRESS, 0x06, &status, 1);
+        status &= ~0b00000101;
+        native_hal_i2c_set_registers(QMC5883L_ADDRESS, 0x06, &status, 1);
+    }
+}
+
+void native_hal_devices_i2c_write(uint8_t device_address, uint8_t register_address, const uint8_t *data, uint16_t size){
+    native_hal_i2c_set_registers(device_address, register_address, data, size);
+
+    // USER_CTRL FIFO_RESET clears itself
+    if(device_address == MPU6050_ADDRESS && register_address == 0x6A && (data[0] & 0x04)){
+        m_mpu6050_fifo_start = 0;
+        m_mpu6050_fifo_count = 0;
+        uint8_t user_control = data[0] & ~0x04;
+        native_hal_i2c_set_registers(MPU6050_ADDRESS, 0x6A, &user_control, 1);
+    }
+}
+
+// nrf24 ################################################################################################
+// Register reads and writes behave like the real chip. Nothing is ever received.
+
+static uint8_t m_nrf24_registers[32];
+static uint8_t m_nrf24_selected = 0;
+static int16_t m_nrf24_command = -1;
+static uint8_t m_nrf24_register_index = 0;
+
+void native_hal_spi_device_select(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state){
+    if(port != NRF24_CS_PORT || pin != NRF24_CS_PIN){
+        return;
+    }
+    m_nrf24_selected = state == GPIO_PIN_RESET;
+    m_nrf24_command = -1;
+    m_nrf24_register_index = 0;
+}
+
+void native_hal_spi_device_transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size){
+    if(!m_nrf24_selected || size == 0){
+        return;
+    }
+
+    uint16_t i = 0;
+    if(m_nrf24_command == -1){
+        m_nrf24_command = data[0];
+        m_nrf24_register_index = data[0] & 0x1F;
+        i = 1;
+    }
+
+    // W_REGISTER
+    if((m_nrf24_command & 0xE0) == 0x20){
+        for(; i < size; i++){
+            m_nrf24_registers[m_nrf24_register_index++ & 0x1F] = data[i];
+        }
+    }
+}
+
+void native_hal_spi_device_receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size){
+    memset(data, 0, size);
+    if(!m_nrf24_selected){
+        return;
+    }
+
+    // R_REGISTER
+    if(m_nrf24_command >= 0 && (m_nrf24_command & 0xE0) == 0x00){
+        for(uint16_t i = 0; i < size; i++){
+            data[i] = m_nrf24_registers[m_nrf24_register_index++ & 0x1F];
+        }
+    }
+}
@@ -0,0 +1,516 @@
+#pragma once
+
+// Fake of the STM32Cube HAL that is used for the [env:native] build.
+// Only the parts that the flight code actually touches are here. Registers are plain
+// structs in ram, I2C and SPI talk to simulated devices in native_hal_devices.c and time
+// comes from the workstation clock. Never add this library to the stm32 environment.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef NATIVE
+#define NATIVE
+#endif
+
+#ifndef __IO
+#define __IO volatile
+#endif
+
+// Status ##############################################################################################
+typedef enum {
+    HAL_OK       = 0x00U,
+    HAL_ERROR    = 0x01U,
+    HAL_BUSY     = 0x02U,
+    HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum {
+    RESET = 0U,
+    SET = !RESET
+} FlagStatus, ITStatus;
+
+#define UNUSED(X) (void)X
+
+// Cortex #############################################################################################
+typedef enum {
+    NonMaskableInt_IRQn = -14,
+    SysTick_IRQn        = -1,
+    EXTI0_IRQn          = 6,
+    EXTI1_IRQn          = 7,
+    EXTI2_IRQn          = 8,
+    EXTI3_IRQn          = 9,
+    EXTI4_IRQn          = 10,
+    DMA1_Stream0_IRQn   = 11,
+    DMA1_Stream5_IRQn   = 16,
+    DMA1_Stream6_IRQn   = 17,
+    EXTI9_5_IRQn        = 23,
+    TIM1_UP_TIM10_IRQn  = 25,
+    TIM2_IRQn           = 28,
+    I2C1_EV_IRQn        = 31,
+    I2C1_ER_IRQn        = 32,
+    USART2_IRQn         = 38,
+    EXTI15_10_IRQn      = 40,
+    DMA1_Stream7_IRQn   = 47,
+    TIM5_IRQn           = 50,
+} IRQn_Type;
+
+// Interrupts are emulated. Completed transfers are delivered from HAL_GetTick and __enable_irq
+void native_hal_disable_irq(void);
+void native_hal_enable_irq(void);
+static inline void __disable_irq(void){ native_hal_disable_irq(); }
+static inline void __enable_irq(void){ native_hal_enable_irq(); }
+uint32_t native_hal_get_primask(void);
+static inline uint32_t __get_PRIMASK(void){ return native_hal_get_primask(); }
+static inline void __DSB(void){}
+static inline void __ISB(void){}
+static inline void __NOP(void){}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+
+// Debug watchpoint and trace unit. Reading DWT refreshes CYCCNT from the workstation clock
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+    __IO uint32_t LAR;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+DWT_Type *native_hal_dwt(void);
+extern CoreDebug_Type native_hal_core_debug;
+
+#define DWT (native_hal_dwt())
+#define CoreDebug (&native_hal_core_debug)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+extern uint32_t SystemCoreClock;
+
+// GPIO ###############################################################################################
+typedef struct {
+    __IO uint32_t MODER;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    __IO uint32_t BSRR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef native_hal_gpioa, native_hal_gpiob, native_hal_gpioc, native_hal_gpioh;
+#define GPIOA (&native_hal_gpioa)
+#define GPIOB (&native_hal_gpiob)
+#define GPIOC (&native_hal_gpioc)
+#define GPIOH (&native_hal_gpioh)
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+    uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_PIN_0   ((uint16_t)0x0001)
+#define GPIO_PIN_1   ((uint16_t)0x0002)
+#define GPIO_PIN_2   ((uint16_t)0x0004)
+#define GPIO_PIN_3   ((uint16_t)0x0008)
+#define GPIO_PIN_4   ((uint16_t)0x0010)
+#define GPIO_PIN_5   ((uint16_t)0x0020)
+#define GPIO_PIN_6   ((uint16_t)0x0040)
+#define GPIO_PIN_7   ((uint16_t)0x0080)
+#define GPIO_PIN_8   ((uint16_t)0x0100)
+#define GPIO_PIN_9   ((uint16_t)0x0200)
+#define GPIO_PIN_10  ((uint16_t)0x0400)
+#define GPIO_PIN_11  ((uint16_t)0x0800)
+#define GPIO_PIN_12  ((uint16_t)0x1000)
+#define GPIO_PIN_13  ((uint16_t)0x2000)
+#define GPIO_PIN_14  ((uint16_t)0x4000)
+#define GPIO_PIN_15  ((uint16_t)0x8000)
+
+#define GPIO_MODE_INPUT        0x00000000U
+#define GPIO_MODE_OUTPUT_PP    0x00000001U
+#define GPIO_MODE_OUTPUT_OD    0x00000011U
+#define GPIO_MODE_AF_PP        0x00000002U
+#define GPIO_MODE_AF_OD        0x00000012U
+#define GPIO_MODE_IT_RISING    0x10110000U
+#define GPIO_MODE_IT_FALLING   0x10210000U
+#define GPIO_NOPULL            0x00000000U
+#define GPIO_PULLUP            0x00000001U
+#define GPIO_PULLDOWN          0x00000002U
+#define GPIO_SPEED_FREQ_LOW        0x00000000U
+#define GPIO_SPEED_FREQ_MEDIUM     0x00000001U
+#define GPIO_SPEED_FREQ_HIGH       0x00000002U
+#define GPIO_SPEED_FREQ_VERY_HIGH  0x00000003U
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_IRQHandler(uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+
+// RCC, PWR and FLASH ##################################################################################
+typedef struct {
+    uint32_t PLLState;
+    uint32_t PLLSource;
+    uint32_t PLLM;
+    uint32_t PLLN;
+    uint32_t PLLP;
+    uint32_t PLLQ;
+} RCC_PLLInitTypeDef;
+
+typedef struct {
+    uint32_t OscillatorType;
+    uint32_t HSEState;
+    uint32_t LSEState;
+    uint32_t HSIState;
+    uint32_t HSICalibrationValue;
+    uint32_t LSIState;
+    RCC_PLLInitTypeDef PLL;
+} RCC_OscInitTypeDef;
+
+typedef struct {
+    uint32_t ClockType;
+    uint32_t SYSCLKSource;
+    uint32_t AHBCLKDivider;
+    uint32_t APB1CLKDivider;
+    uint32_t APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+
+#define RCC_OSCILLATORTYPE_HSE  0x00000001U
+#define RCC_HSE_ON              0x00010000U
+#define RCC_PLL_ON              0x00000002U
+#define RCC_PLLSOURCE_HSE       0x00400000U
+#define RCC_PLLP_DIV2           0x00000002U
+#define RCC_CLOCKTYPE_SYSCLK    0x00000001U
+#define RCC_CLOCKTYPE_HCLK      0x00000002U
+#define RCC_CLOCKTYPE_PCLK1     0x00000004U
+#define RCC_CLOCKTYPE_PCLK2     0x00000008U
+#define RCC_SYSCLKSOURCE_PLLCLK 0x00000002U
+#define RCC_SYSCLK_DIV1         0x00000000U
+#define RCC_HCLK_DIV1           0x00000000U
+#define RCC_HCLK_DIV2           0x00001000U
+#define FLASH_LATENCY_2         0x00000002U
+#define PWR_REGULATOR_VOLTAGE_SCALE1 0x0000C000U
+
+// Flash is a block of memory on the workstation. Starts erased on every run, programming can only clear bits
+typedef struct {
+    uint32_t TypeErase;
+    uint32_t Banks;
+    uint32_t Sector;
+    uint32_t NbSectors;
+    uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_SECTORS 0x00000000U
+#define FLASH_TYPEPROGRAM_BYTE  0x00000000U
+#define FLASH_TYPEPROGRAM_WORD  0x00000002U
+#define FLASH_VOLTAGE_RANGE_3   0x00000002U
+#define FLASH_SECTOR_7          7U
+
+uint8_t *native_hal_flash_memory(void);
+#define FLASH_BASE ((uintptr_t)native_hal_flash_memory())
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uintptr_t Address, uint64_t Data);
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+
+#define __HAL_RCC_PWR_CLK_ENABLE()    do {} while(0)
+#define __HAL_RCC_SYSCFG_CLK_ENABLE() do {} while(0)
+#define __HAL_RCC_GPIOA_CLK_ENABLE()  do {} while(0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE()  do {} while(0)
+#define __HAL_RCC_GPIOC_CLK_ENABLE()  do {} while(0)
+#define __HAL_RCC_GPIOH_CLK_ENABLE()  do {} while(0)
+#define __HAL_RCC_DMA1_CLK_ENABLE()   do {} while(0)
+#define __HAL_RCC_I2C1_CLK_ENABLE()   do {} while(0)
+#define __HAL_RCC_TIM1_CLK_ENABLE()   do {} while(0)
+#define __HAL_RCC_TIM2_CLK_ENABLE()   do {} while(0)
+#define __HAL_RCC_TIM5_CLK_ENABLE()   do {} while(0)
+#define __HAL_PWR_VOLTAGESCALING_CONFIG(__REGULATOR__) do {} while(0)
+
+// DMA ################################################################################################
+typedef struct {
+    uint32_t Channel;
+    uint32_t Direction;
+    uint32_t PeriphInc;
+    uint32_t MemInc;
+    uint32_t PeriphDataAlignment;
+    uint32_t MemDataAlignment;
+    uint32_t Mode;
+    uint32_t Priority;
+    uint32_t FIFOMode;
+} DMA_InitTypeDef;
+
+typedef struct {
+    void *Instance;
+    DMA_InitTypeDef Init;
+} DMA_HandleTypeDef;
+
+#define DMA_IT_HT 0x00000008U
+#define __HAL_DMA_DISABLE_IT(__HANDLE__, __INTERRUPT__) do { (void)(__HANDLE__); } while(0)
+
+// I2C ################################################################################################
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t SR1;
+} I2C_TypeDef;
+
+typedef struct {
+    uint32_t ClockSpeed;
+    uint32_t DutyCycle;
+    uint32_t OwnAddress1;
+    uint32_t AddressingMode;
+    uint32_t DualAddressMode;
+    uint32_t OwnAddress2;
+    uint32_t GeneralCallMode;
+    uint32_t NoStretchMode;
+} I2C_InitTypeDef;
+
+typedef struct {
+    I2C_TypeDef *Instance;
+    I2C_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmarx;
+    __IO uint32_t State;
+    __IO uint32_t ErrorCode;
+} I2C_HandleTypeDef;
+
+extern I2C_TypeDef native_hal_i2c1;
+#define I2C1 (&native_hal_i2c1)
+
+#define I2C_DUTYCYCLE_2            0x00000000U
+#define I2C_ADDRESSINGMODE_7BIT    0x00004000U
+#define I2C_DUALADDRESS_DISABLE    0x00000000U
+#define I2C_GENERALCALL_DISABLE    0x00000000U
+#define I2C_NOSTRETCH_DISABLE      0x00000000U
+#define I2C_MEMADD_SIZE_8BIT       0x00000001U
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+// SPI ################################################################################################
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t DR;
+} SPI_TypeDef;
+
+typedef struct {
+    uint32_t Mode;
+    uint32_t Direction;
+    uint32_t DataSize;
+    uint32_t CLKPolarity;
+    uint32_t CLKPhase;
+    uint32_t NSS;
+    uint32_t BaudRatePrescaler;
+    uint32_t FirstBit;
+    uint32_t TIMode;
+    uint32_t CRCCalculation;
+    uint32_t CRCPolynomial;
+} SPI_InitTypeDef;
+
+typedef enum {
+    HAL_SPI_STATE_RESET = 0x00U,
+    HAL_SPI_STATE_READY = 0x01U,
+    HAL_SPI_STATE_BUSY  = 0x02U
+} HAL_SPI_StateTypeDef;
+
+typedef struct {
+    SPI_TypeDef *Instance;
+    SPI_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmatx;
+} SPI_HandleTypeDef;
+
+extern SPI_TypeDef native_hal_spi1, native_hal_spi3;
+#define SPI1 (&native_hal_spi1)
+#define SPI3 (&native_hal_spi3)
+
+#define SPI_MODE_MASTER              0x00000104U
+#define SPI_DIRECTION_2LINES         0x00000000U
+#define SPI_DATASIZE_8BIT            0x00000000U
+#define SPI_POLARITY_LOW             0x00000000U
+#define SPI_POLARITY_HIGH            0x00000002U
+#define SPI_PHASE_1EDGE              0x00000000U
+#define SPI_PHASE_2EDGE              0x00000001U
+#define SPI_NSS_SOFT                 0x00000200U
+#define SPI_BAUDRATEPRESCALER_4      0x00000008U
+#define SPI_BAUDRATEPRESCALER_128    0x00000030U
+#define SPI_FIRSTBIT_MSB             0x00000000U
+#define SPI_TIMODE_DISABLE           0x00000000U
+#define SPI_CRCCALCULATION_DISABLE   0x00000000U
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size);
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi);
+
+// TIM ################################################################################################
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CNT;
+    __IO uint32_t PSC;
+    __IO uint32_t ARR;
+    __IO uint32_t CCR1;
+    __IO uint32_t CCR2;
+    __IO uint32_t CCR3;
+    __IO uint32_t CCR4;
+} TIM_TypeDef;
+
+typedef struct {
+    uint32_t Prescaler;
+    uint32_t CounterMode;
+    uint32_t Period;
+    uint32_t ClockDivision;
+    uint32_t RepetitionCounter;
+    uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct {
+    TIM_TypeDef *Instance;
+    TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+typedef struct {
+    uint32_t ClockSource;
+    uint32_t ClockPolarity;
+    uint32_t ClockPrescaler;
+    uint32_t ClockFilter;
+} TIM_ClockConfigTypeDef;
+
+typedef struct {
+    uint32_t MasterOutputTrigger;
+    uint32_t MasterSlaveMode;
+} TIM_MasterConfigTypeDef;
+
+typedef struct {
+    uint32_t OCMode;
+    uint32_t Pulse;
+    uint32_t OCPolarity;
+    uint32_t OCNPolarity;
+    uint32_t OCFastMode;
+    uint32_t OCIdleState;
+    uint32_t OCNIdleState;
+} TIM_OC_InitTypeDef;
+
+typedef struct {
+    uint32_t OffStateRunMode;
+    uint32_t OffStateIDLEMode;
+    uint32_t LockLevel;
+    uint32_t DeadTime;
+    uint32_t BreakState;
+    uint32_t BreakPolarity;
+    uint32_t BreakFilter;
+    uint32_t AutomaticOutput;
+} TIM_BreakDeadTimeConfigTypeDef;
+
+extern TIM_TypeDef native_hal_tim1, native_hal_tim2, native_hal_tim5;
+#define TIM1 (&native_hal_tim1)
+#define TIM2 (&native_hal_tim2)
+#define TIM5 (&native_hal_tim5)
+
+#define TIM_COUNTERMODE_UP            0x00000000U
+#define TIM_CLOCKDIVISION_DIV1        0x00000000U
+#define TIM_AUTORELOAD_PRELOAD_DISABLE 0x00000000U
+#define TIM_CLOCKSOURCE_INTERNAL      0x00001000U
+#define TIM_TRGO_RESET                0x00000000U
+#define TIM_MASTERSLAVEMODE_DISABLE   0x00000000U
+#define TIM_OCMODE_PWM1               0x00000060U
+#define TIM_OCPOLARITY_HIGH           0x00000000U
+#define TIM_OCNPOLARITY_HIGH          0x00000000U
+#define TIM_OCFAST_DISABLE            0x00000000U
+#define TIM_OCIDLESTATE_RESET         0x00000000U
+#define TIM_OCNIDLESTATE_RESET        0x00000000U
+#define TIM_OSSR_DISABLE              0x00000000U
+#define TIM_OSSI_DISABLE              0x00000000U
+#define TIM_LOCKLEVEL_OFF             0x00000000U
+#define TIM_BREAK_DISABLE             0x00000000U
+#define TIM_BREAKPOLARITY_HIGH        0x00000000U
+#define TIM_AUTOMATICOUTPUT_DISABLE   0x00000000U
+#define TIM_CHANNEL_1                 0x00000000U
+#define TIM_CHANNEL_2                 0x00000004U
+#define TIM_CHANNEL_3                 0x00000008U
+#define TIM_CHANNEL_4                 0x0000000CU
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef *htim, TIM_ClockConfigTypeDef *sClockSourceConfig);
+HAL_StatusTypeDef HAL_TIM_PWM_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef *sConfig, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef *htim, TIM_MasterConfigTypeDef *sMasterConfig);
+HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef *htim, TIM_BreakDeadTimeConfigTypeDef *sBreakDeadTimeConfig);
+void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
+
+// The counter of a running timer is derived from the workstation clock and the prescaler
+uint32_t native_hal_tim_get_counter(TIM_HandleTypeDef *htim);
+#define __HAL_TIM_GET_COUNTER(__HANDLE__) native_hal_tim_get_counter(__HANDLE__)
+#define __HAL_TIM_SET_COUNTER(__HANDLE__, __COUNTER__) ((__HANDLE__)->Instance->CNT = (__COUNTER__))
+
+// UART ###############################################################################################
+typedef struct {
+    __IO uint32_t SR;
+    __IO uint32_t DR;
+} USART_TypeDef;
+
+typedef struct {
+    uint32_t BaudRate;
+    uint32_t WordLength;
+    uint32_t StopBits;
+    uint32_t Parity;
+    uint32_t Mode;
+    uint32_t HwFlowCtl;
+    uint32_t OverSampling;
+} UART_InitTypeDef;
+
+typedef struct {
+    USART_TypeDef *Instance;
+    UART_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmarx;
+} UART_HandleTypeDef;
+
+extern USART_TypeDef native_hal_usart1, native_hal_usart2;
+#define USART1 (&native_hal_usart1)
+#define USART2 (&native_hal_usart2)
+
+#define UART_WORDLENGTH_8B      0x00000000U
+#define UART_STOPBITS_1         0x00000000U
+#define UART_PARITY_NONE        0x00000000U
+#define UART_MODE_TX_RX         0x0000000CU
+#define UART_HWCONTROL_NONE     0x00000000U
+#define UART_OVERSAMPLING_16    0x00000000U
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_DeInit(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+// Core ###############################################################################################
+HAL_StatusTypeDef HAL_Init(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+// printf retargeting is a no op, stdout is already the terminal
+void RetargetInit(UART_HandleTypeDef *huart);
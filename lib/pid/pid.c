@@ -7,7 +7,10 @@
  * @param gain_integral 
  * @param gain_derivative 
  * @param desired_value value that you want to achieve
- * @param time the current time in ticks. Stm32 tick
+ * @param time the current time in microseconds, from the timebase
+ * @param max_value the output stays below this. Set max and min both to 0 for no limit
+ * @param min_value the output stays above this
+ * @param stop_windup also keep the integral on its own between min and max
  * @return struct pid 
  */
 struct pid pid_init(
@@ -25,92 +28,104 @@ struct pid pid_init(
     new_pid.m_gain_proportional = gain_proportional;
     new_pid.m_gain_integral = gain_integral;
     new_pid.m_gain_derivative = gain_derivative;
-    new_pid.m_integral_sum = 0;
-    new_pid.m_last_error = 0;
     new_pid.m_desired_value = desired_value;
-    new_pid.m_previous_time = time;
     new_pid.m_max_value = max_value;
     new_pid.m_min_value = min_value;
     new_pid.m_stop_windup = stop_windup;
-    new_pid.m_last_proportional_error = 0;
-    new_pid.m_last_integral_error = 0;
-    new_pid.m_last_derivative_error = 0;
+    new_pid.m_derivative_filter_rc = 0;
+    new_pid.m_saturated = 0;
+    pid_reset(&new_pid, time);
 
     return new_pid;
 }
 
+static float clamp(float value, float min_value, float max_value){
+    return value > max_value ? max_value : (value < min_value ? min_value : value);
+}
 
-/**
- * @brief Calculate the error based on the configuration of the pid and the new value
- * 
- * @param pid_instance pid config
- * @param value current value that the error will be calculated for 
- * @param time current time in ticks. Stm32 tick 
- * @return float error result
- */
-float pid_get_error(struct pid* pid_instance, float value, uint32_t time){
-
-    float error_p = 0, error_i = 0, error_d = 0;
-
-    float error = (pid_instance->m_desired_value - value);
-
-    float elapsed_time_sec = ((float)time-(float)pid_instance->m_previous_time)/1000.0;
+// Everything goes through here. measurement is only used for the derivative, so a change of the
+// desired value does not kick the output
+static float update(struct pid* pid_instance, float error, float measurement, float dt){
+    if(dt <= 0.0f){
+        return pid_instance->m_last_output; // Same time as the last call, nothing new to say
+    }
+    uint8_t limited = pid_instance->m_max_value > pid_instance->m_min_value;
 
     // proportional
-    {
-        error_p = error;
+    float proportional = pid_instance->m_gain_proportional * error;
+
+    // derivative of the measurement through a low pass, the first call has nothing to compare to
+    float rate = pid_instance->m_has_last_measurement ? (pid_instance->m_last_measurement - measurement) / dt : 0.0f;
+    pid_instance->m_last_measurement = measurement;
+    pid_instance->m_has_last_measurement = 1;
+    pid_instance->m_filtered_derivative += (rate - pid_instance->m_filtered_derivative) * dt / (dt + pid_instance->m_derivative_filter_rc);
+    float derivative = pid_instance->m_gain_derivative * pid_instance->m_filtered_derivative;
+
+    // integral. It does not grow further into a limit of the output, and only shrinks while the mixer is saturated
+    float integral_step = pid_instance->m_gain_integral * error * dt;
+    float output = proportional + pid_instance->m_integral_sum + integral_step + derivative;
+    uint8_t hold_integral =
+        (limited && ((output > pid_instance->m_max_value && integral_step > 0.0f) || (output < pid_instance->m_min_value && integral_step < 0.0f))) ||
+        (pid_instance->m_saturated && integral_step * pid_instance->m_integral_sum > 0.0f);
+    if(!hold_integral){
+        pid_instance->m_integral_sum += integral_step;
     }
-
-    // integral
-    {
-        pid_instance->m_integral_sum += (error * elapsed_time_sec);
-
-        if(pid_instance->m_stop_windup == 1){
-            // clamp the integral if it is getting out of bounds
-            if((pid_instance->m_integral_sum * pid_instance->m_gain_integral) > pid_instance->m_max_value){
-                pid_instance->m_integral_sum = pid_instance->m_max_value / pid_instance->m_gain_integral;
-            }else if(pid_instance->m_integral_sum * pid_instance->m_gain_integral < pid_instance->m_min_value){
-                pid_instance->m_integral_sum = pid_instance->m_min_value / pid_instance->m_gain_integral;
-            }
-        }
-        error_i = pid_instance->m_integral_sum;
+    if(pid_instance->m_stop_windup == 1){
+        pid_instance->m_integral_sum = clamp(pid_instance->m_integral_sum, pid_instance->m_min_value, pid_instance->m_max_value);
     }
 
-    // derivative
-    {
-        // divide by the time passed
-        error_d = (error_p - pid_instance->m_last_error) / elapsed_time_sec;
-
-        // Dont let it get out of bounds 
-        if(error_d > pid_instance->m_max_value){
-            error_d = pid_instance->m_max_value;
-        }else if(error_d < pid_instance->m_min_value){
-            error_d = pid_instance->m_min_value;
-        }
-        
-        // set the previous error for the next iteration
-        pid_instance->m_last_error = error;
+    output = proportional + pid_instance->m_integral_sum + derivative;
+    if(limited){
+        output = clamp(output, pid_instance->m_min_value, pid_instance->m_max_value);
     }
 
+    pid_instance->m_last_error = error;
+    pid_instance->m_last_proportional_error = proportional;
+    pid_instance->m_last_integral_error = pid_instance->m_integral_sum;
+    pid_instance->m_last_derivative_error = derivative;
+    pid_instance->m_last_output = output;
+    return output;
+}
 
-    pid_instance->m_last_proportional_error = pid_instance->m_gain_proportional * error_p;
-    pid_instance->m_last_integral_error = pid_instance->m_gain_integral * error_i;
-    pid_instance->m_last_derivative_error = pid_instance->m_gain_derivative * error_d;
-    // printf("p: %8.4f, ", pid_instance->m_gain_proportional * error_p);
-    // printf("i: %8.4f, ", pid_instance->m_gain_integral * error_i);
-    // printf("d: %8.4f, ", pid_instance->m_gain_derivative * error_d);
-
-    // printf("%8.4f, %8.4f, %8.4f, ", pid_instance->m_gain_proportional * error_p, pid_instance->m_gain_integral * error_i, pid_instance->m_gain_derivative * error_d);
-
+/**
+ * @brief Calculate the output for a new value
+ * 
+ * @param pid_instance pid config
+ * @param value current value, the error is the desired value minus this
+ * @param dt seconds since the last update
+ * @return float output
+ */
+float pid_update(struct pid* pid_instance, float value, float dt){
+    return update(pid_instance, pid_instance->m_desired_value - value, value, dt);
+}
 
-    // end result
-    float total_error = (pid_instance->m_gain_proportional * error_p) + 
-                (pid_instance->m_gain_integral * error_i) + 
-                (pid_instance->m_gain_derivative * error_d) ;
+/**
+ * @brief Calculate the output for an error worked out by the caller, like the short way around a circle.
+ * There is no measurement, so unlike pid_update the derivative stays on the error and a step of the
+ * desired value does kick it. A measurement that wraps (the heading at +-180) would kick it at every wrap
+ * instead. Keep the derivative gain low, or at 0 like the yaw heading pid
+ * 
+ * @param pid_instance pid config
+ * @param error your own calculated error
+ * @param dt seconds since the last update
+ * @return float output
+ */
+float pid_update_own_error(struct pid* pid_instance, float error, float dt){
+    return update(pid_instance, error, -error, dt);
+}
 
-    // save the time for next calculation
+/**
+ * @brief Calculate the error based on the configuration of the pid and the new value
+ * 
+ * @param pid_instance pid config
+ * @param value current value that the error will be calculated for 
+ * @param time current time in microseconds, from the timebase
+ * @return float error result
+ */
+float pid_get_error(struct pid* pid_instance, float value, uint32_t time){
+    float elapsed_time_sec = (float)(time - pid_instance->m_previous_time) / 1000000.0f; // unsigned so the wrap of the timer does not matter
     pid_instance->m_previous_time = time;
-    return total_error;
+    return pid_update(pid_instance, value, elapsed_time_sec);
 }
 
 
@@ -118,65 +133,14 @@ float pid_get_error(struct pid* pid_instance, float value, uint32_t time){
  * @brief Calculate the error based on the configuration of the pid and the new value
  * 
  * @param pid_instance pid config
- * @param error your own calculated error that will be used to get pid error
- * @param time current time in ticks. Stm32 tick 
+ * @param error your own calculated error that will be used to get pid error, the derivative is of it like in pid_update_own_error
+ * @param time current time in microseconds, from the timebase
  * @return float error result
  */
 float pid_get_error_own_error(struct pid* pid_instance, float error, uint32_t time){
-
-    float error_p = 0, error_i = 0, error_d = 0;
-
-    float elapsed_time_sec = ((float)time-(float)pid_instance->m_previous_time)/1000.0;
-
-    // proportional
-    {
-        error_p = error;
-    }
-
-    // integral
-    {
-        pid_instance->m_integral_sum += (error * elapsed_time_sec);
-
-        if(pid_instance->m_stop_windup == 1){
-            // clamp the integral if it is getting out of bounds
-            if((pid_instance->m_integral_sum * pid_instance->m_gain_integral) > pid_instance->m_max_value){
-                pid_instance->m_integral_sum = pid_instance->m_max_value / pid_instance->m_gain_integral;
-            }else if(pid_instance->m_integral_sum * pid_instance->m_gain_integral < pid_instance->m_min_value){
-                pid_instance->m_integral_sum = pid_instance->m_min_value / pid_instance->m_gain_integral;
-            }
-        }
-        error_i = pid_instance->m_integral_sum;
-    }
-
-    // derivative
-    {
-        // divide by the time passed
-        error_d = (error_p - pid_instance->m_last_error) / elapsed_time_sec;
-
-        // Dont let it get out of bounds 
-        if(error_d > pid_instance->m_max_value){
-            error_d = pid_instance->m_max_value;
-        }else if(error_d < pid_instance->m_min_value){
-            error_d = pid_instance->m_min_value;
-        }
-        
-        // set the previous error for the next iteration
-        pid_instance->m_last_error = error;
-    }
-
-
-    // printf("p: %8.4f, ", pid_instance->m_gain_proportional * error_p);
-    // printf("i: %8.4f, ", pid_instance->m_gain_integral * error_i);
-    // printf("d: %8.4f, ", pid_instance->m_gain_derivative * error_d);
-
-    // end result
-    float total_error = (pid_instance->m_gain_proportional * error_p) + 
-                (pid_instance->m_gain_integral * error_i) + 
-                (pid_instance->m_gain_derivative * error_d) ;
-
-    // save the time for next calculation
+    float elapsed_time_sec = (float)(time - pid_instance->m_previous_time) / 1000000.0f; // unsigned so the wrap of the timer does not matter
     pid_instance->m_previous_time = time;
-    return total_error;
+    return pid_update_own_error(pid_instance, error, elapsed_time_sec);
 }
 
 /**
@@ -201,6 +165,45 @@ void pid_set_derivative_gain(struct pid* pid_instance, float derivative_gain){
     pid_instance->m_gain_derivative = derivative_gain;
 }
 
+/**
+ * @brief Low pass on the derivative, it is the noisiest part
+ * 
+ * @param pid_instance pid config
+ * @param cutoff_hz 0 to turn it off
+ */
+void pid_set_derivative_filter(struct pid* pid_instance, float cutoff_hz){
+    pid_instance->m_derivative_filter_rc = cutoff_hz > 0.0f ? 1.0f / (6.2831853f * cutoff_hz) : 0.0f;
+}
+
+/**
+ * @brief Tell the pid the motors could not do what it asked last time. Stops the integral from winding up
+ * 
+ * @param pid_instance pid config
+ * @param saturated 1 while any motor is at its limit
+ */
+void pid_set_saturated(struct pid* pid_instance, uint8_t saturated){
+    pid_instance->m_saturated = saturated;
+}
+
+/**
+ * @brief Forget the integral and the derivative history, for when the pid has not run for a while
+ * 
+ * @param pid_instance pid config
+ * @param time current time in microseconds, from the timebase
+ */
+void pid_reset(struct pid* pid_instance, uint32_t time){
+    pid_instance->m_integral_sum = 0;
+    pid_instance->m_last_error = 0;
+    pid_instance->m_previous_time = time;
+    pid_instance->m_last_proportional_error = 0;
+    pid_instance->m_last_integral_error = 0;
+    pid_instance->m_last_derivative_error = 0;
+    pid_instance->m_last_output = 0;
+    pid_instance->m_last_measurement = 0;
+    pid_instance->m_has_last_measurement = 0;
+    pid_instance->m_filtered_derivative = 0;
+}
+
 void pid_reset_integral_sum(struct pid* pid_instance){
     pid_instance->m_integral_sum = 0;
 }
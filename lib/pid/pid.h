@@ -5,7 +5,7 @@ struct pid{
     float m_gain_proportional;
     float m_gain_integral;
     float m_gain_derivative;
-    float m_integral_sum;
+    float m_integral_sum; // Already multiplied by the integral gain, so it is in output units
     float m_last_error;
     float m_desired_value;
     uint32_t m_previous_time;
@@ -15,26 +15,37 @@ struct pid{
     float m_last_proportional_error;
     float m_last_integral_error;
     float m_last_derivative_error;
+    float m_last_output;
+    float m_last_measurement;
+    uint8_t m_has_last_measurement;
+    float m_derivative_filter_rc; // 1 / (2 pi cutoff), 0 leaves the derivative unfiltered. Not a filter_chain, dt changes every update
+    float m_filtered_derivative;
+    uint8_t m_saturated; // Set from the mixer, the integral can only shrink while it is
 };
 
 struct pid pid_init(
-    float gain_proportional, 
-    float gain_integral, 
-    float gain_derivative, 
+    float gain_proportional,
+    float gain_integral,
+    float gain_derivative,
     float desired_value,
     uint32_t time,
     float max_value,
     float min_value,
     uint8_t stop_windup
 );
+float pid_update(struct pid* pid_instance, float value, float dt);
+float pid_update_own_error(struct pid* pid_instance, float error, float dt);
 float pid_get_error(struct pid* pid_instance, float value, uint32_t time);
 float pid_get_error_own_error(struct pid* pid_instance, float error, uint32_t time);
 void pid_set_desired_value(struct pid* pid_instance, float value);
 void pid_set_proportional_gain(struct pid* pid_instance, float proportional_gain);
 void pid_set_integral_gain(struct pid* pid_instance, float integral_gain);
 void pid_set_derivative_gain(struct pid* pid_instance, float derivative_gain);
+void pid_set_derivative_filter(struct pid* pid_instance, float cutoff_hz);
+void pid_set_saturated(struct pid* pid_instance, uint8_t saturated);
+void pid_reset(struct pid* pid_instance, uint32_t time);
 void pid_reset_integral_sum(struct pid* pid_instance);
 void pid_set_previous_time(struct pid* pid_instance, uint32_t time);
 float pid_get_last_proportional_error(struct pid* pid_instance);
 float pid_get_last_integral_error(struct pid* pid_instance);
-float pid_get_last_derivative_error(struct pid* pid_instance);
\ No newline at end of file
+float pid_get_last_derivative_error(struct pid* pid_instance);
@@ -0,0 +1,169 @@
+#include "./profiler.h"
+
+static struct profiler_section m_sections[PROFILER_MAX_SECTIONS];
+static uint8_t m_section_count = 0;
+
+static uint32_t m_expected_loop_period_us = 0;
+static uint32_t m_loop_histogram[PROFILER_HISTOGRAM_BINS];
+static uint32_t m_last_loop_period_us = 0;
+static uint32_t m_min_loop_period_us = 0;
+static uint32_t m_max_loop_period_us = 0;
+static uint64_t m_total_loop_period_us = 0;
+static uint32_t m_loop_count = 0;
+
+uint8_t init_profiler(uint32_t expected_loop_period_us)
+{
+    m_expected_loop_period_us = expected_loop_period_us;
+    m_section_count = 0;
+    profiler_reset();
+    return 1;
+}
+
+static void reset_section(struct profiler_section *section)
+{
+    section->last_cycles = 0;
+    section->min_cycles = UINT32_MAX;
+    section->max_cycles = 0;
+    section->total_cycles = 0;
+    section->count = 0;
+}
+
+// Returns the section id or -1 if there is no room. The name is not copied
+int8_t profiler_add_section(const char *name)
+{
+    if (m_section_count >= PROFILER_MAX_SECTIONS)
+    {
+        return -1;
+    }
+
+    m_sections[m_section_count].name = name;
+    reset_section(&m_sections[m_section_count]);
+    m_section_count++;
+    return m_section_count - 1;
+}
+
+void profiler_start(int8_t section)
+{
+    m_sections[section].start_cycles = timebase_get_cycles();
+}
+
+void profiler_end(int8_t section)
+{
+    struct profiler_section *current = &m_sections[section];
+    uint32_t cycles = timebase_get_cycles() - current->start_cycles;
+
+    current->last_cycles = cycles;
+    current->total_cycles += cycles;
+    current->count++;
+    if (cycles < current->min_cycles)
+    {
+        current->min_cycles = cycles;
+    }
+    if (cycles > current->max_cycles)
+    {
+        current->max_cycles = cycles;
+    }
+}
+
+// Call once per loop with the time since the previous loop started
+void profiler_record_loop_period(uint32_t period_us)
+{
+    m_last_loop_period_us = period_us;
+    m_total_loop_period_us += period_us;
+    m_loop_count++;
+    if (period_us < m_min_loop_period_us)
+    {
+        m_min_loop_period_us = period_us;
+    }
+    if (period_us > m_max_loop_period_us)
+    {
+        m_max_loop_period_us = period_us;
+    }
+
+    // Middle bin is the expected period, the ones at the ends also take everything further out
+    int32_t offset_us = (int32_t)period_us - (int32_t)m_expected_loop_period_us + PROFILER_HISTOGRAM_BIN_US / 2;
+    int32_t bin = offset_us >= 0 ? offset_us / PROFILER_HISTOGRAM_BIN_US : -((-offset_us + PROFILER_HISTOGRAM_BIN_US - 1) / PROFILER_HISTOGRAM_BIN_US);
+    bin += PROFILER_HISTOGRAM_BINS / 2;
+    if (bin < 0)
+    {
+        bin = 0;
+    }
+    else if (bin >= PROFILER_HISTOGRAM_BINS)
+    {
+        bin = PROFILER_HISTOGRAM_BINS - 1;
+    }
+    m_loop_histogram[bin]++;
+}
+
+uint32_t profiler_get_last_micros(int8_t section)
+{
+    return timebase_cycles_to_micros(m_sections[section].last_cycles);
+}
+
+uint32_t profiler_get_last_loop_period()
+{
+    return m_last_loop_period_us;
+}
+
+void profiler_reset()
+{
+    for (uint8_t i = 0; i < m_section_count; i++)
+    {
+        reset_section(&m_sections[i]);
+    }
+    for (uint8_t i = 0; i < PROFILER_HISTOGRAM_BINS; i++)
+    {
+        m_loop_histogram[i] = 0;
+    }
+    m_last_loop_period_us = 0;
+    m_min_loop_period_us = UINT32_MAX;
+    m_max_loop_period_us = 0;
+    m_total_loop_period_us = 0;
+    m_loop_count = 0;
+}
+
+// Printing over uart blocks for a long time, so the report can go out one line at a time from a slow task.
+// Returns 0 when the line number is past the end of the report
+uint8_t profiler_print_report_line(uint8_t line)
+{
+    if (line < m_section_count)
+    {
+        struct profiler_section *section = &m_sections[line];
+        uint32_t mean_cycles = section->count == 0 ? 0 : (uint32_t)(section->total_cycles / section->count);
+        printf("%-12s n %8lu min %6lu mean %6lu max %6lu us\n",
+            section->name,
+            (unsigned long)section->count,
+            (unsigned long)timebase_cycles_to_micros(section->count == 0 ? 0 : section->min_cycles),
+            (unsigned long)timebase_cycles_to_micros(mean_cycles),
+            (unsigned long)timebase_cycles_to_micros(section->max_cycles));
+        return 1;
+    }
+
+    line -= m_section_count;
+    if (line == 0)
+    {
+        printf("loop period  n %8lu min %6lu mean %6lu max %6lu us\n",
+            (unsigned long)m_loop_count,
+            (unsigned long)(m_loop_count == 0 ? 0 : m_min_loop_period_us),
+            (unsigned long)(m_loop_count == 0 ? 0 : m_total_loop_period_us / m_loop_count),
+            (unsigned long)m_max_loop_period_us);
+        return 1;
+    }
+
+    line -= 1;
+    if (line < PROFILER_HISTOGRAM_BINS)
+    {
+        int32_t bin_offset_us = ((int32_t)line - PROFILER_HISTOGRAM_BINS / 2) * PROFILER_HISTOGRAM_BIN_US;
+        printf("%s%+6ld us %8lu\n",
+            line == 0 ? "<=" : (line == PROFILER_HISTOGRAM_BINS - 1 ? ">=" : "  "),
+            (long)bin_offset_us,
+            (unsigned long)m_loop_histogram[line]);
+        return 1;
+    }
+    return 0;
+}
+
+void profiler_print_report()
+{
+    for (uint8_t line = 0; profiler_print_report_line(line); line++);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../timebase/timebase.h"
+
+// Named code sections timed with the DWT cycle counter, and a histogram of the loop period.
+// Starting and ending a section is a couple of loads and stores, it can stay in the flight code.
+// Sections have to be shorter than the cycle counter wrap, 57 seconds at 75MHz.
+
+#define PROFILER_MAX_SECTIONS 16
+#define PROFILER_HISTOGRAM_BINS 21 // Odd so the middle one is the expected loop period
+#define PROFILER_HISTOGRAM_BIN_US 100
+
+struct profiler_section{
+    const char *name;
+    uint32_t start_cycles;
+    uint32_t last_cycles;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t count;
+};
+
+uint8_t init_profiler(uint32_t expected_loop_period_us);
+int8_t profiler_add_section(const char *name);
+void profiler_start(int8_t section);
+void profiler_end(int8_t section);
+void profiler_record_loop_period(uint32_t period_us);
+uint32_t profiler_get_last_micros(int8_t section);
+uint32_t profiler_get_last_loop_period();
+void profiler_reset();
+uint8_t profiler_print_report_line(uint8_t line);
+void profiler_print_report();
@@ -11,39 +11,81 @@
 #define CONTROL2_REG 0x0A
 
 #define OUTPUT_DATA1_REG 0x00
+#define STATUS_REG 0x06
 
-I2C_HandleTypeDef *i2c_handle;
+#define STATUS_DATA_READY 0b00000001
+#define STATUS_DATA_SKIPPED 0b00000100 // A measurement came in before the last one was read
+
+#define LSB_PER_MICRO_TESLA 20 // 2 milligauss per step
+
+// Fixed point path. Readings stay in raw steps with FIXED_FRACTION_BITS below the point through both
+// calibrations, the soft iron matrix is in Q12 and the products are summed in 64 bits
+// Nothing averages or filters the magnetometer, every reading goes to the estimator on its own, so it turns into float
+// straight after the calibration
+#define FIXED_FRACTION_BITS 4
+#define FIXED_SOFT_IRON_BITS 12
+#define BENCHMARK_RUNS 1000
+
+static I2C_HandleTypeDef *i2c_handle;
+
+// Read through the i2c scheduler
+static uint8_t m_queued_data[6];
+static volatile enum t_i2c_read_state m_queued_state = I2C_READ_IDLE;
+
+// The status check that goes before the data read. Data is only read when there is something new
+static enum t_data_ready_source m_data_ready_source = DATA_READY_STATUS_REGISTER;
+static uint8_t m_status_data = 0;
+static volatile enum t_i2c_read_state m_status_state = I2C_READ_IDLE;
+static volatile uint8_t m_data_ready_pin_flag = 0;
+static volatile uint32_t m_skipped_sample_count = 0;
 
 // Storage of hard iron correction, values should be replaced by what is passed
 volatile float m_hard_iron[3] = {
     0, 0, 0};
 
-// Storage of soft iron correction, values should be replaced by what is passed
+// Storage of soft iron correction with the alignment to the board axes folded in, values should be replaced by what is passed
 volatile float m_soft_iron[3][3] = {
     {1, 0, 0},
     {0, 1, 0},
     {0, 0, 1}};
 
+// Kept so a new soft iron matrix can have the alignment folded in again
+static float m_alignment[3][3] = SENSOR_ALIGNMENT_CW0;
+
+// Last sample before any correction, for working out a new calibration
+static volatile int16_t m_raw[3] = {0, 0, 0};
+
+// Integer copies of the calibration, redone by qmc5883l_set_calibration
+static uint8_t m_use_fixed_point = 0;
+static int32_t m_fixed_hard_iron[3];
+static int32_t m_fixed_soft_iron[3][3];
+
 // max value output is at 200 Hz
-uint8_t init_qmc5883l(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, const float hard_iron[3], const float soft_iron[3][3])
+// The hard iron is taken off in the sensor axes. The soft iron matrix and then the alignment turn it into
+// board axes, both are one matrix so a sample costs the same as with the calibration alone
+uint8_t init_qmc5883l(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, const float hard_iron[3], const float soft_iron[3][3], const float alignment[3][3], enum t_output_data_rate output_data_rate, enum t_data_ready_source data_ready_source)
 {
     i2c_handle = i2c_handle_temp;
+    m_data_ready_source = data_ready_source;
 
-    // assign the correction for irons
-    if (apply_calibration)
+    for (uint8_t i = 0; i < 3; i++)
     {
-        for (uint8_t i = 0; i < 3; i++)
+        for (uint8_t k = 0; k < 3; k++)
         {
-            m_hard_iron[i] = hard_iron[i];
+            m_alignment[i][k] = alignment[i][k];
         }
+    }
 
-        for (uint8_t i = 0; i < 3; i++)
-        {
-            for (uint8_t k = 0; k < 3; k++)
-            {
-                m_soft_iron[i][k] = soft_iron[i][k];
-            }
-        }
+    // assign the correction for irons
+    const float no_hard_iron[3] = {0, 0, 0};
+    const float identity[3][3] = SENSOR_ALIGNMENT_CW0;
+    if (apply_calibration)
+    {
+        qmc5883l_set_calibration(hard_iron, soft_iron);
+    }
+    else
+    {
+        qmc5883l_set_calibration(no_hard_iron, identity);
     }
 
     // Test the sensor by reading it's id register
@@ -64,9 +106,9 @@ uint8_t init_qmc5883l(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibrat
         return 0;
     }
 
-    // Disable interrupts
+    // The DRDY pin is only driven if something listens to it
     uint8_t settings2 = 0b00000000;
-    settings2 |= INTERRUPT_PIN_DISABLED;
+    settings2 |= data_ready_source == DATA_READY_PIN ? INTERRUPT_PIN_ENABLED : INTERRUPT_PIN_DISABLED;
 
     HAL_I2C_Mem_Write(
         i2c_handle,
@@ -81,7 +123,7 @@ uint8_t init_qmc5883l(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibrat
     uint8_t settings1 = 0b00000000;
     settings1 |= OS_RATIO_512;
     settings1 |= MEASURE_SCALE_2G;
-    settings1 |= ODR_50HZ;
+    settings1 |= output_data_rate;
     settings1 |= MODE_CONTINUOUS;
 
     HAL_I2C_Mem_Write(
@@ -98,19 +140,28 @@ uint8_t init_qmc5883l(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibrat
     return 1;
 }
 
-void qmc5883l_magnetometer_readings_micro_teslas(float *data)
+static int32_t round_to_int(float value)
 {
-    uint8_t retrieved_data[] = {0, 0, 0, 0, 0, 0};
+    return (int32_t)(value + (value >= 0.0f ? 0.5f : -0.5f));
+}
 
-    HAL_I2C_Mem_Read(
-        i2c_handle,
-        QMC5883L_I2C_ID + 1,
-        OUTPUT_DATA1_REG,
-        1,
-        retrieved_data,
-        6, // read six registers in total so from 
-        100);
+// Steps times 16 in and out. The hard iron gets rounded to a sixteenth of a step, far below the noise
+static void convert_readings_fixed(int16_t X, int16_t Y, int16_t Z, int32_t *data)
+{
+    int32_t x = (int32_t)X * (1 << FIXED_FRACTION_BITS) - m_fixed_hard_iron[0];
+    int32_t y = (int32_t)Y * (1 << FIXED_FRACTION_BITS) - m_fixed_hard_iron[1];
+    int32_t z = (int32_t)Z * (1 << FIXED_FRACTION_BITS) - m_fixed_hard_iron[2];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        int64_t sum = (int64_t)m_fixed_soft_iron[i][0] * x +
+                      (int64_t)m_fixed_soft_iron[i][1] * y +
+                      (int64_t)m_fixed_soft_iron[i][2] * z;
+        data[i] = (int32_t)(sum >> FIXED_SOFT_IRON_BITS);
+    }
+}
 
+static void convert_readings_micro_teslas(uint8_t *retrieved_data, float *data)
+{
     // First is least significant and second is most significant
     int16_t X = ((int16_t)retrieved_data[1] << 8) | (int16_t)retrieved_data[0];
     int16_t Y = ((int16_t)retrieved_data[3] << 8) | (int16_t)retrieved_data[2];
@@ -119,9 +170,24 @@ void qmc5883l_magnetometer_readings_micro_teslas(float *data)
     // Convert the mag's adc value to gauss
     // ADC accuracy is 2 MilliGauss per 1 step
     // Divide by 20 to do micro teslas
-    data[0] = (float)X / 20;
-    data[1] = (float)Y / 20;
-    data[2] = (float)Z / 20;
+    m_raw[0] = X;
+    m_raw[1] = Y;
+    m_raw[2] = Z;
+
+    if (m_use_fixed_point)
+    {
+        int32_t fixed[3];
+        convert_readings_fixed(X, Y, Z, fixed);
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            data[i] = (float)fixed[i] * (1.0f / (LSB_PER_MICRO_TESLA << FIXED_FRACTION_BITS));
+        }
+        return;
+    }
+
+    data[0] = (float)X / LSB_PER_MICRO_TESLA;
+    data[1] = (float)Y / LSB_PER_MICRO_TESLA;
+    data[2] = (float)Z / LSB_PER_MICRO_TESLA;
 
     // Use the soft and hard iron calibrations
     for (uint8_t i = 0; i < 3; i++)
@@ -129,14 +195,192 @@ void qmc5883l_magnetometer_readings_micro_teslas(float *data)
         data[i] = data[i] - m_hard_iron[i];
     }
 
+    // From copies, the rows further down still need the uncorrected values
+    float x = data[0];
+    float y = data[1];
+    float z = data[2];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        data[i] = (m_soft_iron[i][0] * x) +
+                  (m_soft_iron[i][1] * y) +
+                  (m_soft_iron[i][2] * z);
+    }
+}
+
+// Replaces the iron calibration, for example with one fitted on the drone. Takes effect from the next sample
+void qmc5883l_set_calibration(const float hard_iron[3], const float soft_iron[3][3])
+{
+    float combined[3][3];
+    sensor_alignment_multiply(m_alignment, soft_iron, combined);
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_hard_iron[i] = hard_iron[i];
+        m_fixed_hard_iron[i] = round_to_int(hard_iron[i] * (LSB_PER_MICRO_TESLA << FIXED_FRACTION_BITS));
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            m_soft_iron[i][k] = combined[i][k];
+            m_fixed_soft_iron[i][k] = round_to_int(combined[i][k] * (1 << FIXED_SOFT_IRON_BITS));
+        }
+    }
+}
+
+// Sensor axes with no calibration or alignment, from the last sample that was read
+void qmc5883l_get_raw_micro_teslas(float *data)
+{
     for (uint8_t i = 0; i < 3; i++)
     {
-        data[i] = (m_soft_iron[i][0] * data[0]) +
-                  (m_soft_iron[i][1] * data[1]) +
-                  (m_soft_iron[i][2] * data[2]);
+        data[i] = (float)m_raw[i] / LSB_PER_MICRO_TESLA;
     }
 }
 
+// The readings go through the fixed point path from now on
+void qmc5883l_use_fixed_point(uint8_t enabled)
+{
+    m_use_fixed_point = enabled;
+}
+
+// Cycles per sample of the float and the fixed point conversion, and how far apart they end up
+void qmc5883l_print_benchmark()
+{
+    uint8_t saved_use_fixed_point = m_use_fixed_point;
+    int16_t saved_raw[3] = {m_raw[0], m_raw[1], m_raw[2]};
+    uint8_t retrieved_data[6] = {0x10, 0xFE, 0x20, 0x19, 0x90, 0x0E}; // -496, 6432, 3728
+    float data[3];
+    float fixed_data[3];
+
+    uint32_t cycles[2];
+    for (uint8_t fixed_point = 0; fixed_point < 2; fixed_point++)
+    {
+        m_use_fixed_point = fixed_point;
+        uint32_t start = timebase_get_cycles();
+        for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+        {
+            retrieved_data[0] = 0x10 + (i & 0x0F); // Different every time so nothing gets hoisted out of the loop
+            convert_readings_micro_teslas(retrieved_data, data);
+        }
+        cycles[fixed_point] = (timebase_get_cycles() - start) / BENCHMARK_RUNS;
+    }
+
+    m_use_fixed_point = 0;
+    convert_readings_micro_teslas(retrieved_data, data);
+    m_use_fixed_point = 1;
+    convert_readings_micro_teslas(retrieved_data, fixed_data);
+    m_use_fixed_point = saved_use_fixed_point;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        m_raw[i] = saved_raw[i];
+    }
+
+    float error = 0.0f;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        error = fmaxf(error, fabsf(data[i] - fixed_data[i]));
+    }
+
+    printf("QMC5883L reading conversion cycles float %lu, fixed point %lu\n", (unsigned long)cycles[0], (unsigned long)cycles[1]);
+    printf("QMC5883L fixed point difference %.4f uT\n", error);
+}
+
+void qmc5883l_magnetometer_readings_micro_teslas(float *data)
+{
+    uint8_t retrieved_data[] = {0, 0, 0, 0, 0, 0};
+
+    HAL_I2C_Mem_Read(
+        i2c_handle,
+        QMC5883L_I2C_ID + 1,
+        OUTPUT_DATA1_REG,
+        1,
+        retrieved_data,
+        6, // read six registers in total so from 
+        100);
+
+    convert_readings_micro_teslas(retrieved_data, data);
+}
+
+// Runs in the dma interrupt
+static void queued_read_callback(uint8_t success)
+{
+    m_queued_state = success ? I2C_READ_DONE : I2C_READ_FAILED;
+}
+
+uint8_t qmc5883l_queue_magnetometer_read()
+{
+    if(m_queued_state == I2C_READ_PENDING){
+        return 0;
+    }
+
+    m_queued_state = I2C_READ_PENDING;
+    if(!i2c_scheduler_queue_read(QMC5883L_I2C_ID, OUTPUT_DATA1_REG, m_queued_data, 6, I2C_PRIORITY_MEDIUM, queued_read_callback)){
+        m_queued_state = I2C_READ_FAILED;
+        return 0;
+    }
+    return 1;
+}
+
+// Returns 1 and the readings if the queued read finished
+uint8_t qmc5883l_get_queued_magnetometer_readings_micro_teslas(float *data)
+{
+    if(m_queued_state != I2C_READ_DONE){
+        return 0;
+    }
+
+    convert_readings_micro_teslas(m_queued_data, data);
+    m_queued_state = I2C_READ_IDLE;
+    return 1;
+}
+
+// Runs in the dma interrupt. Chains the data read right after the status when DRDY is set
+static void status_read_callback(uint8_t success)
+{
+    m_status_state = I2C_READ_IDLE;
+    if(!success || !(m_status_data & STATUS_DATA_READY)){
+        return;
+    }
+
+    if(m_status_data & STATUS_DATA_SKIPPED){
+        m_skipped_sample_count++;
+    }
+    qmc5883l_queue_magnetometer_read();
+}
+
+// Call this faster than the output data rate. Only transfers and calibrates the data when the chip has a
+// new measurement, so polling costs a one byte read. Returns 1 and the readings when there is a new sample
+uint8_t qmc5883l_update(float *data)
+{
+    uint8_t new_sample = qmc5883l_get_queued_magnetometer_readings_micro_teslas(data);
+
+    if(m_queued_state == I2C_READ_PENDING || m_status_state == I2C_READ_PENDING){
+        return new_sample;
+    }
+
+    if(m_data_ready_source == DATA_READY_PIN){
+        if(m_data_ready_pin_flag){
+            m_data_ready_pin_flag = 0;
+            qmc5883l_queue_magnetometer_read();
+        }
+        return new_sample;
+    }
+
+    m_status_state = I2C_READ_PENDING;
+    if(!i2c_scheduler_queue_read(QMC5883L_I2C_ID, STATUS_REG, &m_status_data, 1, I2C_PRIORITY_MEDIUM, status_read_callback)){
+        m_status_state = I2C_READ_IDLE;
+    }
+    return new_sample;
+}
+
+// Call from HAL_GPIO_EXTI_Callback when the DRDY pin is used
+void qmc5883l_data_ready_interrupt()
+{
+    m_data_ready_pin_flag = 1;
+}
+
+// Measurements that were overwritten before they were read. Grows if the update is not called often enough
+uint32_t qmc5883l_get_skipped_sample_count()
+{
+    return m_skipped_sample_count;
+}
+
 void calculate_yaw(float *magnetometer_data, float *yaw)
 {
     float x = magnetometer_data[0];
@@ -144,7 +388,7 @@ void calculate_yaw(float *magnetometer_data, float *yaw)
     float z = magnetometer_data[2];
 
     // rotation around the z axis
-    *yaw = atan2f(y, x) * (180 / M_PI);
+    *yaw = fast_atan2f(y, x) * RADIANS_TO_DEGREES_F;
 
     // Convert yaw to [0, 360] range
     if (*yaw > 180) {
@@ -154,17 +398,23 @@ void calculate_yaw(float *magnetometer_data, float *yaw)
 
 
 void calculate_yaw_tilt_compensated(float *magnetometer_data, float *yaw, float gyro_x_axis_rotation_degrees, float gyro_y_axis_rotation_degrees){
-    float roll = gyro_x_axis_rotation_degrees * (M_PI / 180);  //  Convert roll from degrees to radians
-    float pitch = gyro_y_axis_rotation_degrees * (M_PI / 180);  // Convert pitch from degrees to radians
+    float roll = gyro_x_axis_rotation_degrees * DEGREES_TO_RADIANS_F;  //  Convert roll from degrees to radians
+    float pitch = gyro_y_axis_rotation_degrees * DEGREES_TO_RADIANS_F;  // Convert pitch from degrees to radians
 
     float mx = magnetometer_data[0];
     float my = magnetometer_data[1];
     float mz = magnetometer_data[2];
 
-    float Xc = mx * cos(pitch) + mz * sin(pitch);
-    float Yc = mx * sin(roll) * sin(pitch) + my * cos(roll) - mz * sin(roll) * cos(pitch);
+    // Each one only once, they were computed twice in double before
+    float sin_roll = fast_sinf(roll);
+    float cos_roll = fast_cosf(roll);
+    float sin_pitch = fast_sinf(pitch);
+    float cos_pitch = fast_cosf(pitch);
+
+    float Xc = mx * cos_pitch + mz * sin_pitch;
+    float Yc = mx * sin_roll * sin_pitch + my * cos_roll - mz * sin_roll * cos_pitch;
 
-    *yaw = atan2(Yc, Xc) * (180 / M_PI);
+    *yaw = fast_atan2f(Yc, Xc) * RADIANS_TO_DEGREES_F;
     if (*yaw > 180) {
         *yaw -= 360;
     }
@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include "stm32f4xx_hal.h"
 #include "../printf/retarget.h"
+#include "../i2c_scheduler/i2c_scheduler.h"
+#include "../fastmath/fastmath.h"
+#include "../sensor_alignment/sensor_alignment.h"
+#include "../timebase/timebase.h"
 #include <math.h>
 
 enum t_interrupts {
@@ -34,7 +38,22 @@ enum t_measure_scale {
     MEASURE_SCALE_8G = 0b00010000,
 };
 
-uint8_t init_qmc5883l(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, const float hard_iron[3], const float soft_iron[3][3]);
+// Where qmc5883l_update finds out that there is a new measurement
+enum t_data_ready_source {
+    DATA_READY_STATUS_REGISTER = 0, // Poll the DRDY bit, one byte read per check
+    DATA_READY_PIN             = 1, // DRDY pin on an exti line, call qmc5883l_data_ready_interrupt from the callback
+};
+
+uint8_t init_qmc5883l(I2C_HandleTypeDef *i2c_handle_temp, uint8_t apply_calibration, const float hard_iron[3], const float soft_iron[3][3], const float alignment[3][3], enum t_output_data_rate output_data_rate, enum t_data_ready_source data_ready_source);
+void qmc5883l_set_calibration(const float hard_iron[3], const float soft_iron[3][3]);
+void qmc5883l_get_raw_micro_teslas(float *data);
+void qmc5883l_use_fixed_point(uint8_t enabled);
+void qmc5883l_print_benchmark();
 void qmc5883l_magnetometer_readings_micro_teslas(float *data);
+uint8_t qmc5883l_queue_magnetometer_read();
+uint8_t qmc5883l_get_queued_magnetometer_readings_micro_teslas(float *data);
+uint8_t qmc5883l_update(float *data);
+void qmc5883l_data_ready_interrupt();
+uint32_t qmc5883l_get_skipped_sample_count();
 void calculate_yaw(float *magnetometer_data, float *yaw);
 void calculate_yaw_tilt_compensated(float *magnetometer_data, float *yaw, float gyro_x_axis_rotation_degrees, float gyro_y_axis_rotation_degrees);
\ No newline at end of file
@@ -23,7 +23,8 @@ uint8_t string_buffer[STRING_BUFFER_SIZE];
 
 volatile uint8_t slave_ready = 0;
 
-void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+// Call from HAL_GPIO_EXTI_Callback, the pin is checked here
+void sd_card_slave_ready_interrupt(uint16_t GPIO_Pin)
 {
     if(GPIO_Pin == m_slave_ready_pin && slave_ready == 0 && driver_initialized == 1){
         // Falling 
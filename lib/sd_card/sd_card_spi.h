@@ -53,6 +53,7 @@ enum t_logger_commands {
 #define	FA_OPEN_ALWAYS		0x10
 #define	FA_OPEN_APPEND		0x30
 
+void sd_card_slave_ready_interrupt(uint16_t GPIO_Pin);
 uint8_t wait_for_slave_ready(uint16_t timeout_ms);
 uint8_t sd_card_initialize_spi(SPI_HandleTypeDef * device_handle, GPIO_TypeDef* slave_select_port, uint16_t slave_select_pin, GPIO_TypeDef* slave_ready_port, uint16_t slave_ready_pin);
 uint16_t sd_buffer_size(uint8_t local);
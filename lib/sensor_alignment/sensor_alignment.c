@@ -0,0 +1,33 @@
+#include "./sensor_alignment.h"
+
+// The drivers skip the multiply altogether when the sensor is mounted straight
+uint8_t sensor_alignment_is_identity(const float alignment[3][3]){
+    for(uint8_t i = 0; i < 3; i++){
+        for(uint8_t k = 0; k < 3; k++){
+            if(alignment[i][k] != (i == k ? 1.0f : 0.0f)){
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// data = alignment * data
+void sensor_alignment_apply(const float alignment[3][3], float *data){
+    float x = data[0];
+    float y = data[1];
+    float z = data[2];
+    for(uint8_t i = 0; i < 3; i++){
+        data[i] = alignment[i][0] * x + alignment[i][1] * y + alignment[i][2] * z;
+    }
+}
+
+// For folding the alignment into a calibration matrix once instead of doing both on every sample.
+// result can not be one of the inputs
+void sensor_alignment_multiply(const float left[3][3], const float right[3][3], float result[3][3]){
+    for(uint8_t i = 0; i < 3; i++){
+        for(uint8_t k = 0; k < 3; k++){
+            result[i][k] = left[i][0] * right[0][k] + left[i][1] * right[1][k] + left[i][2] * right[2][k];
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+
+// How a sensor sits on the board, as a matrix that turns the sensor axes into the board axes
+// (board = alignment * sensor). The board axes are the mpu6050 ones the estimators use.
+// Rotations are clockwise around z looking at the top of the board, FLIP is mounted upside down.
+// Same names and directions as betaflight's sensor_align_e.
+
+#define SENSOR_ALIGNMENT_CW0        {{ 1, 0, 0}, { 0, 1, 0}, { 0, 0, 1}}
+#define SENSOR_ALIGNMENT_CW90       {{ 0, 1, 0}, {-1, 0, 0}, { 0, 0, 1}}
+#define SENSOR_ALIGNMENT_CW180      {{-1, 0, 0}, { 0,-1, 0}, { 0, 0, 1}}
+#define SENSOR_ALIGNMENT_CW270      {{ 0,-1, 0}, { 1, 0, 0}, { 0, 0, 1}}
+#define SENSOR_ALIGNMENT_CW0_FLIP   {{-1, 0, 0}, { 0, 1, 0}, { 0, 0,-1}}
+#define SENSOR_ALIGNMENT_CW90_FLIP  {{ 0, 1, 0}, { 1, 0, 0}, { 0, 0,-1}}
+#define SENSOR_ALIGNMENT_CW180_FLIP {{ 1, 0, 0}, { 0,-1, 0}, { 0, 0,-1}}
+#define SENSOR_ALIGNMENT_CW270_FLIP {{ 0,-1, 0}, {-1, 0, 0}, { 0, 0,-1}}
+
+uint8_t sensor_alignment_is_identity(const float alignment[3][3]);
+void sensor_alignment_apply(const float alignment[3][3], float *data);
+void sensor_alignment_multiply(const float left[3][3], const float right[3][3], float result[3][3]);
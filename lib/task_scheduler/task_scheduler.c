@@ -0,0 +1,187 @@
+#include "./task_scheduler.h"
+
+static struct task m_tasks[TASK_SCHEDULER_MAX_TASKS];
+static uint8_t m_task_count = 0;
+
+static void reset_task_statistics(struct task *task)
+{
+    task->run_count = 0;
+    task->overrun_count = 0;
+    task->late_count = 0;
+    task->missed_trigger_count = 0;
+    task->last_duration_us = 0;
+    task->max_duration_us = 0;
+    task->max_latency_us = 0;
+}
+
+uint8_t init_task_scheduler()
+{
+    m_task_count = 0;
+    return 1;
+}
+
+// Returns the task id or -1 if there is no room
+int8_t task_scheduler_add_task(const char *name, void (*function)(), uint32_t period_us, enum t_task_priority priority, uint32_t budget_us)
+{
+    if (m_task_count >= TASK_SCHEDULER_MAX_TASKS)
+    {
+        return -1;
+    }
+
+    struct task *new_task = &m_tasks[m_task_count];
+    new_task->name = name;
+    new_task->function = function;
+    new_task->period_us = period_us;
+    new_task->priority = priority;
+    new_task->budget_us = budget_us;
+    new_task->triggered = 0;
+    new_task->ready_time = timebase_get_micros() + period_us;
+    reset_task_statistics(new_task);
+
+    m_task_count++;
+    return m_task_count - 1;
+}
+
+// Make a task ready now. If it is already waiting to run the trigger is only counted as missed
+void task_scheduler_trigger(int8_t task_id)
+{
+    if (task_id < 0 || task_id >= m_task_count)
+    {
+        return;
+    }
+    if (m_tasks[task_id].triggered)
+    {
+        m_tasks[task_id].missed_trigger_count++;
+        return;
+    }
+
+    m_tasks[task_id].ready_time = timebase_get_micros();
+    m_tasks[task_id].triggered = 1;
+}
+
+static uint8_t is_ready(struct task *task, uint32_t time)
+{
+    if (task->triggered)
+    {
+        return 1;
+    }
+    return task->period_us != 0 && (int32_t)(time - task->ready_time) >= 0;
+}
+
+// Waited longer than its period, it runs even if it does not fit
+static uint8_t is_starving(struct task *task, uint32_t time)
+{
+    return task->period_us != 0 && time - task->ready_time >= task->period_us;
+}
+
+// Most important ready task that fits in the time available. -1 if there is nothing to do
+static int8_t find_next_task(uint32_t time, uint32_t time_available_us)
+{
+    int8_t best = -1;
+    for (uint8_t i = 0; i < m_task_count; i++)
+    {
+        struct task *task = &m_tasks[i];
+        if (!is_ready(task, time))
+        {
+            continue;
+        }
+
+        if (task->priority != TASK_PRIORITY_REALTIME && task->budget_us > time_available_us && !is_starving(task, time))
+        {
+            continue;
+        }
+
+        if (best == -1 ||
+            task->priority < m_tasks[best].priority ||
+            (task->priority == m_tasks[best].priority && (int32_t)(task->ready_time - m_tasks[best].ready_time) < 0))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Run one task. Call in a loop, time_available_us is how long until something more important has to run.
+// Returns 0 if nothing was run
+uint8_t task_scheduler_run(uint32_t time_available_us)
+{
+    uint32_t start_time = timebase_get_micros();
+    int8_t next = find_next_task(start_time, time_available_us);
+    if (next == -1)
+    {
+        return 0;
+    }
+
+    struct task *task = &m_tasks[next];
+    uint32_t latency = start_time - task->ready_time;
+    uint8_t late = is_starving(task, start_time);
+
+    // Clear the trigger before running so the task can be triggered again while it runs
+    task->triggered = 0;
+    if (task->period_us != 0)
+    {
+        // Keep the rate, but do not try to catch up on the runs that were missed
+        task->ready_time = late ? start_time + task->period_us : task->ready_time + task->period_us;
+    }
+
+    task->function();
+
+    uint32_t duration = timebase_get_micros() - start_time;
+    task->run_count++;
+    task->last_duration_us = duration;
+    if (duration > task->max_duration_us)
+    {
+        task->max_duration_us = duration;
+    }
+    if (latency > task->max_latency_us)
+    {
+        task->max_latency_us = latency;
+    }
+    if (duration > task->budget_us)
+    {
+        task->overrun_count++;
+    }
+    if (late)
+    {
+        task->late_count++;
+    }
+    return 1;
+}
+
+struct task *task_scheduler_get_task(int8_t task_id)
+{
+    if (task_id < 0 || task_id >= m_task_count)
+    {
+        return NULL;
+    }
+    return &m_tasks[task_id];
+}
+
+uint8_t task_scheduler_get_task_count()
+{
+    return m_task_count;
+}
+
+void task_scheduler_reset_statistics()
+{
+    for (uint8_t i = 0; i < m_task_count; i++)
+    {
+        reset_task_statistics(&m_tasks[i]);
+    }
+}
+
+void task_scheduler_print_statistics()
+{
+    for (uint8_t i = 0; i < m_task_count; i++)
+    {
+        struct task *task = &m_tasks[i];
+        printf("%-12s runs %8lu max %6lu us latency %6lu us overruns %6lu late %6lu missed %6lu\n",
+            task->name,
+            (unsigned long)task->run_count,
+            (unsigned long)task->max_duration_us,
+            (unsigned long)task->max_latency_us,
+            (unsigned long)task->overrun_count,
+            (unsigned long)task->late_count,
+            (unsigned long)task->missed_trigger_count);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+#include "../timebase/timebase.h"
+
+// Cooperative multi rate scheduler on the timebase timer. Every task runs to the end, the scheduler only
+// decides what goes next. Periodic tasks run at their own rate, tasks with period 0 only run when
+// triggered (flight control from the mpu6050 data ready for example).
+// A task that does not fit in the time left before the next important thing waits, unless it has been
+// waiting for a whole period already.
+
+#define TASK_SCHEDULER_MAX_TASKS 10
+
+// Lower value goes first
+enum t_task_priority {
+    TASK_PRIORITY_REALTIME = 0, // Runs as soon as it is ready, the time budget is not checked
+    TASK_PRIORITY_HIGH     = 1,
+    TASK_PRIORITY_MEDIUM   = 2,
+    TASK_PRIORITY_LOW      = 3,
+};
+
+struct task{
+    const char *name;
+    void (*function)();
+    uint32_t period_us; // 0 for triggered only
+    enum t_task_priority priority;
+    uint32_t budget_us; // How long the task is expected to take at most
+
+    uint8_t triggered;
+    uint32_t ready_time; // When it was due or triggered
+
+    uint32_t run_count;
+    uint32_t overrun_count; // Took longer than the budget
+    uint32_t late_count; // Started a whole period or more after it was due
+    uint32_t missed_trigger_count; // Triggered again before it ran, the two triggers became one run
+    uint32_t last_duration_us;
+    uint32_t max_duration_us;
+    uint32_t max_latency_us; // Longest wait between being ready and starting
+};
+
+uint8_t init_task_scheduler();
+int8_t task_scheduler_add_task(const char *name, void (*function)(), uint32_t period_us, enum t_task_priority priority, uint32_t budget_us);
+void task_scheduler_trigger(int8_t task_id);
+uint8_t task_scheduler_run(uint32_t time_available_us);
+struct task *task_scheduler_get_task(int8_t task_id);
+uint8_t task_scheduler_get_task_count();
+void task_scheduler_reset_statistics();
+void task_scheduler_print_statistics();
@@ -0,0 +1,36 @@
+#include "./timebase.h"
+
+static TIM_HandleTypeDef *timer_handle;
+
+// The timer has to be set up for 1MHz with the full 32 bit period before this
+uint8_t init_timebase(TIM_HandleTypeDef *timer_handle_temp)
+{
+    timer_handle = timer_handle_temp;
+
+    // Cycle counter is part of the debug block, it needs trace enabled first
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    return HAL_TIM_Base_Start(timer_handle) == HAL_OK;
+}
+
+uint32_t timebase_get_micros()
+{
+    return __HAL_TIM_GET_COUNTER(timer_handle);
+}
+
+uint32_t timebase_get_cycles()
+{
+    return DWT->CYCCNT;
+}
+
+float timebase_get_seconds_between(uint32_t start_micros, uint32_t end_micros)
+{
+    return (float)(end_micros - start_micros) / 1000000.0f;
+}
+
+uint32_t timebase_cycles_to_micros(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "stm32f4xx_hal.h"
+
+// Free running microsecond clock for every dt in the flight code. HAL_GetTick is only 1ms so at 200Hz
+// it is off by up to 20% and above 1kHz the dt is 0.
+// The 32 bit timer runs at 1MHz and wraps after about 71 minutes. Unsigned subtraction handles the wrap
+// as long as the two times are less than that apart.
+// The DWT cycle counter is there for measuring how long code takes, it wraps after 57 seconds at 75MHz.
+
+uint8_t init_timebase(TIM_HandleTypeDef *timer_handle_temp);
+uint32_t timebase_get_micros();
+uint32_t timebase_get_cycles();
+float timebase_get_seconds_between(uint32_t start_micros, uint32_t end_micros);
+uint32_t timebase_cycles_to_micros(uint32_t cycles);
@@ -1,6 +1,7 @@
 #include "./ned_coordinates.h"
 #include <stdio.h>
 #include <math.h>
+#include "../../fastmath/fastmath.h"
 
 #ifndef M_PI
 #define M_PI (3.14159265358979323846)
@@ -9,7 +10,7 @@
 void get_ned_coordinates(float* acceleration_data, float* magnetometer_data, float* north_vector, float* east_vector, float* down_vector){
 
     // A unit
-    const float acc_vector_length = sqrt(pow(acceleration_data[0], 2) + pow(acceleration_data[1], 2) + pow(acceleration_data[2], 2));
+    const float acc_vector_length = fast_sqrtf(acceleration_data[0] * acceleration_data[0] + acceleration_data[1] * acceleration_data[1] + acceleration_data[2] * acceleration_data[2]);
     float acc_unit_vector[] = {
         acceleration_data[0] / acc_vector_length,
         acceleration_data[1] / acc_vector_length,
@@ -18,7 +19,7 @@ void get_ned_coordinates(float* acceleration_data, float* magnetometer_data, flo
 
 
     // M unit
-    const float mag_vector_length = sqrt(pow(magnetometer_data[0], 2) + pow(magnetometer_data[1], 2) + pow(magnetometer_data[2], 2));
+    const float mag_vector_length = fast_sqrtf(magnetometer_data[0] * magnetometer_data[0] + magnetometer_data[1] * magnetometer_data[1] + magnetometer_data[2] * magnetometer_data[2]);
     float mag_unit_vector[] = {
           magnetometer_data[0] / mag_vector_length,
           magnetometer_data[1] / mag_vector_length,
@@ -43,7 +44,7 @@ void get_ned_coordinates(float* acceleration_data, float* magnetometer_data, flo
 
     // E unit
     // east normalization and turning into unit vector
-    const float east_vector_length = sqrt(pow(east_direction[0], 2) + pow(east_direction[1], 2) + pow(east_direction[2], 2));
+    const float east_vector_length = fast_sqrtf(east_direction[0] * east_direction[0] + east_direction[1] * east_direction[1] + east_direction[2] * east_direction[2]);
     float east_unit_direction[] = {
         east_direction[0] / east_vector_length,
         east_direction[1] / east_vector_length,
@@ -59,7 +60,7 @@ void get_ned_coordinates(float* acceleration_data, float* magnetometer_data, flo
     };
 
     // N unit
-    const float north_vector_length = sqrt(pow(north_direction[0], 2) + pow(north_direction[1], 2) + pow(north_direction[2], 2));
+    const float north_vector_length = fast_sqrtf(north_direction[0] * north_direction[0] + north_direction[1] * north_direction[1] + north_direction[2] * north_direction[2]);
     
     // Return NED coordinates
     north_vector[0] = north_direction[0] / north_vector_length;
@@ -77,17 +78,17 @@ void get_ned_coordinates(float* acceleration_data, float* magnetometer_data, flo
 
 
 float angle_between_2d_vectors(float ax, float ay, float bx, float by ){
-    float a_length = sqrt(pow(ax, 2) + pow(ay, 2));
-    float b_length = sqrt(pow(bx, 2) + pow(by, 2));
+    float a_length = fast_sqrtf(ax * ax + ay * ay);
+    float b_length = fast_sqrtf(bx * bx + by * by);
 
     ax = ax /a_length;
-    ax = ax /a_length;
+    ay = ay /a_length;
 
     bx = bx /b_length;
-    bx = bx /b_length;
+    by = by /b_length;
 
-    return atan2(
+    return fast_atan2f(
         (ax * by - ay * bx), 
         (ax * bx + ay * by)
-    )*180/M_PI;
+    ) * RADIANS_TO_DEGREES_F;
 }
\ No newline at end of file
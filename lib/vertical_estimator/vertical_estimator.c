@@ -0,0 +1,153 @@
+#include "./vertical_estimator.h"
+
+#define STATES 3
+
+// How unsure the filter is after a reset
+#define INITIAL_ALTITUDE_SIGMA 1.0f     // m
+#define INITIAL_VELOCITY_SIGMA 0.5f     // m/s
+#define INITIAL_BIAS_SIGMA 0.5f         // m/s^2
+
+// Altitude, vertical velocity, accelerometer bias
+static float m_state[STATES];
+static float m_covariance[STATES][STATES];
+
+static float m_accelerometer_variance = 0.0f;   // (m/s^2)^2
+static float m_bias_variance_density = 0.0f;    // (m/s^2)^2 per second
+static float m_barometer_variance = 0.0f;       // m^2
+static float m_gps_variance = 0.0f;             // m^2
+
+static float m_gps_offset = 0.0f;
+static uint8_t m_gps_offset_set = 0;
+
+// accelerometer_noise_mps2 is the noise on the vertical acceleration with the motors running.
+// accelerometer_bias_walk_mps2 is how fast the bias can wander, per sqrt(second).
+// The barometer and gps noises set how much each is trusted against the other and the accelerometer
+uint8_t init_vertical_estimator(float accelerometer_noise_mps2, float accelerometer_bias_walk_mps2, float barometer_noise_meters, float gps_noise_meters){
+    m_accelerometer_variance = accelerometer_noise_mps2 * accelerometer_noise_mps2;
+    m_bias_variance_density = accelerometer_bias_walk_mps2 * accelerometer_bias_walk_mps2;
+    m_barometer_variance = barometer_noise_meters * barometer_noise_meters;
+    m_gps_variance = gps_noise_meters * gps_noise_meters;
+
+    m_state[2] = 0.0f;
+    vertical_estimator_reset(0.0f);
+    return 1;
+}
+
+// Start over at a known altitude and not moving. The bias is kept, the gps offset is taken again
+void vertical_estimator_reset(float altitude_meters){
+    m_state[0] = altitude_meters;
+    m_state[1] = 0.0f;
+
+    for(uint8_t i = 0; i < STATES; i++){
+        for(uint8_t k = 0; k < STATES; k++){
+            m_covariance[i][k] = 0.0f;
+        }
+    }
+    m_covariance[0][0] = INITIAL_ALTITUDE_SIGMA * INITIAL_ALTITUDE_SIGMA;
+    m_covariance[1][1] = INITIAL_VELOCITY_SIGMA * INITIAL_VELOCITY_SIGMA;
+    m_covariance[2][2] = INITIAL_BIAS_SIGMA * INITIAL_BIAS_SIGMA;
+
+    m_gps_offset_set = 0;
+}
+
+// One step of the position, velocity, bias model. The inertial navigation runs the same model once per axis,
+// so the axis comes in as its own state and covariance
+void vertical_estimator_predict_axis(float state[3], float covariance[3][3], float measured_acceleration, float dt, float accelerometer_variance, float bias_variance_density){
+    float acceleration = measured_acceleration - state[2];
+    float half_dt2 = 0.5f * dt * dt;
+
+    state[0] += state[1] * dt + acceleration * half_dt2;
+    state[1] += acceleration * dt;
+
+    // P = F * P * F' + Q
+    float transition[STATES][STATES] = {
+        {1.0f, dt,   -half_dt2},
+        {0.0f, 1.0f, -dt},
+        {0.0f, 0.0f, 1.0f}
+    };
+    float product[STATES][STATES];
+    for(uint8_t i = 0; i < STATES; i++){
+        for(uint8_t k = 0; k < STATES; k++){
+            product[i][k] = 0.0f;
+            for(uint8_t j = 0; j < STATES; j++){
+                product[i][k] += transition[i][j] * covariance[j][k];
+            }
+        }
+    }
+    for(uint8_t i = 0; i < STATES; i++){
+        for(uint8_t k = i; k < STATES; k++){
+            float value = 0.0f;
+            for(uint8_t j = 0; j < STATES; j++){
+                value += product[i][j] * transition[k][j];
+            }
+            covariance[i][k] = value;
+            covariance[k][i] = value;
+        }
+    }
+
+    // The acceleration noise goes in through the same half_dt2 and dt as the acceleration itself
+    covariance[0][0] += accelerometer_variance * half_dt2 * half_dt2;
+    covariance[0][1] += accelerometer_variance * half_dt2 * dt;
+    covariance[1][0] += accelerometer_variance * half_dt2 * dt;
+    covariance[1][1] += accelerometer_variance * dt * dt;
+    covariance[2][2] += bias_variance_density * dt;
+}
+
+// A sensor that measures the position directly, so it is one number with the gain being the first column of P
+void vertical_estimator_update_axis(float state[3], float covariance[3][3], float position, float variance){
+    float innovation = position - state[0];
+    float innovation_variance = covariance[0][0] + variance;
+
+    float gain[STATES];
+    float first_row[STATES];
+    for(uint8_t i = 0; i < STATES; i++){
+        gain[i] = covariance[i][0] / innovation_variance;
+        first_row[i] = covariance[0][i];
+    }
+
+    for(uint8_t i = 0; i < STATES; i++){
+        state[i] += gain[i] * innovation;
+        for(uint8_t k = 0; k < STATES; k++){
+            covariance[i][k] -= gain[i] * first_row[k];
+        }
+    }
+}
+
+// vertical_acceleration_mps2 is up positive with gravity already taken out, dt in seconds
+void vertical_estimator_predict(float vertical_acceleration_mps2, float dt){
+    vertical_estimator_predict_axis(m_state, m_covariance, vertical_acceleration_mps2, dt, m_accelerometer_variance, m_bias_variance_density);
+}
+
+// Height from the barometer reference, bmp280_calculate_height_meters_from_reference
+void vertical_estimator_update_barometer(float altitude_meters){
+    vertical_estimator_update_axis(m_state, m_covariance, altitude_meters, m_barometer_variance);
+}
+
+// The first fix only lines the gps up with the current estimate. After that it keeps the barometer from drifting
+void vertical_estimator_update_gps(float altitude_meters_sea_level){
+    if(!m_gps_offset_set){
+        m_gps_offset = altitude_meters_sea_level - m_state[0];
+        m_gps_offset_set = 1;
+        return;
+    }
+    vertical_estimator_update_axis(m_state, m_covariance, altitude_meters_sea_level - m_gps_offset, m_gps_variance);
+}
+
+float vertical_estimator_get_altitude_meters(){
+    return m_state[0];
+}
+
+float vertical_estimator_get_vertical_velocity_mps(){
+    return m_state[1];
+}
+
+float vertical_estimator_get_accelerometer_bias_mps2(){
+    return m_state[2];
+}
+
+// The accelerometer turned into the world frame, only the up component is needed. rotation is drone to world
+// like attitude_get_rotation_matrix gives it, the accelerometer in g reading +1 on z when level
+float vertical_estimator_get_vertical_acceleration_mps2(const float rotation[3][3], const float accelerometer_g[3]){
+    float up_g = rotation[2][0] * accelerometer_g[0] + rotation[2][1] * accelerometer_g[1] + rotation[2][2] * accelerometer_g[2];
+    return (up_g - 1.0f) * GRAVITY_MPS2;
+}
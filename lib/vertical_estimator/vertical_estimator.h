@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "../printf/retarget.h"
+
+// Altitude and climb rate from the accelerometer, barometer and gps (3 state Kalman filter).
+// The vertical acceleration in the world frame, gravity removed, is integrated every loop. The barometer and
+// the gps pull the altitude back whenever they have something new. The third state is the accelerometer
+// bias along the vertical, without it the integrated velocity would run away.
+//
+// Altitude is in meters from where the barometer reference was set, up positive. The gps altitude is above
+// sea level, the offset between the two is taken at the first gps fix.
+
+#define GRAVITY_MPS2 9.80665f
+
+uint8_t init_vertical_estimator(float accelerometer_noise_mps2, float accelerometer_bias_walk_mps2, float barometer_noise_meters, float gps_noise_meters);
+void vertical_estimator_reset(float altitude_meters);
+void vertical_estimator_predict(float vertical_acceleration_mps2, float dt);
+void vertical_estimator_predict_axis(float state[3], float covariance[3][3], float measured_acceleration, float dt, float accelerometer_variance, float bias_variance_density);
+void vertical_estimator_update_axis(float state[3], float covariance[3][3], float position, float variance);
+void vertical_estimator_update_barometer(float altitude_meters);
+void vertical_estimator_update_gps(float altitude_meters_sea_level);
+float vertical_estimator_get_altitude_meters();
+float vertical_estimator_get_vertical_velocity_mps();
+float vertical_estimator_get_accelerometer_bias_mps2();
+float vertical_estimator_get_vertical_acceleration_mps2(const float rotation[3][3], const float accelerometer_g[3]);
@@ -9,11 +9,13 @@ SPI_HandleTypeDef hspi3;
 
 TIM_HandleTypeDef htim1;
 TIM_HandleTypeDef htim2;
+TIM_HandleTypeDef htim5;
 
 UART_HandleTypeDef huart1;
 UART_HandleTypeDef huart2;
 DMA_HandleTypeDef hdma_usart2_rx;
 DMA_HandleTypeDef hdma_spi3_tx;
+DMA_HandleTypeDef hdma_i2c1_rx;
 
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
@@ -25,6 +27,7 @@ static void MX_SPI1_Init(void);
 static void MX_SPI3_Init(void);
 static void MX_TIM1_Init(void);
 static void MX_TIM2_Init(void);
+static void MX_TIM5_Init(void);
 /* Actual functional code -----------------------------------------------*/
 
 #include "../lib/printf/retarget.h"
@@ -32,7 +35,16 @@ static void MX_TIM2_Init(void);
 #include "string.h"
 
 // Drivers
+#include "../lib/i2c_scheduler/i2c_scheduler.h"
+#include "../lib/task_scheduler/task_scheduler.h"
 #include "../lib/mpu6050/mpu6050.h"
+#include "../lib/attitude/attitude.h"
+#include "../lib/attitude_ekf/attitude_ekf.h"
+#include "../lib/vertical_estimator/vertical_estimator.h"
+#include "../lib/inertial_navigation/inertial_navigation.h"
+#include "../lib/sensor_alignment/sensor_alignment.h"
+#include "../lib/flash_storage/flash_storage.h"
+#include "../lib/magnetometer_calibration/magnetometer_calibration.h"
 #include "../lib/qmc5883l/qmc5883l.h"
 #include "../lib/bmp280/bmp280.h"
 // #include "../lib/bme280/bme280.h"
@@ -48,19 +60,26 @@ static void MX_TIM2_Init(void);
 // Other imports
 #include "../lib/utils/ned_coordinates/ned_coordinates.h"
 #include "../lib/pid/pid.h"
+#include "../lib/filters/filters.h"
+#include "../lib/dynamic_notch/dynamic_notch.h"
+#include "../lib/timebase/timebase.h"
+#include "../lib/profiler/profiler.h"
+#include "../lib/fastmath/fastmath.h"
 
 void init_STM32_peripherals();
 void calibrate_escs();
-void fix_mag_axis(float *magnetometer_data);
 void fix_gyro_axis(float *accelerometer_data_temp);
 uint16_t setServoActivationPercent(float percent, uint16_t minValue, uint16_t maxValue);
 float mapValue(float value, float input_min, float input_max, float output_min, float output_max);
 void extract_request_values(char *request, uint8_t request_size, uint8_t *throttle, uint8_t *yaw, uint8_t *pitch, uint8_t *roll);
-float get_sensor_fusion_altitude(float gps_altitude, float barometer_altitude);
 u_int8_t init_sensors();
 void init_loop_timer();
 void check_calibrations();
 void calibrate_gyro();
+uint8_t load_gyro_temperature_model();
+void calibrate_gyro_temperature_model();
+uint8_t load_magnetometer_calibration();
+void calibrate_magnetometer();
 void get_initial_position();
 void handle_loop_timing();
 
@@ -74,10 +93,19 @@ float apply_dead_zone(float value, float max_value, float min_value, float dead_
 void send_pid_base_info_to_remote();
 void send_pid_added_info_to_remote();
 char* generate_message_pid_values_nrf24(float base_proportional, float base_integral, float base_derivative, float base_master);
+void handle_flight_control();
 void handle_get_and_calculate_sensor_values();
+void handle_attitude_estimation();
+void handle_magnetometer();
+void handle_magnetometer_calibration();
+void handle_dynamic_notch();
+void handle_barometer();
+void handle_gps();
+void handle_profiler_report();
 void handle_radio_communication();
 void handle_logging();
-void handle_pid_and_motor_control();
+void handle_pid_and_motor_control(uint8_t angle_loop);
+uint32_t get_time_until_flight_control();
 void setup_logging_to_sd();
 
 // PWM pins
@@ -101,6 +129,7 @@ void setup_logging_to_sd();
 // PB5  SPI RADIO
 // PB4  SPI RADIO
 // PA12 LED
+// PB8  MPU6050 INT. Data ready, rising interrupt
 
 // SPI1 SD card logger
 // PB5 MOSI
@@ -174,6 +203,35 @@ float soft_iron_correction[3][3] = {
     {-0.058046,-0.245339,3.733419}
 };
 
+// The mpu6050 and qmc5883l keep their readings as integers through the alignment and calibration and only
+// turn them into float at the end. Same results, print_sensor_conversion_benchmark shows which is cheaper
+const uint8_t use_fixed_point_sensors = 0;
+
+// How the sensors are turned on the board. The drivers give everything in the mpu6050 axes.
+// The magnetometer has its x and y switched around compared to the mpu6050
+const float imu_alignment[3][3] = SENSOR_ALIGNMENT_CW0;
+const float magnetometer_alignment[3][3] = SENSOR_ALIGNMENT_CW90;
+
+// The gyro bias over temperature is kept in flash, with it the gyro does not need calibrating at every boot.
+// To make one set run_gyro_temperature_calibration, power up cold and leave the drone still while it warms up.
+// A hair dryer makes the temperature span bigger
+const uint8_t run_gyro_temperature_calibration = 0;
+#define GYRO_TEMPERATURE_CALIBRATION_MS 600000 // 10 minutes
+#define GYRO_TEMPERATURE_CALIBRATION_MIN_SPAN_CELSIUS 5.0
+
+// The iron calibration can also be fitted on the drone, then it is used instead of the numbers above.
+// run_magnetometer_calibration: after startup turn the drone around in every direction, upside down too,
+// until the time runs out. The result goes to flash.
+// calibrate_magnetometer_in_flight: keeps fitting in the background and uses a new result when it is good.
+// Only kept until power off, writing flash stops the cpu for over a second
+const uint8_t run_magnetometer_calibration = 0;
+const uint8_t calibrate_magnetometer_in_flight = 0;
+#define MAGNETOMETER_CALIBRATION_MS 60000
+#define MAGNETOMETER_FIELD_NORM_MICRO_TESLAS 50.503
+#define MAGNETOMETER_CALIBRATION_FORGETTING_FACTOR 0.9995 // Samples fade over about 2000 samples
+#define MAGNETOMETER_CALIBRATION_SAMPLE_DISTANCE_MICRO_TESLAS 1.0 // In raw units, about a degree of turning
+#define MAGNETOMETER_CALIBRATION_RATE_HZ 1
+
 float accelerometer_correction[3] = {
     0.024980, -0.020180, 1.144808
 };
@@ -185,12 +243,8 @@ float gyro_correction[3] = {
 // handling loop timing ###################################################################################
 uint32_t loop_start_time = 0;
 uint32_t loop_end_time = 0;
-int16_t delta_loop_time = 0;
-
-// Accelerometer values to degrees conversion #############################################################
-float accelerometer_x_rotation = 0;
-float accelerometer_y_rotation = 0;
-float magnetometer_z_rotation = 0;
+uint32_t delta_loop_time = 0; // microseconds
+uint32_t missed_data_ready_count = 0; // Loops that were started by the timeout instead of the mpu6050 interrupt
 
 // Radio config ########################################################################################### 
 uint8_t tx_address[5] = {0xEE, 0xDD, 0xCC, 0xBB, 0xAA};
@@ -203,11 +257,19 @@ float error_roll = 0;
 float error_yaw = 0;
 float error_altitude = 0;
 
-// Actual PID adjustment for pitch
-#define BASE_PITCH_ROLL_MASTER_GAIN 0.4
-#define BASE_PITCH_ROLL_GAIN_P 0.0 // 0.35
-#define BASE_PITCH_ROLL_GAIN_I 0.0 // 0.0
-#define BASE_PITCH_ROLL_GAIN_D 0.0 // 130.0
+// Cascaded control. The angle loop turns the angle error into a rotation rate REFRESH_RATE_HZ times a second,
+// the rate loop turns the rate error into motor power every gyro sample (RATE_LOOP_HZ).
+// Tune the rate loop first with the angle gain at 0, then bring the angle gain up.
+#define ANGLE_GAIN_P 4.0 // deg/s asked for per degree of error
+#define MAX_ANGLE_RATE_DPS 200.0 // The most the angle loop asks the rate loop for
+#define RATE_DERIVATIVE_FILTER_HZ 50 // Low pass on the derivative of the rate loops, on top of the gyro filters
+
+// Pitch and roll rate loop, motor percent per deg/s of rate error. The remote "ratePid" tuning adds to these.
+// The numbers from the old angle only pid were per degree and do not carry over
+#define RATE_MASTER_GAIN 0.4
+#define RATE_GAIN_P 0.0
+#define RATE_GAIN_I 0.0
+#define RATE_GAIN_D 0.0
 
 
 // Notes for PID
@@ -216,10 +278,15 @@ float error_altitude = 0;
 // 2) Remember that the drone when in the air has motors spinning at idle power, just enough 
 // to float in the air. If you are testing with drone constrained add a base motor speed to account for this.
 
-// PID for yaw
-const float yaw_gain_p = 0.0; 
+// PID for yaw. The heading from the attitude estimator, the gyro turns it every loop and the magnetometer
+// pulls it slowly, gives the yaw rate for the yaw rate loop like the angle loop does for pitch and roll.
+// If it turns the wrong way the props spin the other way around than the mixing assumes, flip the rate gains
+const float yaw_gain_p = 0.0; // deg/s per degree of heading error
 const float yaw_gain_i = 0.0;
 const float yaw_gain_d = 0.0;
+const float yaw_rate_gain_p = 0.0;
+const float yaw_rate_gain_i = 0.0;
+const float yaw_rate_gain_d = 0.0;
 
 // PID for yaw
 const float altitude_gain_p = 0.0; 
@@ -228,38 +295,140 @@ const float altitude_gain_d = 0.0;
 
 // Used for smooth changes to PID while using remote control. Do not touch this
 
-float pitch_roll_master_gain = BASE_PITCH_ROLL_MASTER_GAIN; // Dont you just love the STM#2 compiler?
-float pitch_roll_gain_p = BASE_PITCH_ROLL_GAIN_P;
-float pitch_roll_gain_i = BASE_PITCH_ROLL_GAIN_I;
-float pitch_roll_gain_d = BASE_PITCH_ROLL_GAIN_D;
+float rate_master_gain = RATE_MASTER_GAIN; // Dont you just love the STM#2 compiler?
+float rate_gain_p = RATE_GAIN_P;
+float rate_gain_i = RATE_GAIN_I;
+float rate_gain_d = RATE_GAIN_D;
 
-float added_pitch_roll_master_gain = 0;
-float added_pitch_roll_gain_p = 0;
-float added_pitch_roll_gain_i = 0;
-float added_pitch_roll_gain_d = 0;
+float added_rate_master_gain = 0;
+float added_rate_gain_p = 0;
+float added_rate_gain_i = 0;
+float added_rate_gain_d = 0;
 
 // Refresh rate ##############################################################################################
 
 // remember that the stm32 is not as fast as the esp32 and it cannot print lines at the same speed
 // const float refresh_rate_hz = 400;
-#define REFRESH_RATE_HZ 200
+#define REFRESH_RATE_HZ 200 // Estimator corrections, the angle loop and logging
+#define RATE_LOOP_HZ 1000 // The loop wakes up this often for the rate loop and the motors. Every gyro sample
+#define SENSOR_READ_TIMEOUT_MS 4 // Longer than the i2c scheduler timeout so a stuck read gets aborted
+#define DATA_READY_TIMEOUT_MS (2 * 1000 / RATE_LOOP_HZ) // If the mpu6050 interrupt stops the loop still runs at half rate
+#define IMU_SAMPLE_RATE_HZ 1000 // The mpu6050 fifo collects at this rate and the loop drains it
+#define IMU_SAMPLES_PER_LOOP (IMU_SAMPLE_RATE_HZ / RATE_LOOP_HZ)
+#define RATE_LOOPS_PER_ANGLE_LOOP (RATE_LOOP_HZ / REFRESH_RATE_HZ)
+
+// Everything else runs at its own rate in the time left between the flight control runs
+#define FLIGHT_CONTROL_PERIOD_US (1000000 / RATE_LOOP_HZ)
+#define MAGNETOMETER_OUTPUT_DATA_RATE ODR_50HZ
+#define MAGNETOMETER_RATE_HZ 100 // Polls the DRDY bit twice per qmc5883l measurement so none get skipped
+#define BAROMETER_RATE_HZ 100 // Only polls, the bmp280 driver reads once per conversion at its own rate
+#define GPS_RATE_HZ 10
+#define RADIO_RATE_HZ 100
+int8_t flight_control_task = -1;
+int8_t logging_task = -1;
+uint8_t rate_loop_count = 0; // Rate loops since the last angle loop
+
+// Profiling ##############################################################################################
+// Every handler and the slow driver calls are timed with the cycle counter. The report goes out over uart
+// one line at a time because printing blocks. Only for the bench, each line costs about one loop.
+const uint8_t print_profiler_report = 0;
+const uint8_t print_fastmath_benchmark = 0; // Cycles and error of lib/fastmath against libm, once on startup
+const uint8_t print_attitude_ekf_benchmark = 0; // Cycles of the EKF steps and its share of a 1kHz loop, after the sensors are set up
+const uint8_t print_sensor_conversion_benchmark = 0; // Cycles of the float and fixed point sensor conversions, after the sensors are set up
+const uint8_t print_filter_benchmark = 0; // Cycles per sample of the gyro filter chain, once on startup
+#define PROFILER_REPORT_RATE_HZ 5
+uint8_t profiler_report_line = 0;
+int8_t profile_flight_control = -1;
+int8_t profile_sensors = -1;
+int8_t profile_imu_read = -1;
+int8_t profile_pid_and_motors = -1;
+int8_t profile_magnetometer = -1;
+int8_t profile_dynamic_notch = -1;
+int8_t profile_barometer = -1;
+int8_t profile_gps = -1;
+int8_t profile_radio = -1;
+int8_t profile_nrf24_receive = -1;
+int8_t profile_logging = -1;
+int8_t profile_blackbox_encode = -1;
+int8_t profile_sd_write = -1;
 
 // Sensor stuff ##############################################################################################
-float complementary_ratio = 1.0 - 1.0/(1.0+(1.0/REFRESH_RATE_HZ)); // Depends on how often the loop runs. 1 second / (1 second + one loop time)
+struct mpu6050_sample imu_sample;
+struct mpu6050_sample imu_fifo_samples[MPU6050_FIFO_MAX_SAMPLES]; // Collected over the rate loops until the next angle loop
+struct mpu6050_fixed_sample imu_fifo_fixed_samples[MPU6050_FIFO_MAX_SAMPLES]; // The same samples corrected in integers, with use_fixed_point_sensors
+uint8_t imu_fifo_sample_count = 0;
+float complementary_ratio = 1.0 - 1.0/(1.0+(1.0/REFRESH_RATE_HZ)); // For one loop at REFRESH_RATE_HZ. The mpu6050 turns it into a 1 second time constant and works the ratio out from the measured time of every step
+uint32_t previous_imu_sample_time = 0;
+
+// Quaternion estimator. 1 per second pulls towards the accelerometer and magnetometer about as fast as the old complementary filter
+#define ATTITUDE_PROPORTIONAL_GAIN 1.0
+#define ATTITUDE_INTEGRAL_GAIN 0.0 // The gyro is calibrated on startup, no need to learn the bias in flight
+
+// The EKF instead keeps estimating the gyro bias in flight, the drift with temperature after the startup calibration.
+// It predicts with every 1kHz fifo sample and corrects with the averaged accelerometer once per loop
+const uint8_t use_attitude_ekf = 1;
+#define ATTITUDE_EKF_GYRO_NOISE_DENSITY_DPS 0.4 // Vibration included, sets the trust in the gyro. About the same 1 second as the complementary filter
+#define ATTITUDE_EKF_GYRO_BIAS_WALK_DPS 0.01
+#define ATTITUDE_EKF_ACCELEROMETER_NOISE_G 0.1
+#define ATTITUDE_EKF_HEADING_NOISE_DEGREES 5.0
+float imu_fifo_sample_gyro[3];
+float imu_fifo_sample_acceleration[3];
+
+// Gyro filters, every fifo sample goes through them at 1kHz before the estimator and the pids.
+// The notch takes out the motor vibration (about 230 rotations per second at hover), the low pass what is left above it
+const uint8_t use_gyro_filters = 1;
+#define GYRO_NOTCH_HZ 230
+#define GYRO_NOTCH_Q 2.5
+#define GYRO_LOWPASS_HZ 100
+const struct filter_stage gyro_filter_stages[] = {
+    {FILTER_NOTCH, GYRO_NOTCH_HZ, GYRO_NOTCH_Q},
+    {FILTER_LOWPASS, GYRO_LOWPASS_HZ, 0.7071},
+};
+struct filter_chain gyro_filters[3];
+
+// The notch follows the motors. An FFT of the unfiltered gyro finds the strongest peak, one axis at a time, a few
+// steps of it whenever there is time between the flight control runs. Each run stays under the budget
+const uint8_t use_dynamic_notch = 1;
+#define DYNAMIC_NOTCH_MINIMUM_HZ 80
+#define DYNAMIC_NOTCH_MAXIMUM_HZ 400
+#define DYNAMIC_NOTCH_PEAK_COUNT 1 // Notches per axis it moves, the first ones in gyro_filter_stages
+#define DYNAMIC_NOTCH_RATE_HZ 1000
+#define DYNAMIC_NOTCH_BUDGET_US 40 // About 4% of the cpu at 1kHz. A whole axis takes 9 steps of 10-20us
+float imu_fifo_gyro[3][MPU6050_FIFO_MAX_SAMPLES]; // Per axis so a whole axis goes through its filter chain in one block
+
+// Altitude and climb rate. The accelerometer every loop, corrected by the barometer and the gps when they have new data
+#define VERTICAL_ESTIMATOR_ACCELEROMETER_NOISE_MPS2 0.5 // With the motors running
+#define VERTICAL_ESTIMATOR_ACCELEROMETER_BIAS_WALK_MPS2 0.05
+#define VERTICAL_ESTIMATOR_BAROMETER_NOISE_METERS 0.5
+#define VERTICAL_ESTIMATOR_GPS_NOISE_METERS 3.0
+#define GPS_MINIMUM_SATELLITES 6 // Fewer and the gps altitude is off by tens of meters
+
+// Position and velocity north and east of the first gps fix. The accelerometer every loop, the gps pulls it back every fix
+#define INERTIAL_NAVIGATION_ACCELEROMETER_NOISE_MPS2 0.5
+#define INERTIAL_NAVIGATION_ACCELEROMETER_BIAS_WALK_MPS2 0.05 // A degree of tilt error is 0.17 m/s^2 of bias
+#define INERTIAL_NAVIGATION_GPS_NOISE_METERS 2.5 // At a horizontal dilution of 1
+#define MAGNETIC_DECLINATION_DEGREES 0.0 // East positive, from the noaa calculator linked at the magnetometer corrections. 0 until it is set
+float horizontal_acceleration[2];
+float ned_position[3]; // North and east from the inertial navigation, down from the vertical estimator
+float ned_velocity[3];
+float attitude_rotation[3][3];
 float acceleration_data[] = {0,0,0};
 float gyro_angular[] = {0,0,0};
 float gyro_degrees[] = {0,0,0};
 float magnetometer_data[] = {0,0,0};
+uint8_t magnetometer_new_sample = 0; // Set when magnetometer_data changed, the estimator clears it
 float gps_longitude = 0.0;
 float gps_latitude = 0.0;
 float pressure = 0.0;
 float temperature = 0.0;
 float altitude = 0.0;
+float vertical_velocity = 0.0;
 
 float target_pitch = 0.0;
 float target_roll = 0.0;
 float target_yaw = 0.0;
 float target_altitude = 0.0;
+float target_rates[] = {0.0, 0.0, 0.0}; // From the angle loop, pitch, roll and heading in deg/s
 
 float motor_power[] = {0.0, 0.0, 0.0, 0.0};
 
@@ -281,9 +450,6 @@ float roll = 50.0;
 uint8_t shit_encoder_mode = 0;
 uint8_t slowing_lock = 0;
 
-float last_raw_yaw = 0;
-float delta_yaw = 0;
-
 float minimum_signal_timing_seconds = 0.2; // Seconds
 uint32_t last_signal_timestamp = 0;
 
@@ -300,6 +466,7 @@ const uint8_t use_blackbox_logging = 1;
 
 // Keep track of time in each loop. Since loop start
 uint32_t startup_time = 0;
+uint32_t startup_time_micros = 0;
 uint32_t delta_time = 0;
 uint16_t time_since_startup_ms = 0;
 uint8_t time_since_startup_minutes = 0;
@@ -311,7 +478,7 @@ uint8_t time_since_startup_hours = 0;
 uint32_t loop_iteration = 1;
 float PID_proportional[3];
 float PID_integral[3];
-float PID_derivative[2];
+float PID_derivative[3];
 float PID_feed_forward[3];
 
 float PID_set_points[4];
@@ -325,6 +492,7 @@ uint8_t entered_loop = 0;
 
 uint8_t gps_output_buffer[GPS_OUTPUT_BUFFER_SIZE];
 uint8_t receive_buffer[GPS_RECEIVE_BUFFER_SIZE];
+volatile uint16_t gps_output_size = 0; // Set by the uart interrupt when gps_output_buffer has a message, 0 once it is parsed
 uint8_t got_gps = 0;
 
 // Interrupt for uart 2 data received
@@ -335,33 +503,20 @@ void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size){
     // If the stm32 is restarted  while it is initializing dma the
     // data arrives from the uart and it fucks up. So you have to restart it a few times
 
-    // HAL_GPIO_WritePin(GPIOC, GPIO_PIN_13, 1);
-
-    // if (huart->Instance == USART2){   
-    //     memcpy((uint8_t *)gps_output_buffer, receive_buffer, Size);
-
-    //     // printf("\n");
-    //     // for(uint16_t i = 0; i < GPS_RECEIVE_BUFFER_SIZE; i++){
-    //     //     printf("%c", gps_output_buffer[i]);
-    //     // }
-    //     // printf("\n");
-
-    //     if(entered_loop){
-    //         if(bn357_parse_and_store((unsigned char*)gps_output_buffer, Size)){
-    //             HAL_GPIO_WritePin(GPIOC, GPIO_PIN_13, GPIO_PIN_RESET);
-    //             // printf("Working UART2, %f, %f\n", bn357_get_latitude_decimal_format(), bn357_get_longitude_decimal_format());
-    //         }else{
-    //             HAL_GPIO_WritePin(GPIOC, GPIO_PIN_13, GPIO_PIN_SET);
-    //             // printf("Failed UART2, %f, %f\n", bn357_get_latitude_decimal_format(), bn357_get_longitude_decimal_format());
-    //         }
-    //     }else{
-    //         bn357_parse_and_store((unsigned char*)gps_output_buffer, Size);
-    //     }
-
-    //     /* start the DMA again */
-    //     HAL_UARTEx_ReceiveToIdle_DMA(&huart2, (uint8_t *)receive_buffer, GPS_RECEIVE_BUFFER_SIZE);
-    //     __HAL_DMA_DISABLE_IT(&hdma_usart2_rx, DMA_IT_HT);
-    // }
+    // Parsing takes too long for an interrupt, the gps task does it. A message that comes in while the
+    // last one is still waiting to be parsed is dropped, the gps only sends a few per second
+    if (huart->Instance == USART2){
+        if(gps_output_size == 0){
+            uint16_t size = Size < GPS_OUTPUT_BUFFER_SIZE ? Size : GPS_OUTPUT_BUFFER_SIZE - 1;
+            memcpy((uint8_t *)gps_output_buffer, receive_buffer, size);
+            gps_output_buffer[size] = '\0'; // The parser looks for the sentence with strstr
+            gps_output_size = size;
+        }
+
+        /* start the DMA again */
+        HAL_UARTEx_ReceiveToIdle_DMA(&huart2, (uint8_t *)receive_buffer, GPS_RECEIVE_BUFFER_SIZE);
+        __HAL_DMA_DISABLE_IT(&hdma_usart2_rx, DMA_IT_HT);
+    }
 }
 
 // Interrupt for uart 2 when it crashes to restart it
@@ -376,10 +531,35 @@ void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart){
     }
 }
 
+// Interrupt for pins. PB8 mpu6050 data ready, PA12 sd logger slave ready
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin){
+    if(GPIO_Pin == GPIO_PIN_8){
+        mpu6050_data_ready_interrupt();
+    }
+    sd_card_slave_ready_interrupt(GPIO_Pin);
+}
+
+// Interrupt for i2c dma read done. Sensor reads are queued through the i2c scheduler
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c){
+    i2c_scheduler_transfer_complete_callback(hi2c);
+}
+
+// Interrupt for i2c write done
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c){
+    i2c_scheduler_transfer_complete_callback(hi2c);
+}
+
+// Interrupt for i2c nack or bus error
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c){
+    i2c_scheduler_error_callback(hi2c);
+}
 
 struct pid pitch_pid;
 struct pid roll_pid;
 struct pid yaw_pid;
+struct pid pitch_rate_pid;
+struct pid roll_rate_pid;
+struct pid yaw_rate_pid;
 struct pid altitude_pid;
 
 
@@ -391,107 +571,331 @@ int main(void){
     HAL_GPIO_WritePin(GPIOC, GPIO_PIN_13, GPIO_PIN_SET);
 
     printf("STARTING PROGRAM\n"); 
+    if(print_fastmath_benchmark){
+        fastmath_print_benchmark();
+    }
+    if(print_filter_benchmark){
+        filters_print_benchmark();
+    }
     // calibrate_escs();
     if(init_sensors() == 0){
         return 0; // exit if initialization failed
     }
+    if(print_sensor_conversion_benchmark){
+        mpu6050_print_benchmark();
+        qmc5883l_print_benchmark();
+    }
+    if(print_attitude_ekf_benchmark){
+        attitude_ekf_print_benchmark(); // After init_sensors, before it the EKF has no noise set and divides by 0
+    }
     // check_calibrations();
-    calibrate_gyro(); // Recalibrate the gyro as the temperature affects the calibration
+    if(run_gyro_temperature_calibration){
+        calibrate_gyro_temperature_model();
+    }
+    if(!load_gyro_temperature_model()){
+        calibrate_gyro(); // No temperature model, recalibrate the gyro as the temperature affects the calibration
+    }
+    if(run_magnetometer_calibration){
+        calibrate_magnetometer();
+    }
+    load_magnetometer_calibration();
     get_initial_position();
 
-    pitch_pid = pid_init(pitch_roll_master_gain * pitch_roll_gain_p, pitch_roll_master_gain * pitch_roll_gain_i, pitch_roll_master_gain * pitch_roll_gain_d, 0.0, HAL_GetTick(), 20.0, -20.0, 1);
-    roll_pid = pid_init(pitch_roll_master_gain * pitch_roll_gain_p, pitch_roll_master_gain * pitch_roll_gain_i, pitch_roll_master_gain * pitch_roll_gain_d, 0.0, HAL_GetTick(), 20.0, -20.0, 1);
-    yaw_pid = pid_init(yaw_gain_p, yaw_gain_i, yaw_gain_d, 0.0, HAL_GetTick(), 0, 0, 0);
-    altitude_pid = pid_init(altitude_gain_p, altitude_gain_i, altitude_gain_d, 0.0, HAL_GetTick(), 0, 0, 0);
+    pitch_pid = pid_init(ANGLE_GAIN_P, 0.0, 0.0, 0.0, timebase_get_micros(), MAX_ANGLE_RATE_DPS, -MAX_ANGLE_RATE_DPS, 1);
+    roll_pid = pid_init(ANGLE_GAIN_P, 0.0, 0.0, 0.0, timebase_get_micros(), MAX_ANGLE_RATE_DPS, -MAX_ANGLE_RATE_DPS, 1);
+    yaw_pid = pid_init(yaw_gain_p, yaw_gain_i, yaw_gain_d, 0.0, timebase_get_micros(), MAX_ANGLE_RATE_DPS, -MAX_ANGLE_RATE_DPS, 1);
+    pitch_rate_pid = pid_init(rate_master_gain * rate_gain_p, rate_master_gain * rate_gain_i, rate_master_gain * rate_gain_d, 0.0, timebase_get_micros(), 20.0, -20.0, 1);
+    roll_rate_pid = pid_init(rate_master_gain * rate_gain_p, rate_master_gain * rate_gain_i, rate_master_gain * rate_gain_d, 0.0, timebase_get_micros(), 20.0, -20.0, 1);
+    yaw_rate_pid = pid_init(yaw_rate_gain_p, yaw_rate_gain_i, yaw_rate_gain_d, 0.0, timebase_get_micros(), 20.0, -20.0, 1);
+    pid_set_derivative_filter(&pitch_rate_pid, RATE_DERIVATIVE_FILTER_HZ);
+    pid_set_derivative_filter(&roll_rate_pid, RATE_DERIVATIVE_FILTER_HZ);
+    pid_set_derivative_filter(&yaw_rate_pid, RATE_DERIVATIVE_FILTER_HZ);
+    altitude_pid = pid_init(altitude_gain_p, altitude_gain_i, altitude_gain_d, 0.0, timebase_get_micros(), 0, 0, 0);
 
     setup_logging_to_sd();
 
     printf("Looping\n");
     altitude = 10;
+    init_profiler(FLIGHT_CONTROL_PERIOD_US);
+    profile_flight_control = profiler_add_section("flight");
+    profile_sensors = profiler_add_section("sensors");
+    profile_imu_read = profiler_add_section("imu read");
+    profile_pid_and_motors = profiler_add_section("pid, motors");
+    profile_magnetometer = profiler_add_section("magnetometer");
+    profile_dynamic_notch = profiler_add_section("dynamic notch");
+    profile_barometer = profiler_add_section("barometer");
+    profile_gps = profiler_add_section("gps");
+    profile_radio = profiler_add_section("radio");
+    profile_nrf24_receive = profiler_add_section("nrf24 rx");
+    profile_logging = profiler_add_section("logging");
+    profile_blackbox_encode = profiler_add_section("bbox encode");
+    profile_sd_write = profiler_add_section("sd write");
+
+    // Flight control is started by the mpu6050, the rest runs on the timebase at their own rates
+    init_task_scheduler();
+    flight_control_task = task_scheduler_add_task("flight", handle_flight_control, 0, TASK_PRIORITY_REALTIME, 600);
+    task_scheduler_add_task("magnetometer", handle_magnetometer, 1000000 / MAGNETOMETER_RATE_HZ, TASK_PRIORITY_HIGH, 300);
+    task_scheduler_add_task("barometer", handle_barometer, 1000000 / BAROMETER_RATE_HZ, TASK_PRIORITY_HIGH, 300);
+    task_scheduler_add_task("gps", handle_gps, 1000000 / GPS_RATE_HZ, TASK_PRIORITY_MEDIUM, 200);
+    task_scheduler_add_task("radio", handle_radio_communication, 1000000 / RADIO_RATE_HZ, TASK_PRIORITY_MEDIUM, 500);
+    logging_task = task_scheduler_add_task("logging", handle_logging, 0, TASK_PRIORITY_LOW, 300); // Triggered after every angle loop. Has to fit in the gap between two rate loops, the overruns show when it does not. A frame that is still waiting when the next angle loop triggers it again is lost, the missed count shows those
+    if(use_gyro_filters && use_dynamic_notch){
+        task_scheduler_add_task("dynamic notch", handle_dynamic_notch, 1000000 / DYNAMIC_NOTCH_RATE_HZ, TASK_PRIORITY_LOW, DYNAMIC_NOTCH_BUDGET_US);
+    }
+    if(calibrate_magnetometer_in_flight){
+        task_scheduler_add_task("mag calibration", handle_magnetometer_calibration, 1000000 / MAGNETOMETER_CALIBRATION_RATE_HZ, TASK_PRIORITY_LOW, 500);
+    }
+    if(print_profiler_report){
+        task_scheduler_add_task("profiler", handle_profiler_report, 1000000 / PROFILER_REPORT_RATE_HZ, TASK_PRIORITY_LOW, 6000);
+    }
+
     init_loop_timer();
     startup_time = HAL_GetTick();
+    startup_time_micros = timebase_get_micros();
     entered_loop = 1;
     while (1){
         // HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, 0);
 
-        handle_radio_communication();
-        handle_get_and_calculate_sensor_values(); // Important do do this right before the pid stuff.
-        handle_pid_and_motor_control();
-        handle_logging();
+        handle_loop_timing();
+        task_scheduler_run(get_time_until_flight_control());
+    }
+}
 
+void handle_flight_control(){
+    profiler_start(profile_flight_control);
+    uint32_t start_time = timebase_get_micros();
+    delta_loop_time = start_time - loop_start_time;
+    loop_start_time = start_time;
+    profiler_record_loop_period(delta_loop_time);
 
+    mpu6050_queue_fifo_read();
 
-        fix_gyro_axis(gyro_degrees); // switch back the x and y axis of gyro to how they were before. This is for sensor fusion not to be confused 
+    // The estimator corrections and the angle loop only every few rate loops
+    uint8_t angle_loop = ++rate_loop_count >= RATE_LOOPS_PER_ANGLE_LOOP;
+    if(angle_loop){
+        rate_loop_count = 0;
+    }
 
+    profiler_start(profile_sensors);
+    // The corrections use the samples of the rate loops before this one, so they run while the drain is on the bus
+    if(angle_loop){
+        handle_attitude_estimation();
+    }
+    handle_get_and_calculate_sensor_values(); // Important do do this right before the pid stuff.
+    profiler_end(profile_sensors);
+
+    profiler_start(profile_pid_and_motors);
+    handle_pid_and_motor_control(angle_loop);
+    profiler_end(profile_pid_and_motors);
+
+    if(angle_loop){
         loop_iteration++;
-        handle_loop_timing();
+        loop_end_time = timebase_get_micros();
+        task_scheduler_trigger(logging_task);
     }
+    profiler_end(profile_flight_control);
 }
 
-void handle_get_and_calculate_sensor_values(){
-    
-    temperature = bmp280_get_temperature_celsius();
+// Magnetometer reads run in the background, new data is picked up on a later call
+void handle_magnetometer(){
+    profiler_start(profile_magnetometer);
+    if(qmc5883l_update(magnetometer_data)){
+        magnetometer_new_sample = 1;
+        if(calibrate_magnetometer_in_flight){
+            float raw_magnetometer_data[3];
+            qmc5883l_get_raw_micro_teslas(raw_magnetometer_data);
+            magnetometer_calibration_add_sample(raw_magnetometer_data);
+        }
+    }
+    profiler_end(profile_magnetometer);
+}
+
+// The solve is too slow to do for every sample. A good result replaces the calibration right away
+void handle_magnetometer_calibration(){
+    struct magnetometer_calibration calibration;
+    if(magnetometer_calibration_solve(&calibration)){
+        qmc5883l_set_calibration(calibration.hard_iron, calibration.soft_iron);
+    }
+}
 
-    // calculate the altitude using gps altitude and a bmp280 reference altitude
-    // Reset the reference on bmp280 every time the gps gets updated
-    // So the barometer keeps track in between the gps updates and does so with the 
-    // origin of the precise altitude value from gps
+void handle_dynamic_notch(){
+    profiler_start(profile_dynamic_notch);
+    int8_t axis = dynamic_notch_update(DYNAMIC_NOTCH_BUDGET_US);
+    if(axis >= 0){
+        float frequencies[DYNAMIC_NOTCH_MAX_PEAKS];
+        dynamic_notch_get_frequencies_hz(axis, frequencies);
+        for(uint8_t i = 0; i < DYNAMIC_NOTCH_PEAK_COUNT; i++){
+            struct filter_stage notch = {FILTER_NOTCH, frequencies[i], GYRO_NOTCH_Q};
+            filter_chain_set_stage(&gyro_filters[axis], i, &notch);
+        }
+    }
+    profiler_end(profile_dynamic_notch);
+}
 
-    altitude = bmp280_get_height_meters_from_reference(0);
-    // altitude = get_sensor_fusion_altitude(bn357_get_altitude_meters() ,(float)bmp280_get_height_meters_from_reference(bn357_get_status_up_to_date(1)));
+void handle_barometer(){
+    profiler_start(profile_barometer);
+    // The height from the first reading goes into the vertical estimator, the altitude comes out of it in the sensor loop
+    if(bmp280_update()){
+        temperature = bmp280_get_latest_temperature_celsius();
+        pressure = bmp280_get_latest_pressure_hPa();
+        vertical_estimator_update_barometer(bmp280_calculate_height_meters_from_reference(pressure, 0));
+    }
+    profiler_end(profile_barometer);
+}
 
-    
+void handle_gps(){
+    profiler_start(profile_gps);
+    if(gps_output_size != 0){
+        bn357_parse_and_store((unsigned char*)gps_output_buffer, gps_output_size);
+        gps_output_size = 0;
+    }
     if(bn357_get_status_up_to_date(1)){
-        got_gps = 1;
+        got_gps = 1; // Cleared when the logging has written it
+        if(bn357_get_fix_quality() > 0 && bn357_get_satellites_quantity() >= GPS_MINIMUM_SATELLITES){
+            vertical_estimator_update_gps(bn357_get_altitude_meters());
+            gps_latitude = bn357_get_latitude_decimal_format();
+            gps_longitude = bn357_get_longitude_decimal_format();
+            inertial_navigation_update_gps(gps_latitude, gps_longitude, bn357_get_accuracy());
+        }
         // Do some gps location pid
-    }else{
-        got_gps = 0;
     }
+    profiler_end(profile_gps);
+}
 
-    mpu6050_get_accelerometer_readings_gravity(acceleration_data);
-    mpu6050_get_gyro_readings_dps(gyro_angular);
-    qmc5883l_magnetometer_readings_micro_teslas(magnetometer_data);
-
-    // Convert the sensor data to data that is useful
-    fix_mag_axis(magnetometer_data); // Switches around the x and the y of the magnetometer to match mpu6050 outputs
-    calculate_degrees_x_y(acceleration_data, &accelerometer_x_rotation, &accelerometer_y_rotation); // Get roll and pitch from the data. I call it x and y. Ranges -90 to 90. 
-
-    // My mpu6050 has a drift problem when rotating around z axis. I have only seen Joop Broking having this problem.
-    // Raw yaw - yaw without tilt adjustment
-    // Yaw - yaw with tilt adjustment
-    // Get raw yaw. The results of this adjustment have to modify the values of gyro degrees before complementary filter. So only the non tilt adjusted yaw is available
-    calculate_yaw(magnetometer_data, &magnetometer_z_rotation);
+void handle_profiler_report(){
+    if(!profiler_print_report_line(profiler_report_line)){
+        profiler_report_line = 0;
+        printf("\n");
+        return;
+    }
+    profiler_report_line++;
+}
 
-    // if(yaw != 50){ // This is not an issue when not rotating.
-    //     // Joop Brokings method did not work for me and it didn't make sense subtracting scaled total yaw. I subtract delta yaw instead
-    //     delta_yaw = angle_difference(magnetometer_z_rotation, last_raw_yaw); // Helper function to handle wrapping
+void handle_get_and_calculate_sensor_values(){
+    // The fifo drain should be done in well under a loop. A stuck sensor gets aborted by the i2c scheduler, the old values are kept then.
+    // Only the drain is waited for, the magnetometer and barometer reads queued behind it finish in the background
+    profiler_start(profile_imu_read);
+    mpu6050_wait_for_fifo_read(SENSOR_READ_TIMEOUT_MS);
+
+    // Everything the mpu6050 sampled since the last loop, added to what the angle loop gets
+    uint8_t first_sample = imu_fifo_sample_count;
+    uint8_t new_sample_count = mpu6050_get_queued_fifo_samples(&imu_fifo_samples[first_sample], MPU6050_FIFO_MAX_SAMPLES - first_sample);
+    imu_fifo_sample_count += new_sample_count;
+    profiler_end(profile_imu_read);
+    if(new_sample_count == 0){
+        return;
+    }
 
-    //     // gyro_angular[0] -= delta_yaw * -16.5; 
-    //     gyro_angular[0] -= delta_yaw * -5.0; 
+    // Every gyro sample on its own for the filters and the EKF
+    for(uint8_t i = first_sample; i < imu_fifo_sample_count; i++){
+        if(use_fixed_point_sensors){
+            // Kept in integers for the average in the angle loop, only the gyro for the filters is needed in float now
+            mpu6050_correct_sample_fixed(&imu_fifo_samples[i], &imu_fifo_fixed_samples[i]);
+            mpu6050_fixed_sample_to_float(&imu_fifo_fixed_samples[i], imu_fifo_sample_acceleration, imu_fifo_sample_gyro);
+        }else{
+            mpu6050_convert_sample(&imu_fifo_samples[i], imu_fifo_sample_acceleration, imu_fifo_sample_gyro);
+        }
+        for(uint8_t axis = 0; axis < 3; axis++){
+            imu_fifo_gyro[axis][i] = imu_fifo_sample_gyro[axis];
+        }
+        if(use_dynamic_notch){
+            dynamic_notch_push_sample(imu_fifo_sample_gyro);
+        }
+    }
 
-    //     // This robot doesn't use the y axis so i ignore it 
-    // }
+    // The rate loop uses the newest sample
+    for(uint8_t axis = 0; axis < 3; axis++){
+        if(use_gyro_filters){
+            filter_chain_apply_block(&gyro_filters[axis], &imu_fifo_gyro[axis][first_sample], &imu_fifo_gyro[axis][first_sample], new_sample_count);
+        }
+        gyro_angular[axis] = imu_fifo_gyro[axis][imu_fifo_sample_count - 1];
+    }
+}
 
-    // Save the raw yaw for next loop. No mater if yaw changes or not. Need to know the latest one
-    last_raw_yaw = magnetometer_z_rotation;
+// The samples of the last few rate loops, averaged down to one sample for the corrections
+void handle_attitude_estimation(){
+    float imu_average_gyro[3] = {0, 0, 0};
+    if(imu_fifo_sample_count > 0){
+        if(use_fixed_point_sensors){
+            // Averaged in integers and converted once for the estimator
+            struct mpu6050_fixed_sample imu_fixed_average;
+            mpu6050_average_fixed_samples(imu_fifo_fixed_samples, imu_fifo_sample_count, &imu_fixed_average);
+            mpu6050_fixed_sample_to_float(&imu_fixed_average, acceleration_data, imu_fifo_sample_gyro);
+            imu_sample.time = imu_fifo_samples[imu_fifo_sample_count - 1].time;
+        }else{
+            mpu6050_average_samples(imu_fifo_samples, imu_fifo_sample_count, &imu_sample);
+            mpu6050_convert_sample(&imu_sample, acceleration_data, imu_fifo_sample_gyro);
+        }
+        for(uint8_t axis = 0; axis < 3; axis++){
+            for(uint8_t i = 0; i < imu_fifo_sample_count; i++){
+                imu_average_gyro[axis] += imu_fifo_gyro[axis][i];
+            }
+            imu_average_gyro[axis] /= imu_fifo_sample_count;
+        }
+    }
 
-    // Use complementary filter to correct the gyro drift. 
-    convert_angular_rotation_to_degrees_x_y(gyro_angular, gyro_degrees, accelerometer_x_rotation, accelerometer_y_rotation, HAL_GetTick(), 1);
+    // Gyro, accelerometer and magnetometer go into the quaternion in one step. The magnetometer only when it has a new sample
+    if(imu_fifo_sample_count > 0){
+        if(previous_imu_sample_time != 0){
+            float imu_dt = timebase_get_seconds_between(previous_imu_sample_time, imu_sample.time);
+            if(use_attitude_ekf){
+                // The samples were taken evenly in between
+                for(uint8_t i = 0; i < imu_fifo_sample_count; i++){
+                    for(uint8_t axis = 0; axis < 3; axis++){
+                        imu_fifo_sample_gyro[axis] = imu_fifo_gyro[axis][i];
+                    }
+                    attitude_ekf_predict(imu_fifo_sample_gyro, imu_dt / imu_fifo_sample_count);
+                }
+                attitude_ekf_update_accelerometer(acceleration_data);
+                if(magnetometer_new_sample){
+                    attitude_ekf_update_magnetometer(magnetometer_data);
+                }
+            }else{
+                attitude_update(imu_average_gyro, acceleration_data, magnetometer_new_sample ? magnetometer_data : NULL, imu_dt);
+            }
+            magnetometer_new_sample = 0;
 
-    // Get yaw that is adjusted by x and y degrees
-    calculate_yaw_tilt_compensated(magnetometer_data, &magnetometer_z_rotation, gyro_degrees[0], gyro_degrees[1]);
+            // The accelerometer turned upright with the new attitude, gravity taken out
+            if(use_attitude_ekf){
+                attitude_ekf_get_rotation_matrix(attitude_rotation);
+            }else{
+                attitude_get_rotation_matrix(attitude_rotation);
+            }
+            vertical_estimator_predict(vertical_estimator_get_vertical_acceleration_mps2(attitude_rotation, acceleration_data), imu_dt);
+            altitude = vertical_estimator_get_altitude_meters();
+            vertical_velocity = vertical_estimator_get_vertical_velocity_mps();
+
+            inertial_navigation_get_horizontal_acceleration_mps2(attitude_rotation, acceleration_data, horizontal_acceleration);
+            inertial_navigation_predict(horizontal_acceleration, imu_dt);
+            inertial_navigation_get_position_meters(ned_position);
+            inertial_navigation_get_velocity_mps(ned_velocity);
+            ned_position[2] = -altitude;
+            ned_velocity[2] = -vertical_velocity;
+        }
+        previous_imu_sample_time = imu_sample.time;
+        imu_fifo_sample_count = 0;
+    }
 
-    // Complementary filter did not work good for magnetometer+gyro. 
-    // Gyro just too slow and inaccurate for this.
-    // I trust the magnetometer more than the gyro in this case.
-    gyro_degrees[2] = magnetometer_z_rotation;
+    // Roll, pitch and the compass heading for the pids. The heading turns the same way calculate_yaw_tilt_compensated did
+    if(use_attitude_ekf){
+        attitude_ekf_get_euler_degrees(gyro_degrees);
+    }else{
+        attitude_get_euler_degrees(gyro_degrees);
+    }
 
-    fix_gyro_axis(gyro_degrees); // switch the x and y axis of gyro
+    fix_gyro_axis(gyro_degrees); // The pids call the rotation around y pitch. The estimator does not read gyro_degrees back so this is the only switch
 }
 
 void handle_radio_communication(){
-    if(nrf24_data_available(1)){ // takes 3-4 ms
-        nrf24_receive(rx_data); // takes 8-9 ms
+    profiler_start(profile_radio);
+    profiler_start(profile_nrf24_receive);
+    uint8_t radio_data_available = nrf24_data_available(1);
+    if(radio_data_available){
+        nrf24_receive(rx_data);
+    }
+    profiler_end(profile_nrf24_receive);
+
+    if(radio_data_available){
         // Get the type of request
         extract_request_type(rx_data, strlen(rx_data), rx_type);
 
@@ -603,8 +1007,9 @@ void handle_radio_communication(){
 
             last_yaw = yaw;
 
-        }else if(strcmp(rx_type, "pid") == 0){
-            printf("\nGot pid");
+        }else if(strcmp(rx_type, "ratePid") == 0 || strcmp(rx_type, "pid") == 0){
+            // Tunes the pitch and roll rate loop. "pid" is the old name the remote still sends
+            printf("\nGot rate pid");
 
             float added_proportional = 0;
             float added_integral = 0;
@@ -613,27 +1018,27 @@ void handle_radio_communication(){
 
             extract_pid_request_values(rx_data, strlen(rx_data), &added_proportional, &added_integral, &added_derivative, &added_master_gain);
 
-            pitch_roll_gain_p = BASE_PITCH_ROLL_GAIN_P + added_proportional;
-            pitch_roll_gain_i = BASE_PITCH_ROLL_GAIN_I + added_integral;
-            pitch_roll_gain_d = BASE_PITCH_ROLL_GAIN_D + added_derivative;
-            pitch_roll_master_gain = BASE_PITCH_ROLL_MASTER_GAIN + added_master_gain;
+            rate_gain_p = RATE_GAIN_P + added_proportional;
+            rate_gain_i = RATE_GAIN_I + added_integral;
+            rate_gain_d = RATE_GAIN_D + added_derivative;
+            rate_master_gain = RATE_MASTER_GAIN + added_master_gain;
 
-            added_pitch_roll_gain_p = added_proportional;
-            added_pitch_roll_gain_i = added_integral;
-            added_pitch_roll_gain_d = added_derivative;
-            added_pitch_roll_master_gain = added_master_gain;
+            added_rate_gain_p = added_proportional;
+            added_rate_gain_i = added_integral;
+            added_rate_gain_d = added_derivative;
+            added_rate_master_gain = added_master_gain;
 
-            // Configure the pitch pid 
-            pid_set_proportional_gain(&pitch_pid, pitch_roll_gain_p * pitch_roll_master_gain);
-            pid_set_integral_gain(&pitch_pid, pitch_roll_gain_i * pitch_roll_master_gain);
-            pid_set_derivative_gain(&pitch_pid, pitch_roll_gain_d * pitch_roll_master_gain);
-            pid_reset_integral_sum(&pitch_pid);
+            // Configure the pitch rate pid 
+            pid_set_proportional_gain(&pitch_rate_pid, rate_gain_p * rate_master_gain);
+            pid_set_integral_gain(&pitch_rate_pid, rate_gain_i * rate_master_gain);
+            pid_set_derivative_gain(&pitch_rate_pid, rate_gain_d * rate_master_gain);
+            pid_reset_integral_sum(&pitch_rate_pid);
 
-            // Configure the roll pid 
-            pid_set_proportional_gain(&roll_pid, pitch_roll_gain_p * pitch_roll_master_gain);
-            pid_set_integral_gain(&roll_pid, pitch_roll_gain_i * pitch_roll_master_gain);
-            pid_set_derivative_gain(&roll_pid, pitch_roll_gain_d * pitch_roll_master_gain);
-            pid_reset_integral_sum(&roll_pid);
+            // Configure the roll rate pid 
+            pid_set_proportional_gain(&roll_rate_pid, rate_gain_p * rate_master_gain);
+            pid_set_integral_gain(&roll_rate_pid, rate_gain_i * rate_master_gain);
+            pid_set_derivative_gain(&roll_rate_pid, rate_gain_d * rate_master_gain);
+            pid_reset_integral_sum(&roll_rate_pid);
 
         }else if(strcmp(rx_type, "remoteSyncBase") == 0){
             printf("\nGot remoteSyncBase");
@@ -645,10 +1050,11 @@ void handle_radio_communication(){
 
         rx_type[0] = '\0'; // Clear out the string by setting its first char to string terminator
     }
+    profiler_end(profile_radio);
 }
 
-void handle_pid_and_motor_control(){
-    // float error_altitude = mapValue(pid_get_error(&altitude_pid, altitude, HAL_GetTick()), -180.0, 180.0, -100.0, 100.0);
+void handle_pid_and_motor_control(uint8_t angle_loop){
+    // float error_altitude = mapValue(pid_get_error(&altitude_pid, altitude, timebase_get_micros()), -180.0, 180.0, -100.0, 100.0);
     // printf("Altitude error %6.2f ", error_altitude);
     
     // For the robot to do work it needs to be receiving radio signals and at the correct angles, facing up
@@ -659,40 +1065,70 @@ void handle_pid_and_motor_control(){
         gyro_degrees[1] > -30 && 
         ((float)HAL_GetTick() - (float)last_signal_timestamp) / 1000.0 <= minimum_signal_timing_seconds
     ){
-        pid_set_desired_value(&pitch_pid, target_pitch);
-        pid_set_desired_value(&roll_pid, target_roll);
-        // pid_set_desired_value(&yaw_pid, target_yaw);
-        // pid_set_desired_value(&altitude_pid, target_altitude);
-
-        PID_set_points[0] = target_pitch;
-        PID_set_points[1] = target_roll;
-        PID_set_points[2] = target_yaw;
+        uint32_t time = timebase_get_micros();
+        float rate_loop_dt = delta_loop_time / 1000000.0f;
 
         // pitch is facing to the sides
         // roll is facing forwards and backwards
-        error_pitch = pid_get_error(&pitch_pid, gyro_degrees[0], HAL_GetTick());
-        PID_proportional[0] = pid_get_last_proportional_error(&pitch_pid);
-        PID_integral[0] = pid_get_last_integral_error(&pitch_pid);
-        PID_derivative[0] = pid_get_last_derivative_error(&pitch_pid);
-
-        error_roll = pid_get_error(&roll_pid, gyro_degrees[1], HAL_GetTick());
-        PID_proportional[1] = pid_get_last_proportional_error(&roll_pid);
-        PID_integral[1] = pid_get_last_integral_error(&roll_pid);
-        PID_derivative[1] = pid_get_last_derivative_error(&roll_pid);
-        
-        // error_yaw = pid_get_error(&yaw_pid, gyro_degrees[2], HAL_GetTick());
-        PID_proportional[2] = pid_get_last_proportional_error(&yaw_pid);
-        PID_integral[2] = pid_get_last_integral_error(&yaw_pid);
-        // PID_derivative[2] = pid_get_last_derivative_error(&yaw_pid);
+        if(angle_loop){
+            pid_set_desired_value(&pitch_pid, target_pitch);
+            pid_set_desired_value(&roll_pid, target_roll);
+            // pid_set_desired_value(&altitude_pid, target_altitude);
+
+            target_rates[0] = pid_get_error(&pitch_pid, gyro_degrees[0], time);
+            target_rates[1] = pid_get_error(&roll_pid, gyro_degrees[1], time);
+
+            // The heading wraps at 180, the error is the short way around
+            target_rates[2] = pid_get_error_own_error(&yaw_pid, angle_difference(gyro_degrees[2], target_yaw), time);
+        }
+
+        PID_set_points[0] = target_rates[0];
+        PID_set_points[1] = target_rates[1];
+        PID_set_points[2] = target_rates[2];
+
+        // The gyro in the same axes as gyro_degrees. Close enough to level the angles change at these rates
+        float rates[3] = {gyro_angular[0], gyro_angular[1], gyro_angular[2]};
+        fix_gyro_axis(rates);
+        rates[2] = -rates[2]; // The heading counts the other way around than the gyro z
 
-        // error_altitude = pid_get_error(&roll_pid, altitude, HAL_GetTick());
+        pid_set_desired_value(&pitch_rate_pid, target_rates[0]);
+        error_pitch = pid_update(&pitch_rate_pid, rates[0], rate_loop_dt);
+        PID_proportional[0] = pid_get_last_proportional_error(&pitch_rate_pid);
+        PID_integral[0] = pid_get_last_integral_error(&pitch_rate_pid);
+        PID_derivative[0] = pid_get_last_derivative_error(&pitch_rate_pid);
+
+        pid_set_desired_value(&roll_rate_pid, target_rates[1]);
+        error_roll = pid_update(&roll_rate_pid, rates[1], rate_loop_dt);
+        PID_proportional[1] = pid_get_last_proportional_error(&roll_rate_pid);
+        PID_integral[1] = pid_get_last_integral_error(&roll_rate_pid);
+        PID_derivative[1] = pid_get_last_derivative_error(&roll_rate_pid);
+
+        pid_set_desired_value(&yaw_rate_pid, target_rates[2]);
+        error_yaw = pid_update(&yaw_rate_pid, rates[2], rate_loop_dt);
+        PID_proportional[2] = pid_get_last_proportional_error(&yaw_rate_pid);
+        PID_integral[2] = pid_get_last_integral_error(&yaw_rate_pid);
+        PID_derivative[2] = pid_get_last_derivative_error(&yaw_rate_pid);
+
+        // error_altitude = pid_get_error(&roll_pid, altitude, timebase_get_micros());
 
         error_altitude = throttle*0.9;
 
-        motor_power[0] = error_altitude + (-error_pitch) +  (-error_roll);
-        motor_power[1] = error_altitude + (-error_pitch) +  ( error_roll);
-        motor_power[2] = error_altitude + ( error_pitch) +  ( error_roll);
-        motor_power[3] = error_altitude + ( error_pitch) +  (-error_roll);
+        // Diagonal motors spin the same way, speeding up one pair against the other turns the drone
+        motor_power[0] = error_altitude + (-error_pitch) +  (-error_roll) + ( error_yaw);
+        motor_power[1] = error_altitude + (-error_pitch) +  ( error_roll) + (-error_yaw);
+        motor_power[2] = error_altitude + ( error_pitch) +  ( error_roll) + ( error_yaw);
+        motor_power[3] = error_altitude + ( error_pitch) +  (-error_roll) + (-error_yaw);
+
+        // A motor past its limit cannot do what the rate loops want, their integrals stop growing until it is back
+        uint8_t mixer_saturated = 0;
+        for(uint8_t i = 0; i < 4; i++){
+            if(motor_power[i] > 100.0 || motor_power[i] < 0.0){
+                mixer_saturated = 1;
+            }
+        }
+        pid_set_saturated(&pitch_rate_pid, mixer_saturated);
+        pid_set_saturated(&roll_rate_pid, mixer_saturated);
+        pid_set_saturated(&yaw_rate_pid, mixer_saturated);
 
 
         // Motor A (4) 13740 rpm or 229 rotations per second
@@ -743,17 +1179,35 @@ void handle_pid_and_motor_control(){
 
         PID_derivative[0] = 0;
         PID_derivative[1] = 0;
+        PID_derivative[2] = 0;
+
+        target_rates[0] = 0;
+        target_rates[1] = 0;
+        target_rates[2] = 0;
+
+        // Start clean when it arms, nothing from the last flight or from being carried around
+        uint32_t time = timebase_get_micros();
+        pid_reset(&pitch_pid, time);
+        pid_reset(&roll_pid, time);
+        pid_reset(&yaw_pid, time);
+        pid_reset(&pitch_rate_pid, time);
+        pid_reset(&roll_rate_pid, time);
+        pid_reset(&yaw_rate_pid, time);
+
+        // Hold whatever heading it has when it starts flying, not the one from before it was carried around
+        target_yaw = gyro_degrees[2];
     }
 }
 
 void handle_logging(){
+    profiler_start(profile_logging);
     delta_time = HAL_GetTick() - startup_time;
     time_since_startup_hours = delta_time / 3600000;
     time_since_startup_minutes = (delta_time - time_since_startup_hours * 3600000) / 60000;
     time_since_startup_seconds = (delta_time - time_since_startup_hours * 3600000 - time_since_startup_minutes * 60000) / 1000;
     time_since_startup_ms = delta_time - time_since_startup_hours * 3600000 - time_since_startup_minutes * 60000 - time_since_startup_seconds * 1000;
 
-    uint32_t time_blackbox = ((time_since_startup_hours * 60 + time_since_startup_minutes * 60) + time_since_startup_seconds) * 1000000 + time_since_startup_ms * 1000; 
+    uint32_t time_blackbox = timebase_get_micros() - startup_time_micros; 
 
     // Print out for debugging
     // printf("%d:%02d:%02d:%03d;", time_since_startup_hours, time_since_startup_minutes, time_since_startup_seconds, time_since_startup_ms);
@@ -775,6 +1229,7 @@ void handle_logging(){
         uint16_t data_size = 0;
 
         if(use_blackbox_logging){
+            profiler_start(profile_blackbox_encode);
             char* betaflight_data_string = betaflight_blackbox_get_encoded_data_string(
                 loop_iteration,
                 time_blackbox,
@@ -790,8 +1245,10 @@ void handle_logging(){
                 magnetometer_data,
                 gyro_degrees,
                 altitude,
+                (int32_t)profiler_get_last_loop_period(), // Loop period jitter in the log
                 &data_size
             );
+            profiler_end(profile_blackbox_encode);
             char* sd_card_buffer = sd_card_get_buffer_pointer(1);
             uint16_t sd_card_buffer_index = 0;
             uint16_t betaflight_data_string_index = 0;
@@ -823,6 +1280,7 @@ void handle_logging(){
                     betaflight_gps_string_index++;
                 }
                 free(betaflight_gps_string);
+                got_gps = 0;
             }
         }else{
             // Log a bit of data
@@ -838,6 +1296,7 @@ void handle_logging(){
             sd_card_append_to_buffer(1, "\n");
         } 
         
+        profiler_start(profile_sd_write);
         if(sd_card_async){
             if(use_simple_async){
                 sd_special_write_chunk_of_string_data_no_slave_response(sd_card_get_buffer_pointer(1));
@@ -860,6 +1319,7 @@ void handle_logging(){
                 sd_card_initialized = sd_special_write_chunk_of_string_data(sd_card_get_buffer_pointer(1));
             }
         }
+        profiler_end(profile_sd_write);
     }
 
     // Update the blue led with current sd state
@@ -868,6 +1328,7 @@ void handle_logging(){
     }else{
         HAL_GPIO_WritePin(GPIOC, GPIO_PIN_13, GPIO_PIN_SET);
     }
+    profiler_end(profile_logging);
 }
 
 void setup_logging_to_sd(){
@@ -968,6 +1429,7 @@ void init_STM32_peripherals(){
     MX_SPI1_Init();
     MX_TIM1_Init();
     MX_TIM2_Init();
+    MX_TIM5_Init();
     MX_SPI3_Init();
     HAL_Delay(1);
     MX_USART2_UART_Init();
@@ -978,6 +1440,7 @@ void init_STM32_peripherals(){
     HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_4);
     HAL_TIM_PWM_Start(&htim2, TIM_CHANNEL_1);
     HAL_TIM_PWM_Start(&htim2, TIM_CHANNEL_2);
+    init_timebase(&htim5);
 
     HAL_GPIO_WritePin(GPIOB, GPIO_PIN_4, GPIO_PIN_SET);
     HAL_GPIO_WritePin(GPIOB, GPIO_PIN_5, GPIO_PIN_SET);
@@ -1018,10 +1481,21 @@ void calibrate_escs(){
 uint8_t init_sensors(){
     printf("-----------------------------INITIALIZING MODULES...\n");
 
-    uint8_t mpu6050 = init_mpu6050(&hi2c1, 1, accelerometer_correction, gyro_correction, REFRESH_RATE_HZ, complementary_ratio);
-    uint8_t qmc5883l = init_qmc5883l(&hi2c1, 1, hard_iron_correction, soft_iron_correction);
-
-    uint8_t bmp280 = init_bmp280(&hi2c1);
+    init_i2c_scheduler(&hi2c1);
+    init_flash_storage();
+
+    uint8_t mpu6050 = init_mpu6050(&hi2c1, 1, accelerometer_correction, gyro_correction, imu_alignment, REFRESH_RATE_HZ, complementary_ratio);
+    init_attitude(ATTITUDE_PROPORTIONAL_GAIN, ATTITUDE_INTEGRAL_GAIN);
+    init_attitude_ekf(ATTITUDE_EKF_GYRO_NOISE_DENSITY_DPS, ATTITUDE_EKF_GYRO_BIAS_WALK_DPS, ATTITUDE_EKF_ACCELEROMETER_NOISE_G, ATTITUDE_EKF_HEADING_NOISE_DEGREES);
+    init_vertical_estimator(VERTICAL_ESTIMATOR_ACCELEROMETER_NOISE_MPS2, VERTICAL_ESTIMATOR_ACCELEROMETER_BIAS_WALK_MPS2, VERTICAL_ESTIMATOR_BAROMETER_NOISE_METERS, VERTICAL_ESTIMATOR_GPS_NOISE_METERS);
+    init_inertial_navigation(INERTIAL_NAVIGATION_ACCELEROMETER_NOISE_MPS2, INERTIAL_NAVIGATION_ACCELEROMETER_BIAS_WALK_MPS2, INERTIAL_NAVIGATION_GPS_NOISE_METERS, MAGNETIC_DECLINATION_DEGREES);
+    uint8_t qmc5883l = init_qmc5883l(&hi2c1, 1, hard_iron_correction, soft_iron_correction, magnetometer_alignment, MAGNETOMETER_OUTPUT_DATA_RATE, DATA_READY_STATUS_REGISTER);
+    mpu6050_use_fixed_point(use_fixed_point_sensors);
+    qmc5883l_use_fixed_point(use_fixed_point_sensors);
+    init_magnetometer_calibration(MAGNETOMETER_FIELD_NORM_MICRO_TESLAS, MAGNETOMETER_CALIBRATION_FORGETTING_FACTOR, MAGNETOMETER_CALIBRATION_SAMPLE_DISTANCE_MICRO_TESLAS);
+    magnetometer_calibration_reset_with_center(hard_iron_correction);
+
+    uint8_t bmp280 = init_bmp280(&hi2c1, OS_PRES_16, OS_TEMP_1, FILTER_MODE_16, SB_MODE_0_5);
     // uint8_t bme280 = init_bme280(&hi2c1);
     // uint8_t bmp680 = init_bmp680(&hi2c1);
     // uint8_t ms5611 = init_ms5611(&hi2c1);
@@ -1042,11 +1516,35 @@ uint8_t init_sensors(){
     // Continue initializing
     nrf24_rx_mode(tx_address, 10);
 
+    // The gyro sample clock drives the loop from now on. The loop wakes up every few samples and drains the fifo
+    if(!mpu6050_configure(IMU_SAMPLE_RATE_HZ, DLPF_184HZ, GYRO_FULL_SCALE_250DPS, ACCEL_FULL_SCALE_2G)){
+        printf("MPU6050 configuration failed\n");
+        return 0;
+    }
+    if(!mpu6050_enable_data_ready_interrupt(IMU_SAMPLES_PER_LOOP)){
+        printf("MPU6050 data ready interrupt failed\n");
+        return 0;
+    }
+    if(!mpu6050_enable_fifo()){
+        printf("MPU6050 fifo failed\n");
+        return 0;
+    }
+    for(uint8_t axis = 0; axis < 3; axis++){
+        if(!init_filter_chain(&gyro_filters[axis], gyro_filter_stages, sizeof(gyro_filter_stages) / sizeof(gyro_filter_stages[0]), IMU_SAMPLE_RATE_HZ)){
+            printf("Gyro filter setup failed\n");
+            return 0;
+        }
+    }
+    if(!init_dynamic_notch(IMU_SAMPLE_RATE_HZ, DYNAMIC_NOTCH_MINIMUM_HZ, DYNAMIC_NOTCH_MAXIMUM_HZ, DYNAMIC_NOTCH_PEAK_COUNT, GYRO_NOTCH_HZ)){
+        printf("Dynamic notch setup failed\n");
+        return 0;
+    }
+
     return 1;
 }
 
 void init_loop_timer(){
-    loop_start_time = HAL_GetTick();
+    loop_start_time = timebase_get_micros();
 }
 
 void check_calibrations(){
@@ -1067,25 +1565,75 @@ void calibrate_gyro(){
 
 
 
+// The fixed gyro correction is not used anymore once this is loaded
+uint8_t load_gyro_temperature_model(){
+    struct mpu6050_gyro_temperature_model model;
+    if(!flash_storage_read(FLASH_STORAGE_SLOT_GYRO_TEMPERATURE_MODEL, &model, sizeof(model))){
+        return 0;
+    }
+    mpu6050_set_gyro_temperature_model(&model);
+    printf("Gyro temperature model loaded, reference %.2f C\n", model.reference_celsius);
+    return 1;
+}
+
+void calibrate_gyro_temperature_model(){
+    struct mpu6050_gyro_temperature_model model;
+    if(!mpu6050_fit_gyro_temperature_model(GYRO_TEMPERATURE_CALIBRATION_MS, GYRO_TEMPERATURE_CALIBRATION_MIN_SPAN_CELSIUS, &model)){
+        return;
+    }
+    if(!flash_storage_write(FLASH_STORAGE_SLOT_GYRO_TEMPERATURE_MODEL, &model, sizeof(model))){
+        printf("Failed to store the gyro temperature model\n");
+    }
+}
+
+// Replaces the hard and soft iron from the top of the file
+uint8_t load_magnetometer_calibration(){
+    struct magnetometer_calibration calibration;
+    if(!flash_storage_read(FLASH_STORAGE_SLOT_MAGNETOMETER_CALIBRATION, &calibration, sizeof(calibration))){
+        return 0;
+    }
+    qmc5883l_set_calibration(calibration.hard_iron, calibration.soft_iron);
+    magnetometer_calibration_reset_with_center(calibration.hard_iron);
+    printf("Magnetometer calibration loaded, hard iron %.2f %.2f %.2f\n", calibration.hard_iron[0], calibration.hard_iron[1], calibration.hard_iron[2]);
+    return 1;
+}
+
+void calibrate_magnetometer(){
+    printf("Magnetometer calibration, turn the drone around in every direction\n");
+    uint32_t start_time = HAL_GetTick();
+    while(HAL_GetTick() - start_time < MAGNETOMETER_CALIBRATION_MS){
+        float raw_magnetometer_data[3];
+        qmc5883l_magnetometer_readings_micro_teslas(magnetometer_data);
+        qmc5883l_get_raw_micro_teslas(raw_magnetometer_data);
+        magnetometer_calibration_add_sample(raw_magnetometer_data);
+        HAL_Delay(20); // The qmc5883l runs at 50Hz
+    }
+
+    struct magnetometer_calibration calibration;
+    if(!magnetometer_calibration_solve(&calibration)){
+        printf("Magnetometer calibration failed, %lu samples, fit error %.4f\n", (unsigned long)magnetometer_calibration_get_sample_count(), magnetometer_calibration_get_fit_error());
+        return;
+    }
+    printf("Magnetometer calibration done, fit error %.4f\n", magnetometer_calibration_get_fit_error());
+    if(!flash_storage_write(FLASH_STORAGE_SLOT_MAGNETOMETER_CALIBRATION, &calibration, sizeof(calibration))){
+        printf("Failed to store the magnetometer calibration\n");
+    }
+}
+
 void get_initial_position(){
     // Find the initial position in degrees and apply it to the gyro measurement integral
     // This will tell the robot which way to go to get the actual upward
     mpu6050_get_accelerometer_readings_gravity(acceleration_data);
     mpu6050_get_gyro_readings_dps(gyro_angular);
     qmc5883l_magnetometer_readings_micro_teslas(magnetometer_data);
-    fix_mag_axis(magnetometer_data); // Switches around the x and the y to match mpu6050
-
-    calculate_degrees_x_y(acceleration_data, &accelerometer_x_rotation, &accelerometer_y_rotation);
 
-    // Get a good raw yaw for calculations later
-    calculate_yaw(magnetometer_data, &magnetometer_z_rotation);
-    last_raw_yaw = magnetometer_z_rotation;
+    // The estimator starts where the sensors say it is instead of converging from level
+    attitude_set_from_sensors(acceleration_data, magnetometer_data);
+    attitude_get_euler_degrees(gyro_degrees);
 
-    calculate_yaw_tilt_compensated(magnetometer_data, &magnetometer_z_rotation, accelerometer_x_rotation, accelerometer_y_rotation);
-
-    gyro_degrees[0] = accelerometer_x_rotation;
-    gyro_degrees[1] = accelerometer_y_rotation;
-    gyro_degrees[2] = magnetometer_z_rotation;
+    float initial_quaternion[4];
+    attitude_get_quaternion(initial_quaternion);
+    attitude_ekf_set_quaternion(initial_quaternion);
 
     printf("Initial location x: %.2f y: %.2f, z: %.2f\n", gyro_degrees[0], gyro_degrees[1], gyro_degrees[2]);
 
@@ -1093,21 +1641,20 @@ void get_initial_position(){
     target_yaw = gyro_degrees[2];
 }
 
+// Flight control runs when the mpu6050 has collected a loop worth of samples. If the interrupt stops it still runs at half rate
 void handle_loop_timing(){
-    loop_end_time = HAL_GetTick();
-    delta_loop_time = loop_end_time - loop_start_time;
-
-    // printf("b%d", delta_loop_time);
-    
-    // This one is more precise than using HAL_Delay
-    while((1000 / REFRESH_RATE_HZ) > HAL_GetTick()-loop_start_time);
-
-    uint32_t temp_loop_start_time = loop_start_time;
-    loop_start_time = HAL_GetTick();
+    if(mpu6050_check_data_ready()){
+        task_scheduler_trigger(flight_control_task);
+    }else if(timebase_get_micros() - loop_start_time >= DATA_READY_TIMEOUT_MS * 1000){
+        missed_data_ready_count++;
+        task_scheduler_trigger(flight_control_task);
+    }
+}
 
-    loop_end_time = HAL_GetTick();
-    delta_loop_time = loop_end_time - temp_loop_start_time;
-    // printf("a%d\n", delta_loop_time);
+// The other tasks only start if they fit in this
+uint32_t get_time_until_flight_control(){
+    int32_t time_left = (int32_t)(loop_start_time + FLIGHT_CONTROL_PERIOD_US - timebase_get_micros());
+    return time_left > 0 ? time_left : 0;
 }
 
 // 0.5ms to 2ms = range is 1.5ms
@@ -1145,10 +1692,6 @@ float mapValue(float value, float input_min, float input_max, float output_min,
     return output_value;
 }
 
-float get_sensor_fusion_altitude(float gps_altitude, float barometer_altitude){
-    return gps_altitude + barometer_altitude;
-}
-
 // Extract the values form a slash separated stirng into specific variables for motion control parameters 
 void extract_joystick_request_values_uint(char *request, uint8_t request_size, uint8_t *throttle, uint8_t *yaw, uint8_t *roll, uint8_t *pitch)
 {
@@ -1244,18 +1787,6 @@ void extract_joystick_request_values_float(char *request, uint8_t request_size,
     *pitch = atof(pitch_string);
 }
 
-// Switch magnetometer axis. x-> y and y->x
-void fix_mag_axis(float *magnetometer_data_temp)
-{
-    float temp = 0.0;
-    temp = magnetometer_data_temp[0];
-    // y is x
-    magnetometer_data_temp[0] = magnetometer_data_temp[1];
-    // x is -y
-    magnetometer_data_temp[1] = -temp;
-}
-
-
 void fix_gyro_axis(float *gyro_data_temp){
     float temp = 0.0;
     temp = gyro_data_temp[0];
@@ -1331,7 +1862,7 @@ void extract_pid_request_values(char *request, uint8_t request_size, float *adde
 void track_time(){
     uint32_t delta_loop_time_temp = loop_end_time - loop_start_time;
 
-    printf("%5ld ms ", delta_loop_time_temp);
+    printf("%5lu us ", (unsigned long)delta_loop_time_temp);
 }
 
 // Map value from a specified range to a new range
@@ -1382,10 +1913,10 @@ void send_pid_base_info_to_remote(){
 
     // Make a slash separated value
     char *string = generate_message_pid_values_nrf24(
-        BASE_PITCH_ROLL_GAIN_P, 
-        BASE_PITCH_ROLL_GAIN_I, 
-        BASE_PITCH_ROLL_GAIN_D,
-        BASE_PITCH_ROLL_MASTER_GAIN
+        RATE_GAIN_P, 
+        RATE_GAIN_I, 
+        RATE_GAIN_D,
+        RATE_MASTER_GAIN
     );
     
 
@@ -1411,10 +1942,10 @@ void send_pid_added_info_to_remote(){
 
     // Make a slash separated value
     char *string = generate_message_pid_values_nrf24(
-        added_pitch_roll_gain_p, 
-        added_pitch_roll_gain_i, 
-        added_pitch_roll_gain_d,
-        added_pitch_roll_master_gain
+        added_rate_gain_p, 
+        added_rate_gain_i, 
+        added_rate_gain_d,
+        added_rate_master_gain
     );
     
     // The remote always receives data as a gibberish with corrupted characters. Sending many of them will mean the remote can reconstruct the message
@@ -1780,6 +2311,51 @@ static void MX_TIM2_Init(void)
 
 }
 
+/**
+  * @brief TIM5 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM5_Init(void)
+{
+
+  /* USER CODE BEGIN TIM5_Init 0 */
+
+  /* USER CODE END TIM5_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM5_Init 1 */
+  // Free running 1MHz counter for the timebase, 75MHz timer clock
+  /* USER CODE END TIM5_Init 1 */
+  htim5.Instance = TIM5;
+  htim5.Init.Prescaler = 75-1;
+  htim5.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim5.Init.Period = 4294967295;
+  htim5.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim5.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim5) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim5, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim5, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM5_Init 2 */
+
+  /* USER CODE END TIM5_Init 2 */
+
+}
+
 /**
   * @brief USART1 Initialization Function
   * @param None
@@ -1856,6 +2432,9 @@ static void MX_DMA_Init(void)
   __HAL_RCC_DMA1_CLK_ENABLE();
 
   /* DMA interrupt init */
+  /* DMA1_Stream0_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
   /* DMA1_Stream5_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Stream5_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Stream5_IRQn);
@@ -1916,7 +2495,16 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
   HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : PB8 */
+  GPIO_InitStruct.Pin = GPIO_PIN_8;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+  GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+  HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
   /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+
   HAL_NVIC_SetPriority(EXTI15_10_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
 